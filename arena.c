@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) Mike Brady 2024
+ * All rights reserved.
+ * Mike Brady <4265913+mikebrady@users.noreply.github.com>
+
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "arena.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_FIRST_CHUNK_SIZE 4096
+#define ARENA_LARGEST_CHUNK_SIZE (1024 * 1024)
+#define ARENA_ALIGNMENT 16
+
+struct arena_chunk {
+  arena_chunk *previous;
+  size_t size; // the space after the header
+  max_align_t data[];
+};
+
+static arena_statistics totals;
+static pthread_mutex_t totals_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t aligned(size_t size) {
+  return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+arena *arena_create(void) {
+  arena *new_arena = calloc(1, sizeof(arena));
+  if (new_arena != NULL) {
+    pthread_mutex_init(&new_arena->lock, NULL);
+    pthread_mutex_lock(&totals_lock);
+    totals.arena_count++;
+    pthread_mutex_unlock(&totals_lock);
+  }
+  return new_arena;
+}
+
+void arena_release(arena *arena) {
+  if (arena != NULL) {
+    size_t chunk_count = 0;
+    while (arena->chunk != NULL) {
+      arena_chunk *previous = arena->chunk->previous;
+      free(arena->chunk);
+      arena->chunk = previous;
+      chunk_count++;
+    }
+    debug(3, "released an arena of %zu chunks holding %zu bytes in %zu allocations.",
+          chunk_count, arena->bytes_reserved, arena->allocation_count);
+    pthread_mutex_lock(&totals_lock);
+    totals.bytes_reserved -= arena->bytes_reserved;
+    pthread_mutex_unlock(&totals_lock);
+    pthread_mutex_destroy(&arena->lock);
+    free(arena);
+  }
+}
+
+// with the arena locked, make room for size bytes in the current chunk, adding a new chunk
+// twice the size of the last one if needed
+static int make_room(arena *arena, size_t size) {
+  if ((arena->chunk != NULL) && (arena->used + size <= arena->chunk->size))
+    return 0;
+  size_t chunk_size = ARENA_FIRST_CHUNK_SIZE;
+  if (arena->chunk != NULL) {
+    chunk_size = arena->chunk->size * 2;
+    if (chunk_size > ARENA_LARGEST_CHUNK_SIZE)
+      chunk_size = ARENA_LARGEST_CHUNK_SIZE;
+  }
+  while (chunk_size < size)
+    chunk_size *= 2;
+  arena_chunk *chunk = malloc(sizeof(arena_chunk) + chunk_size);
+  if (chunk == NULL)
+    return -1;
+  chunk->previous = arena->chunk;
+  chunk->size = chunk_size;
+  arena->chunk = chunk;
+  arena->used = 0;
+  arena->bytes_reserved += chunk_size;
+  pthread_mutex_lock(&totals_lock);
+  totals.chunk_count++;
+  totals.bytes_reserved += chunk_size;
+  if (totals.bytes_reserved > totals.peak_bytes_reserved)
+    totals.peak_bytes_reserved = totals.bytes_reserved;
+  pthread_mutex_unlock(&totals_lock);
+  return 0;
+}
+
+static void count_allocation(arena *arena, size_t size) {
+  arena->allocation_count++;
+  arena->bytes_allocated += size;
+  pthread_mutex_lock(&totals_lock);
+  totals.allocation_count++;
+  totals.bytes_allocated += size;
+  pthread_mutex_unlock(&totals_lock);
+}
+
+void *arena_alloc(arena *arena, size_t size) {
+  void *block = NULL;
+  size = aligned(size == 0 ? 1 : size);
+  pthread_mutex_lock(&arena->lock);
+  if (make_room(arena, size) == 0) {
+    block = (uint8_t *)arena->chunk->data + arena->used;
+    arena->used += size;
+    count_allocation(arena, size);
+  }
+  pthread_mutex_unlock(&arena->lock);
+  if (block != NULL)
+    memset(block, 0, size);
+  return block;
+}
+
+void *arena_grow(arena *arena, void *block, size_t old_size, size_t new_size) {
+  if (new_size <= old_size)
+    return block;
+  void *new_block = NULL;
+  size_t old_aligned = aligned(old_size);
+  size_t new_aligned = aligned(new_size);
+  pthread_mutex_lock(&arena->lock);
+  if ((block != NULL) && (arena->chunk != NULL) &&
+      ((uint8_t *)block + old_aligned == (uint8_t *)arena->chunk->data + arena->used) &&
+      (arena->used - old_aligned + new_aligned <= arena->chunk->size)) {
+    // it's the latest allocation and there's room after it
+    arena->used += new_aligned - old_aligned;
+    arena->bytes_allocated += new_aligned - old_aligned;
+    pthread_mutex_lock(&totals_lock);
+    totals.bytes_allocated += new_aligned - old_aligned;
+    pthread_mutex_unlock(&totals_lock);
+    new_block = block;
+  } else if (make_room(arena, new_aligned) == 0) {
+    new_block = (uint8_t *)arena->chunk->data + arena->used;
+    arena->used += new_aligned;
+    count_allocation(arena, new_aligned);
+  }
+  pthread_mutex_unlock(&arena->lock);
+  if (new_block != NULL) {
+    if ((new_block != block) && (old_size != 0))
+      memcpy(new_block, block, old_size);
+    memset((uint8_t *)new_block + old_size, 0, new_aligned - old_size);
+  }
+  return new_block;
+}
+
+void arena_get_statistics(arena_statistics *statistics) {
+  pthread_mutex_lock(&totals_lock);
+  *statistics = totals;
+  pthread_mutex_unlock(&totals_lock);
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) Mike Brady 2024
+ * All rights reserved.
+ * Mike Brady <4265913+mikebrady@users.noreply.github.com>
+
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// A bump allocator for the results of probing a card. Everything found out about a card --
+// its devices, interfaces, configuration bundles and configuration sets -- is allocated from
+// the card's arena and is freed in one go when the arena is released. Space is taken from
+// chunks that double in size as the arena grows, so a card with many interfaces needs only a
+// handful of calls to malloc. An arena can be used from more than one thread at a time.
+
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+typedef struct arena_chunk arena_chunk;
+
+typedef struct {
+  arena_chunk *chunk; // the chunk being allocated from, which links to the ones before it
+  size_t used;        // the space used in the current chunk
+  size_t allocation_count;
+  size_t bytes_allocated; // the space handed out
+  size_t bytes_reserved;  // the space in all the chunks
+  pthread_mutex_t lock;
+} arena;
+
+// Run-wide totals, covering every arena there has been.
+typedef struct {
+  size_t arena_count;
+  size_t chunk_count;
+  size_t allocation_count;
+  size_t bytes_allocated;
+  size_t bytes_reserved;      // the space held in arenas now
+  size_t peak_bytes_reserved; // the most space held in arenas at any one time
+} arena_statistics;
+
+// return NULL if the arena can't be created
+arena *arena_create(void);
+// free the arena and everything allocated from it; arena may be NULL
+void arena_release(arena *arena);
+
+// return size bytes of zeroed, suitably aligned space, or NULL if none can be had
+void *arena_alloc(arena *arena, size_t size);
+// Make the space at block, which was allocated with old_size bytes, new_size bytes long,
+// keeping its contents. The space is extended where it is if it's the latest allocation and
+// there is room; otherwise it's copied to new space and the old space isn't used again.
+// block may be NULL if old_size is zero. Return NULL, leaving block as it was, on failure.
+void *arena_grow(arena *arena, void *block, size_t old_size, size_t new_size);
+
+void arena_get_statistics(arena_statistics *statistics);
+
+#endif // _ARENA_H
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) Mike Brady 2024
+ * All rights reserved.
+ * Mike Brady <4265913+mikebrady@users.noreply.github.com>
+
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// The calls into alsa-lib that a scan is made of, behind a table of functions, so that a scan can
+// be made against something other than the sound system. There are three backends:
+//
+// - alsa_backend makes the calls to alsa-lib, and is the one normally used.
+// - The recording backend passes every call on to another backend and writes each call, with
+//   its arguments and results, to a trace file.
+// - The replay backend plays a trace file back, giving each call the results it had when it was
+//   recorded, without touching the sound system. A scan replayed with the same probe engine
+//   makes the same calls in the same order; if it makes a different call, the replay of that
+//   interface is said to have diverged and every call from then on fails with -EIO.
+//
+// The PCM calls are made one interface at a time on each thread, on the handle returned by
+// pcm_open(); the calls that take only a configuration space take the handle too, so that a
+// recording or replaying backend knows which interface they belong to.
+
+#ifndef _BACKEND_H
+#define _BACKEND_H
+
+#include "dacquery.h"
+
+#define CHANNEL_MAP_STORE_SIZE 128
+
+// the channel maps a PCM offers for each channel count, whatever its configuration
+typedef struct {
+  bitset channel_counts; // the channel counts that have a channel map
+  char map[BITSET_SIZE][CHANNEL_MAP_STORE_SIZE];
+  int type[BITSET_SIZE]; // the snd_pcm_chmap_type of each map
+} channel_map_list;
+
+typedef struct {
+  const char *(*library_version)(void);
+  // the cards, what is on each of them, and their mixers
+  size_t (*get_control_interface_names)(char ***control_interface_names);
+  int (*get_card_info)(const char *control_interface_name, card_probe *card);
+  int (*enumerate_card)(const char *control_interface_name, card_probe *card);
+  int (*load_mixers)(const char *device_name, mixer_bundle_t *mixers);
+  // the calls made while probing an interface
+  int (*pcm_open)(snd_pcm_t **handle, const char *interface_name, snd_pcm_stream_t stream);
+  int (*pcm_close)(snd_pcm_t *handle);
+  // fill in the type of the PCM and the card, device and subdevice it uses
+  int (*pcm_identity)(snd_pcm_t *handle, pcm_signature *signature);
+  int (*hw_free)(snd_pcm_t *handle);
+  int (*hw_params_any)(snd_pcm_t *handle, snd_pcm_hw_params_t *params);
+  int (*hw_params_set_access)(snd_pcm_t *handle, snd_pcm_hw_params_t *params,
+                              snd_pcm_access_t access);
+  int (*hw_params_set_channels)(snd_pcm_t *handle, snd_pcm_hw_params_t *params,
+                                unsigned int channels);
+  int (*hw_params_set_format)(snd_pcm_t *handle, snd_pcm_hw_params_t *params,
+                              snd_pcm_format_t format);
+  int (*hw_params_set_rate_near)(snd_pcm_t *handle, snd_pcm_hw_params_t *params,
+                                 unsigned int *rate, int *dir);
+  int (*hw_params_test_channels)(snd_pcm_t *handle, snd_pcm_hw_params_t *params,
+                                 unsigned int channels);
+  int (*hw_params_test_format)(snd_pcm_t *handle, snd_pcm_hw_params_t *params,
+                               snd_pcm_format_t format);
+  int (*hw_params_get_channels_min)(snd_pcm_t *handle, const snd_pcm_hw_params_t *params,
+                                    unsigned int *channels);
+  int (*hw_params_get_channels_max)(snd_pcm_t *handle, const snd_pcm_hw_params_t *params,
+                                    unsigned int *channels);
+  int (*hw_params_get_rate_min)(snd_pcm_t *handle, const snd_pcm_hw_params_t *params,
+                                unsigned int *rate);
+  int (*hw_params_get_rate_max)(snd_pcm_t *handle, const snd_pcm_hw_params_t *params,
+                                unsigned int *rate);
+  void (*hw_params_get_format_mask)(snd_pcm_t *handle, snd_pcm_hw_params_t *params,
+                                    snd_pcm_format_mask_t *mask);
+  // the period and buffer size limits left in the configuration space
+  int (*hw_params_get_buffer_limits)(snd_pcm_t *handle, const snd_pcm_hw_params_t *params,
+                                     buffer_limits *limits);
+  int (*hw_params)(snd_pcm_t *handle, snd_pcm_hw_params_t *params); // commit the parameters
+  // the channel map of the committed configuration, or "" -- store has CHANNEL_MAP_STORE_SIZE
+  void (*get_channel_map)(snd_pcm_t *handle, char *store);
+  // the channel maps of every channel count, without committing a configuration -- return
+  // -ENXIO if the driver can't be asked for them
+  int (*query_channel_maps)(snd_pcm_t *handle, channel_map_list *maps);
+} probe_backend;
+
+extern const probe_backend alsa_backend;
+
+// return NULL if the trace file can't be opened -- errno says why
+const probe_backend *recording_backend_open(const probe_backend *recorded, const char *path);
+// finish writing the trace file; return 0 on success
+int recording_backend_close(void);
+
+// return NULL if the trace file can't be read or isn't a trace file
+const probe_backend *replay_backend_open(const char *path);
+// the number of interfaces on which the replay diverged from the recording
+unsigned int replay_backend_divergences(void);
+void replay_backend_close(void);
+
+#endif // _BACKEND_H
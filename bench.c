@@ -0,0 +1,422 @@
+/*
+ * Copyright (c) Mike Brady 2024
+ * All rights reserved.
+ * Mike Brady <4265913+mikebrady@users.noreply.github.com>
+
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// A benchmark of the probe engine that needs no sound hardware. It writes an ALSA configuration
+// defining a number of virtual PCMs -- null and file PCMs, and plug, rate, route and linear PCMs
+// that restrict the formats, rates or channel counts they accept -- points ALSA_CONFIG_PATH at
+// it and probes each PCM just as dacquery would probe an interface. Every kind of PCM is
+// defined a number of times over, so that there is enough work to time. It reports the number
+// of probes per second, the wall time per interface and the peak resident set size as JSON.
+//
+// The results for each kind of PCM are compared with golden output, and the time per interface
+// with a baseline from an earlier run. It fails if the results differ or if the time per
+// interface has grown by more than the threshold. With --record, it writes the golden output
+// and the baseline instead. The results depend on the version of alsa-lib, so golden output
+// recorded with a different version is not compared, and the timing depends on the machine, so
+// a baseline recorded on a different host is not compared either. Comparisons that can't be
+// made are skipped with a message, unless --strict is given, when they are failures.
+//
+// Afterwards, silence is streamed to a null PCM, as --stress would stream it to an interface, to
+// find the smallest period size at which it plays without an xrun, using the first format,
+// channel count and rate it was found to accept. A null PCM takes whatever it is given, so every
+// period size is tried, down to the smallest it allows; the result is part of the golden output,
+// and an error streaming to it is a failure.
+//
+// dacquery.c is included, with its main() renamed, so that its static functions can be used.
+
+#define main dacquery_main
+#include "dacquery.c"
+#undef main
+
+#include <sys/resource.h>
+#include <time.h>
+
+// Each kind of PCM is defined in terms of "bench_sink", a null PCM, which accepts anything.
+typedef struct {
+  const char *kind;
+  const char *definition;
+} bench_pcm_kind;
+
+static const bench_pcm_kind bench_pcm_kinds[] = {
+    {"null", "type null"},
+    {"file", "type file slave.pcm \"bench_sink\" file \"/dev/null\" format \"raw\""},
+    {"plug_s16_48000_2",
+     "type plug slave { pcm \"bench_sink\" format S16_LE rate 48000 channels 2 }"},
+    {"plug_float_96000_8",
+     "type plug slave { pcm \"bench_sink\" format FLOAT_LE rate 96000 channels 8 }"},
+    {"rate_44100",
+     "type rate slave { pcm \"bench_sink\" rate 44100 format S16_LE } converter \"linear\""},
+    {"linear_s32", "type linear slave { pcm \"bench_sink\" format S32_LE }"},
+    {"route_2_of_6",
+     "type route slave { pcm \"bench_sink\" channels 6 } ttable.0.0 1 ttable.1.1 1"},
+    {"route_1_of_rate_48000",
+     "type route slave { pcm { type rate slave { pcm \"bench_sink\" rate 48000 format S16_LE } "
+     "converter \"linear\" } channels 2 } ttable.0.0 1 ttable.0.1 1"},
+};
+
+#define BENCH_PCM_KIND_COUNT (sizeof(bench_pcm_kinds) / sizeof(bench_pcm_kind))
+
+// each period size is streamed to for this long -- long enough for a write or two to be made
+#define BENCH_STRESS_TRIAL_MILLISECONDS 10
+
+static double seconds_since(const struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+static int write_alsa_configuration(const char *path, unsigned int copies) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL)
+    return -errno;
+  fprintf(file, "pcm.bench_sink { type null }\n");
+  unsigned int copy;
+  size_t ki;
+  for (copy = 0; copy < copies; copy++)
+    for (ki = 0; ki < BENCH_PCM_KIND_COUNT; ki++)
+      fprintf(file, "pcm.bench_%s_%u { %s }\n", bench_pcm_kinds[ki].kind, copy,
+              bench_pcm_kinds[ki].definition);
+  return fclose(file) == 0 ? 0 : -errno;
+}
+
+// return the contents of the file, or NULL if it can't be read
+static char *read_file(const char *path) {
+  char *contents = NULL;
+  FILE *file = fopen(path, "r");
+  if (file != NULL) {
+    size_t size = 0;
+    FILE *stream = open_memstream(&contents, &size);
+    if (stream != NULL) {
+      char buffer[4096];
+      size_t length;
+      while ((length = fread(buffer, 1, sizeof(buffer), file)) != 0)
+        fwrite(buffer, 1, length, stream);
+      fclose(stream);
+    }
+    fclose(file);
+  }
+  return contents;
+}
+
+static int write_file(const char *path, const char *contents) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL)
+    return -errno;
+  fputs(contents, file);
+  return fclose(file) == 0 ? 0 : -errno;
+}
+
+// probe the PCM and describe what was found, under the name of its kind, so that the results for
+// every copy of a kind are the same
+static void probe_pcm(probe_context *context, arena *arena, const char *pcm_name,
+                      const char *kind, FILE *results) {
+  configuration_bundle *configuration =
+      get_permissible_configuration_settings(context, arena, pcm_name, SND_PCM_STREAM_PLAYBACK,
+                                             "Bench", "Bench", NULL, 0);
+  fprintf(results, ">>> \"%s\":\n", kind);
+  if (configuration == NULL)
+    fprintf(results, "no result.\n");
+  else if (configuration->error_status != 0)
+    fprintf(results, "error %d: \"%s\".\n", configuration->error_status,
+            snd_strerror(configuration->error_status));
+  else
+    print_configuration(configuration, 1, results);
+}
+
+#define BASELINE_MISSING -1.0
+#define BASELINE_OTHER_HOST -2.0
+
+// return the time per interface in the baseline, or BASELINE_MISSING if there isn't one, or
+// BASELINE_OTHER_HOST if it was recorded on a host other than this one
+static double baseline_microseconds_per_interface(const char *path, const char *host) {
+  double value = BASELINE_MISSING;
+  char *baseline = read_file(path);
+  if (baseline != NULL) {
+    char host_field[300];
+    snprintf(host_field, sizeof(host_field), "\"host\":\"%s\"", host);
+    const char *key = "\"microseconds_per_interface\":";
+    char *field = strstr(baseline, key);
+    if (strstr(baseline, host_field) == NULL)
+      value = BASELINE_OTHER_HOST;
+    else if (field != NULL)
+      value = strtod(field + strlen(key), NULL);
+    free(baseline);
+  }
+  return value;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [--copies N] [--golden FILE] [--baseline FILE] [--threshold PERCENT]\n"
+          "       [--report FILE] [--record | --strict]\n",
+          name);
+}
+
+int main(int argc, char *argv[]) {
+  unsigned int copies = 4;
+  const char *golden_path = NULL;
+  const char *baseline_path = NULL;
+  const char *report_path = NULL;
+  double threshold = 20.0;
+  int record = 0;
+  int strict = 0; // non-zero if a comparison that can't be made is a failure
+  int i;
+  for (i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "--record") == 0)) {
+      record = 1;
+    } else if ((strcmp(argv[i], "--strict") == 0)) {
+      strict = 1;
+    } else if (i + 1 >= argc) {
+      usage(argv[0]);
+      return 1;
+    } else if (strcmp(argv[i], "--copies") == 0) {
+      copies = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--golden") == 0) {
+      golden_path = argv[++i];
+    } else if (strcmp(argv[i], "--baseline") == 0) {
+      baseline_path = argv[++i];
+    } else if (strcmp(argv[i], "--threshold") == 0) {
+      threshold = strtod(argv[++i], NULL);
+    } else if (strcmp(argv[i], "--report") == 0) {
+      report_path = argv[++i];
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (copies == 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  char config_path[64];
+  snprintf(config_path, sizeof(config_path), "/tmp/dacquery-bench-%d.conf", getpid());
+  if (write_alsa_configuration(config_path, copies) != 0) {
+    fprintf(stderr, "could not write the ALSA configuration \"%s\".\n", config_path);
+    return 1;
+  }
+  // this must be done before alsa-lib reads its configuration
+  setenv("ALSA_CONFIG_PATH", config_path, 1);
+  snd_lib_error_set_handler((snd_lib_error_handler_t)snd_error_quiet);
+  debug_init(0, 0, 0, 0);
+
+  probe_context context;
+  arena *arena = arena_create();
+  if ((arena == NULL) || (probe_context_init(&context) != 0)) {
+    fprintf(stderr, "could not allocate memory for the benchmark.\n");
+    unlink(config_path);
+    return 1;
+  }
+
+  int result = 0;
+  char **results = calloc(copies, sizeof(char *));
+  size_t pcm_count = 0;
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  unsigned int copy;
+  for (copy = 0; (results != NULL) && (copy < copies); copy++) {
+    size_t size;
+    FILE *stream = open_memstream(&results[copy], &size);
+    if (stream != NULL) {
+      size_t ki;
+      for (ki = 0; ki < BENCH_PCM_KIND_COUNT; ki++) {
+        char pcm_name[128];
+        snprintf(pcm_name, sizeof(pcm_name), "bench_%s_%u", bench_pcm_kinds[ki].kind, copy);
+        probe_pcm(&context, arena, pcm_name, bench_pcm_kinds[ki].kind, stream);
+        pcm_count++;
+      }
+      fclose(stream);
+    }
+  }
+  double wall_time = seconds_since(&start);
+
+  xrun_settings stress_settings;
+  stress_settings.trial_milliseconds = BENCH_STRESS_TRIAL_MILLISECONDS;
+  stress_settings.priority = 0;
+  xrun_result stress_result;
+  memset(&stress_result, 0, sizeof(stress_result));
+  snd_pcm_format_t stress_format = SND_PCM_FORMAT_UNKNOWN;
+  int stress_channels = 0, stress_rate_index = -1;
+  struct timespec stress_start;
+  clock_gettime(CLOCK_MONOTONIC, &stress_start);
+  configuration_bundle *null_configuration =
+      get_permissible_configuration_settings(&context, arena, "bench_null_0",
+                                             SND_PCM_STREAM_PLAYBACK, "Bench", "Bench", NULL, 0);
+  if ((null_configuration != NULL) && (null_configuration->error_status == 0) &&
+      (null_configuration->configuration_sets_count != 0)) {
+    configuration_set *set = &null_configuration->configuration_sets[0];
+    stress_format = (snd_pcm_format_t)bitset_next(&set->format_set, -1);
+    stress_channels = bitset_next(&set->channel_set, -1);
+    stress_rate_index = bitset_next(&set->rate_set, -1);
+  }
+  if ((stress_format < 0) || (stress_channels < 0) || (stress_rate_index < 0)) {
+    fprintf(stderr, "the null PCM could not be probed, so it could not be streamed to.\n");
+    result = 1;
+  } else if (xrun_find_smallest_period("bench_null_0", stress_format, stress_channels,
+                                       rates_to_check[stress_rate_index], &stress_settings,
+                                       &stress_result) != 0) {
+    fprintf(stderr, "error %d (\"%s\") streaming to the null PCM.\n", stress_result.error,
+            snd_strerror(stress_result.error));
+    result = 1;
+  }
+  double stress_time = seconds_since(&stress_start);
+  unlink(config_path);
+  if ((results == NULL) || (pcm_count != copies * BENCH_PCM_KIND_COUNT)) {
+    fprintf(stderr, "could not allocate memory for the results.\n");
+    return 1;
+  }
+  for (copy = 1; copy < copies; copy++) {
+    if (strcmp(results[copy], results[0]) != 0) {
+      fprintf(stderr, "the results for copy %u of the PCMs differ from those for copy 0.\n",
+              copy);
+      result = 1;
+    }
+  }
+
+  // the golden output is the results for one copy of each kind of PCM
+  char *golden = NULL;
+  size_t golden_size;
+  FILE *golden_stream = open_memstream(&golden, &golden_size);
+  if (golden_stream == NULL) {
+    fprintf(stderr, "could not allocate memory for the results.\n");
+    return 1;
+  }
+  fprintf(golden_stream, "alsa-lib %s\n%s", snd_asoundlib_version(), results[0]);
+  if (stress_rate_index >= 0)
+    fprintf(golden_stream,
+            ">>> stress \"null\" at %u/%s/%d: %u trials, period size %u, buffer size %u, "
+            "%u xruns at period size %u.\n",
+            rates_to_check[stress_rate_index], snd_pcm_format_name(stress_format),
+            stress_channels, stress_result.trials, stress_result.period_size,
+            stress_result.buffer_size, stress_result.xruns, stress_result.failed_period_size);
+  fclose(golden_stream);
+  int matches_golden = -1; // not compared
+  if ((golden_path != NULL) && (record != 0)) {
+    if (write_file(golden_path, golden) != 0) {
+      fprintf(stderr, "could not write the golden output \"%s\".\n", golden_path);
+      result = 1;
+    }
+  } else if (golden_path != NULL) {
+    char *expected = read_file(golden_path);
+    if (expected == NULL) {
+      fprintf(stderr,
+              "skipped: there is no golden output in \"%s\" to compare the results with -- use "
+              "--record to make it.\n",
+              golden_path);
+      if (strict != 0)
+        result = 1;
+    } else if (strncmp(expected, golden, strcspn(golden, "\n") + 1) != 0) {
+      fprintf(stderr,
+              "skipped: the golden output in \"%s\" was recorded with a different version of "
+              "alsa-lib, so the results can't be compared with it -- use --record to make it "
+              "again.\n",
+              golden_path);
+      if (strict != 0)
+        result = 1;
+    } else {
+      matches_golden = strcmp(expected, golden) == 0;
+      if (matches_golden == 0) {
+        fprintf(stderr, "the results differ from the golden output in \"%s\":\n%s", golden_path,
+                golden);
+        result = 1;
+      }
+    }
+    free(expected);
+  }
+
+  double microseconds_per_interface = wall_time * 1e6 / pcm_count;
+  int within_threshold = -1; // not compared
+  char host[256] = "";
+  gethostname(host, sizeof(host) - 1);
+  if ((baseline_path != NULL) && (record == 0)) {
+    double baseline = baseline_microseconds_per_interface(baseline_path, host);
+    if (baseline == BASELINE_MISSING) {
+      fprintf(stderr,
+              "skipped: there is no baseline in \"%s\" to compare the timing with -- use "
+              "--record to make it.\n",
+              baseline_path);
+      if (strict != 0)
+        result = 1;
+    } else if (baseline == BASELINE_OTHER_HOST) {
+      fprintf(stderr,
+              "skipped: the baseline in \"%s\" was recorded on a different host, so the timing "
+              "can't be compared with it -- use --record to make it again.\n",
+              baseline_path);
+      if (strict != 0)
+        result = 1;
+    } else {
+      within_threshold = microseconds_per_interface <= baseline * (1.0 + threshold / 100.0);
+      if (within_threshold == 0) {
+        fprintf(stderr,
+                "%.2f microseconds per interface is more than %.0f%% slower than the baseline "
+                "of %.2f.\n",
+                microseconds_per_interface, threshold, baseline);
+        result = 1;
+      }
+    }
+  }
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  json_writer writer;
+  memset(&writer, 0, sizeof(writer));
+  json_record_begin(&writer);
+  json_string(&writer, "alsa_version", snd_asoundlib_version());
+  json_string(&writer, "host", host);
+  json_integer(&writer, "pcm_kinds", BENCH_PCM_KIND_COUNT);
+  json_integer(&writer, "interfaces", pcm_count);
+  json_number(&writer, "wall_seconds", wall_time);
+  json_number(&writer, "probes_per_second", pcm_count / wall_time);
+  json_number(&writer, "microseconds_per_interface", microseconds_per_interface);
+  json_integer(&writer, "peak_rss_kb", usage.ru_maxrss);
+  json_integer(&writer, "stress_trials", stress_result.trials);
+  json_integer(&writer, "stress_period_size", stress_result.period_size);
+  json_number(&writer, "stress_seconds", stress_time);
+  if (matches_golden >= 0)
+    json_boolean(&writer, "matches_golden", matches_golden);
+  if (within_threshold >= 0)
+    json_boolean(&writer, "within_threshold", within_threshold);
+  json_record_end(&writer);
+  if (writer.failed == 0) {
+    printf("%s\n", writer.buffer);
+    if ((report_path != NULL) && (write_file(report_path, writer.buffer) != 0))
+      fprintf(stderr, "could not write the report \"%s\".\n", report_path);
+    if ((baseline_path != NULL) && (record != 0) &&
+        (write_file(baseline_path, writer.buffer) != 0)) {
+      fprintf(stderr, "could not write the baseline \"%s\".\n", baseline_path);
+      result = 1;
+    }
+  }
+  json_writer_free(&writer);
+
+  free(golden);
+  for (copy = 0; copy < copies; copy++)
+    free(results[copy]);
+  free(results);
+  probe_context_free(&context);
+  arena_release(arena);
+  return result;
+}
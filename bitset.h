@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) Mike Brady 2024
+ * All rights reserved.
+ * Mike Brady <4265913+mikebrady@users.noreply.github.com>
+
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// A small fixed-width set of bits, used for the sets of sample formats, rates and channel counts
+// a device accepts. A format is represented by the bit numbered by its snd_pcm_format_t value, a
+// rate by the bit numbered by its position in the list of rates to check and a channel count by
+// the bit numbered by the count. Iteration goes straight
+// from one member to the next, rather than testing each bit in turn.
+
+#ifndef _BITSET_H
+#define _BITSET_H
+
+#include <stdint.h>
+
+#define BITSET_WORDS 2
+#define BITSET_SIZE (64 * BITSET_WORDS)
+
+typedef struct {
+  uint64_t word[BITSET_WORDS];
+} bitset;
+
+static inline void bitset_clear(bitset *set) {
+  unsigned int w;
+  for (w = 0; w < BITSET_WORDS; w++)
+    set->word[w] = 0;
+}
+
+static inline void bitset_add(bitset *set, unsigned int bit) {
+  set->word[bit / 64] |= (uint64_t)1 << (bit % 64);
+}
+
+static inline void bitset_remove(bitset *set, unsigned int bit) {
+  set->word[bit / 64] &= ~((uint64_t)1 << (bit % 64));
+}
+
+static inline int bitset_contains(const bitset *set, unsigned int bit) {
+  return (set->word[bit / 64] & ((uint64_t)1 << (bit % 64))) != 0;
+}
+
+static inline int bitset_is_empty(const bitset *set) {
+  unsigned int w;
+  for (w = 0; w < BITSET_WORDS; w++)
+    if (set->word[w] != 0)
+      return 0;
+  return 1;
+}
+
+static inline int bitset_equal(const bitset *a, const bitset *b) {
+  unsigned int w;
+  for (w = 0; w < BITSET_WORDS; w++)
+    if (a->word[w] != b->word[w])
+      return 0;
+  return 1;
+}
+
+// add the members of b to a
+static inline void bitset_union(bitset *a, const bitset *b) {
+  unsigned int w;
+  for (w = 0; w < BITSET_WORDS; w++)
+    a->word[w] |= b->word[w];
+}
+
+// remove from a anything that isn't in b
+static inline void bitset_intersect(bitset *a, const bitset *b) {
+  unsigned int w;
+  for (w = 0; w < BITSET_WORDS; w++)
+    a->word[w] &= b->word[w];
+}
+
+// remove from a anything that is in b
+static inline void bitset_subtract(bitset *a, const bitset *b) {
+  unsigned int w;
+  for (w = 0; w < BITSET_WORDS; w++)
+    a->word[w] &= ~b->word[w];
+}
+
+static inline unsigned int bitset_count(const bitset *set) {
+  unsigned int count = 0;
+  unsigned int w;
+  for (w = 0; w < BITSET_WORDS; w++)
+    count += __builtin_popcountll(set->word[w]);
+  return count;
+}
+
+// return the lowest member greater than after, or -1 if there is none
+// Use an after of -1 to get the lowest member of all.
+static inline int bitset_next(const bitset *set, int after) {
+  unsigned int bit = (unsigned int)(after + 1);
+  while (bit < BITSET_SIZE) {
+    uint64_t rest = set->word[bit / 64] >> (bit % 64);
+    if (rest != 0)
+      return bit + __builtin_ctzll(rest);
+    bit = (bit / 64 + 1) * 64; // on to the start of the next word
+  }
+  return -1;
+}
+
+// bit must be an int
+#define bitset_for_each(bit, set)                                                                 \
+  for ((bit) = bitset_next((set), -1); (bit) >= 0; (bit) = bitset_next((set), (bit)))
+
+#endif // _BITSET_H
@@ -25,6 +25,12 @@
  */
 
 #include "dacquery.h"
+#include "backend.h"
+#include "daemon.h"
+#include "json_writer.h"
+#include "probe_cache.h"
+#include "trace.h"
+#include "xrun.h"
 #include <alsa/asoundlib.h>
 #include <assert.h>
 #include <ctype.h>
@@ -33,15 +39,23 @@
 #include <fcntl.h> /* Definition of AT_* constants */
 #include <getopt.h>
 #include <grp.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <math.h>
 #include <poll.h>
+#include <pthread.h>
 #include <pwd.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
 
 int display_extended_information = 0;
 // int include_mixers_with_capture = 0;
@@ -54,23 +68,165 @@ snd_error_quiet(__attribute__((unused)) const char *file, __attribute__((unused)
   // return NULL;
 }
 
-#define MIXER_BUNDLE_SIZE 32
+// return a new, zeroed entry at the end of the bundle, or NULL if there's no room for it. The
+// array of mixers doubles in size when it's full.
+static mixer_info_t *new_mixer(mixer_bundle_t *mixer_bundle) {
+  if (mixer_bundle->first_free == mixer_bundle->size) {
+    size_t new_size = mixer_bundle->size == 0 ? 16 : mixer_bundle->size * 2;
+    mixer_info_t *new_mixers = arena_grow(mixer_bundle->arena, mixer_bundle->mixer,
+                                          sizeof(mixer_info_t) * mixer_bundle->size,
+                                          sizeof(mixer_info_t) * new_size);
+    if (new_mixers == NULL) {
+      debug(1, "could not allocate memory for mixer %zu.", mixer_bundle->first_free);
+      return NULL;
+    }
+    mixer_bundle->mixer = new_mixers;
+    mixer_bundle->size = new_size;
+  }
+  return &mixer_bundle->mixer[mixer_bundle->first_free++];
+}
 
-typedef struct {
-  char name[64];
-  unsigned int index;
-  long minv, maxv, mindecibels, maxdecibels; // the min values are for non-muting
-  int has_a_decibel_range;
-  int lowest_value_is_mute;
-} mixer_info_t;
+// With sample_volume_curves, the dB value of every volume step of each mixer is asked for once
+// and the curve is reduced to the fewest points that straight lines can be drawn between to
+// give it exactly -- two for a linear dB scale, a few for a dB range made of several scales. A
+// curve that can't be given exactly by VOLUME_CURVE_POINTS points, such as that of a mixer that
+// is linear in amplitude, is approximated, doubling the error allowed until it can be.
+int sample_volume_curves = 0;
+
+// Fit lines to the dB values of the volumes from first up, allowing each to be off by the
+// tolerance. Each line goes from a sample to a later one, as far as it can reach. Return the
+// number of points, or zero if more than VOLUME_CURVE_POINTS are needed.
+static unsigned int fit_volume_curve(long first, const long *decibels, long count,
+                                     double tolerance, volume_point *points) {
+  unsigned int point_count = 0;
+  long start = 0;
+  points[point_count].volume = first;
+  points[point_count++].decibels = decibels[0];
+  while (start < count - 1) {
+    // the slopes from the start that would keep every sample passed within the tolerance
+    double lowest = -HUGE_VAL, highest = HUGE_VAL;
+    long end = start + 1;
+    while (end < count - 1) {
+      double steps = end - start;
+      double low = (decibels[end] - tolerance - decibels[start]) / steps;
+      double high = (decibels[end] + tolerance - decibels[start]) / steps;
+      if (low > lowest)
+        lowest = low;
+      if (high < highest)
+        highest = high;
+      double slope = (double)(decibels[end + 1] - decibels[start]) / (end + 1 - start);
+      if ((slope < lowest - 1e-9) || (slope > highest + 1e-9))
+        break;
+      end++;
+    }
+    if (point_count == VOLUME_CURVE_POINTS)
+      return 0;
+    points[point_count].volume = first + end;
+    points[point_count++].decibels = decibels[end];
+    start = end;
+  }
+  return point_count;
+}
 
-typedef struct {
-  mixer_info_t mixer[MIXER_BUNDLE_SIZE];
-  size_t size;
-  size_t first_free;
-} mixer_bundle_t;
+// the dB value of a playback or capture volume
+static int ask_volume_decibels(snd_mixer_elem_t *elem, int capture, long volume, long *decibels) {
+  if (capture != 0)
+    return snd_mixer_selem_ask_capture_vol_dB(elem, volume, decibels);
+  return snd_mixer_selem_ask_playback_vol_dB(elem, volume, decibels);
+}
+
+static void sample_volume_curve(snd_mixer_elem_t *elem, mixer_info_t *mixer) {
+  long first = mixer->minv + (mixer->lowest_value_is_mute != 0 ? 1 : 0);
+  long count = mixer->maxv - first + 1;
+  if (count < 1)
+    return;
+  long *decibels = malloc(sizeof(long) * count);
+  if (decibels == NULL) {
+    debug(1, "could not allocate memory to sample the volume curve of \"%s\".", mixer->name);
+    return;
+  }
+  long i;
+  for (i = 0; i < count; i++) {
+    if (ask_volume_decibels(elem, mixer->capture, first + i, &decibels[i]) != 0) {
+      debug(1, "can't get the dB value of volume %ld of \"%s\".", first + i, mixer->name);
+      break;
+    }
+  }
+  if (i == count) {
+    long tolerance = 0;
+    unsigned int point_count;
+    while ((point_count = fit_volume_curve(first, decibels, count, tolerance,
+                                           mixer->volume_points)) == 0)
+      tolerance = tolerance == 0 ? 1 : tolerance * 2;
+    mixer->volume_point_count = point_count;
+    mixer->volume_curve_error = tolerance;
+    if (tolerance != 0)
+      mixer->volume_curve = VOLUME_CURVE_APPROXIMATE;
+    else if (point_count <= 2)
+      mixer->volume_curve = VOLUME_CURVE_LINEAR;
+    else
+      mixer->volume_curve = VOLUME_CURVE_PIECEWISE;
+    debug(2, "the volume curve of \"%s\" has %u points, to within %ld hundredths of a dB.",
+          mixer->name, point_count, tolerance);
+  }
+  free(decibels);
+}
+
+static const char *volume_curve_name(volume_curve_t curve) {
+  switch (curve) {
+  case VOLUME_CURVE_LINEAR:
+    return "linear";
+  case VOLUME_CURVE_PIECEWISE:
+    return "piecewise";
+  case VOLUME_CURVE_APPROXIMATE:
+    return "approximate";
+  default:
+    return "none";
+  }
+}
+
+// add the playback or capture volume of the element to the bundle; return non-zero if there's no
+// room for it
+static int add_mixer(mixer_bundle_t *mixer_bundle, snd_mixer_elem_t *elem, int capture) {
+  mixer_info_t *mixer = new_mixer(mixer_bundle);
+  if (mixer == NULL)
+    return -ENOMEM;
+  strncpy(mixer->name, snd_mixer_selem_get_name(elem), sizeof(mixer->name) - 1);
+  mixer->index = snd_mixer_selem_get_index(elem);
+  mixer->capture = capture;
+  int response = capture != 0
+                     ? snd_mixer_selem_get_capture_volume_range(elem, &mixer->minv, &mixer->maxv)
+                     : snd_mixer_selem_get_playback_volume_range(elem, &mixer->minv, &mixer->maxv);
+  if (response < 0)
+    debug(1, "Can't read mixer's [linear] min and max volumes.");
+
+  response = capture != 0
+                 ? snd_mixer_selem_get_capture_dB_range(elem, &mixer->mindecibels,
+                                                        &mixer->maxdecibels)
+                 : snd_mixer_selem_get_playback_dB_range(elem, &mixer->mindecibels,
+                                                         &mixer->maxdecibels);
+  if (response == 0) {
+    mixer->has_a_decibel_range = 1;
+    if (mixer->mindecibels == SND_CTL_TLV_DB_GAIN_MUTE) {
+      // For instance, the Raspberry Pi does this
+      debug(1, "Lowest dB value is a mute");
+      mixer->lowest_value_is_mute = 1;
+      if (ask_volume_decibels(elem, capture, mixer->minv + 1, &mixer->mindecibels) != 0)
+        debug(1, "Can't get dB value corresponding to a minimum volume "
+                 "+ 1.");
+    } else {
+      mixer->lowest_value_is_mute = 0;
+    }
+    if (sample_volume_curves != 0)
+      sample_volume_curve(elem, mixer);
+  } else {
+    mixer->has_a_decibel_range = 0;
+    mixer->lowest_value_is_mute = 0;
+  }
+  return 0;
+}
 
-static int process_mixers(char *device_name, mixer_bundle_t *mixer_bundle) {
+static int process_mixers(const char *device_name, mixer_bundle_t *mixer_bundle) {
   int result = 0;
   snd_mixer_t *handle;
   snd_mixer_selem_id_t *sid;
@@ -81,63 +237,18 @@ static int process_mixers(char *device_name, mixer_bundle_t *mixer_bundle) {
   if ((result = snd_mixer_open(&handle, 0)) == 0) {
     if ((result = snd_mixer_attach(handle, device_name)) == 0) {
       if ((result = snd_mixer_selem_register(handle, NULL, NULL)) == 0) {
-        if ((result = snd_mixer_load(handle)) == 0) {
+        uint64_t load_start = trace_start();
+        result = snd_mixer_load(handle);
+        trace_end(TRACE_MIXER_LOAD, load_start, NULL);
+        if (result == 0) {
           for (elem = snd_mixer_first_elem(handle); elem; elem = snd_mixer_elem_next(elem)) {
-            if (snd_mixer_selem_is_active(elem)) {
-
-              /*
-                            int has_capture_elements = snd_mixer_selem_has_common_volume(elem) ||
-                                                       snd_mixer_selem_has_capture_volume(elem) ||
-                                                       snd_mixer_selem_has_common_switch(elem) ||
-                                                       snd_mixer_selem_has_capture_switch(elem);
-
-                            if (((include_mixers_with_capture == 1) && has_capture_elements) ||
-                                 ((include_mixers_with_capture == 0) && (!has_capture_elements))) {
-              */
-              // if (1) {
-              // if (snd_mixer_selem_has_playback_volume(elem) ||
-              // snd_mixer_selem_has_common_volume(elem)) {
-              if (snd_mixer_selem_has_playback_volume(elem) &&
-                  (snd_mixer_selem_is_enumerated(elem) == 0)) {
-
-                strncpy(mixer_bundle->mixer[mixer_bundle->first_free].name,
-                        snd_mixer_selem_get_name(elem),
-                        sizeof(mixer_bundle->mixer[mixer_bundle->first_free].name) - 1);
-                mixer_bundle->mixer[mixer_bundle->first_free].index =
-                    snd_mixer_selem_get_index(elem);
-                if (snd_mixer_selem_get_playback_volume_range(
-                        elem, &mixer_bundle->mixer[mixer_bundle->first_free].minv,
-                        &mixer_bundle->mixer[mixer_bundle->first_free].maxv) < 0)
-                  debug(1, "Can't read mixer's [linear] min and max volumes.");
-
-                if (snd_mixer_selem_get_playback_dB_range(
-                        elem, &mixer_bundle->mixer[mixer_bundle->first_free].mindecibels,
-                        &mixer_bundle->mixer[mixer_bundle->first_free].maxdecibels) == 0) {
-                  mixer_bundle->mixer[mixer_bundle->first_free].has_a_decibel_range = 1;
-                  if (mixer_bundle->mixer[mixer_bundle->first_free].mindecibels ==
-                      SND_CTL_TLV_DB_GAIN_MUTE) {
-                    // For instance, the Raspberry Pi does this
-                    debug(1, "Lowest dB value is a mute");
-                    mixer_bundle->mixer[mixer_bundle->first_free].lowest_value_is_mute = 1;
-                    // mixer_bundle->mixer[mixer_bundle->first_free].minv++;
-                    if (snd_mixer_selem_ask_playback_vol_dB(
-                            elem, mixer_bundle->mixer[mixer_bundle->first_free].minv + 1,
-                            &mixer_bundle->mixer[mixer_bundle->first_free].mindecibels) != 0)
-                      debug(1, "Can't get dB value corresponding to a minimum volume "
-                               "+ 1.");
-                  } else {
-                    mixer_bundle->mixer[mixer_bundle->first_free].lowest_value_is_mute = 0;
-                  }
-                  // inform("Mixer name: \"%s\",%d%*sRange: %6.2f dB, max: %6.2f dB, min: %6.2f dB",
-                  //        snd_mixer_selem_get_name(elem), snd_mixer_selem_get_index(elem),
-                  //        // 14 - strlen(snd_mixer_selem_get_name(elem)),
-                  //        1, " ", (max_db - min_db) * 0.01, max_db * 0.01, min_db * 0.01);
-                } else {
-                  mixer_bundle->mixer[mixer_bundle->first_free].has_a_decibel_range = 0;
-                  mixer_bundle->mixer[mixer_bundle->first_free].lowest_value_is_mute = 0;
-                }
-                mixer_bundle->first_free++;
-              }
+            if ((snd_mixer_selem_is_active(elem)) && (snd_mixer_selem_is_enumerated(elem) == 0)) {
+              if ((snd_mixer_selem_has_playback_volume(elem)) &&
+                  (add_mixer(mixer_bundle, elem, 0) != 0))
+                break;
+              if ((probe_capture != 0) && (snd_mixer_selem_has_capture_volume(elem)) &&
+                  (add_mixer(mixer_bundle, elem, 1) != 0))
+                break;
             }
           }
 
@@ -161,936 +272,3347 @@ static int process_mixers(char *device_name, mixer_bundle_t *mixer_bundle) {
   return result;
 }
 
-snd_pcm_t *alsa_handle = NULL;
-snd_pcm_hw_params_t *alsa_params = NULL;
-snd_pcm_sw_params_t *alsa_swparams = NULL;
-int frame_size; // in bytes for interleaved stereo
+unsigned int probe_jobs = 1; // the number of cards to probe at the same time
+unsigned int interface_probe_jobs = 1; // the number of interfaces on a card to probe at a time
+
+output_format_t output_format = OUTPUT_FORMAT_TEXT;
+
+int use_probe_cache = 1;
+int probe_capture = 0;                // probe capture streams and list capture mixers too
+int report_buffer_limits = 0;         // read the period and buffer size limits of each rate
+int print_statistics = 0;             // print statistics about the run when it is finished
+int stress_interfaces = 0;            // find the smallest xrun-free period of each interface
+unsigned int stress_seconds = 2;      // how long silence is streamed at each period size
+unsigned int stress_load_threads = 0; // the number of threads of synthetic load while streaming
+int stress_priority = 0;              // the SCHED_FIFO priority to stream at, or 0 for none
+static char **stress_interface_names = NULL; // the interfaces named to be streamed to, if any
+static size_t stress_interface_name_count = 0;
+int refresh_probe_cache = 0;          // probe every card again, but keep the results
+static probe_cache *card_cache = NULL; // NULL if the cache is not in use
+static const probe_backend *backend = &alsa_backend;
+
+static void find_formats_to_check(void);
+static pthread_once_t formats_to_check_once;
+
+int probe_context_init(probe_context *context) {
+  pthread_once(&formats_to_check_once, find_formats_to_check);
+  memset(context, 0, sizeof(probe_context));
+  return snd_pcm_hw_params_malloc(&context->alsa_params);
+}
 
-void get_channel_map(snd_pcm_t *alsa_handle, char *channel_map_store) {
-  if (channel_map_store != NULL) {
-    channel_map_store[0] = '\0'; // default
-    if (alsa_handle != NULL) {
-      snd_pcm_chmap_t *channel_map = snd_pcm_get_chmap(alsa_handle);
-      if (channel_map) {
-        unsigned int i;
-        for (i = 0; i < channel_map->channels; i++) {
-          debug(3, "channel %d is %d, name: \"%s\", long name: \"%s\".", i, channel_map->pos[i],
-                snd_pcm_chmap_name(channel_map->pos[i]),
-                snd_pcm_chmap_long_name(channel_map->pos[i]));
-        }
-        if (snd_pcm_chmap_print(channel_map, sizeof(char[128]), channel_map_store) < 0)
-          channel_map_store[0] = '\0'; // if there's any problem
-        debug(3,
-              "channel count: %d, channel name list: "
-              "\"%s\".",
-              channel_map->channels, channel_map_store);
-
-        free(channel_map);
-      } else {
-        debug(3, "no channel map.");
+void probe_context_free(probe_context *context) {
+  json_writer_free(&context->writer);
+  if (context->alsa_params != NULL)
+    snd_pcm_hw_params_free(context->alsa_params);
+  context->alsa_params = NULL;
+}
+
+static void alsa_get_channel_map(snd_pcm_t *alsa_handle, char *channel_map_store) {
+  channel_map_store[0] = '\0'; // default
+  if (alsa_handle != NULL) {
+    snd_pcm_chmap_t *channel_map = snd_pcm_get_chmap(alsa_handle);
+    if (channel_map) {
+      unsigned int i;
+      for (i = 0; i < channel_map->channels; i++) {
+        debug(3, "channel %d is %d, name: \"%s\", long name: \"%s\".", i, channel_map->pos[i],
+              snd_pcm_chmap_name(channel_map->pos[i]),
+              snd_pcm_chmap_long_name(channel_map->pos[i]));
       }
+      if (snd_pcm_chmap_print(channel_map, CHANNEL_MAP_STORE_SIZE, channel_map_store) < 0)
+        channel_map_store[0] = '\0'; // if there's any problem
+      debug(3,
+            "channel count: %d, channel name list: "
+            "\"%s\".",
+            channel_map->channels, channel_map_store);
+
+      free(channel_map);
+    } else {
+      debug(3, "no channel map.");
+    }
+  }
+}
+
+// Ask the driver for the channel maps of every channel count. A map may be fixed, or one whose
+// channels can be rearranged freely (VAR) or in pairs (PAIRED); either way, it is the map that
+// is reported once a configuration with that channel count is committed, and the type says how
+// it can be changed. But a driver may list more than one map for a channel count -- an HDMI
+// interface lists one for each speaker allocation, for instance -- and then which of them would
+// be reported depends on the state of the device, so no map is given for that count.
+static int alsa_query_channel_maps(snd_pcm_t *alsa_handle, channel_map_list *maps) {
+  bitset_clear(&maps->channel_counts);
+  snd_pcm_chmap_query_t **queries = snd_pcm_query_chmaps(alsa_handle);
+  if (queries == NULL)
+    return -ENXIO;
+  bitset ambiguous_channel_counts; // those with more than one map
+  bitset_clear(&ambiguous_channel_counts);
+  snd_pcm_chmap_query_t **query;
+  for (query = queries; *query != NULL; query++) {
+    unsigned int channels = (*query)->map.channels;
+    if (channels >= BITSET_SIZE)
+      continue;
+    debug(3, "channel count: %u, channel map type: %s.", channels,
+          snd_pcm_chmap_type_name((*query)->type));
+    if (bitset_contains(&maps->channel_counts, channels)) {
+      debug(3, "more than one channel map is listed for %u channels.", channels);
+      bitset_remove(&maps->channel_counts, channels);
+      bitset_add(&ambiguous_channel_counts, channels);
+    } else if (bitset_contains(&ambiguous_channel_counts, channels)) {
+      continue;
+    } else if (snd_pcm_chmap_print(&(*query)->map, CHANNEL_MAP_STORE_SIZE,
+                                   maps->map[channels]) >= 0) {
+      bitset_add(&maps->channel_counts, channels);
+      maps->type[channels] = (*query)->type;
     }
+  }
+  snd_pcm_free_chmaps(queries);
+  return 0;
+}
+
+static int query_channel_maps(snd_pcm_t *alsa_handle, channel_map_list *maps) {
+  uint64_t query_start = trace_start();
+  int response = backend->query_channel_maps(alsa_handle, maps);
+  trace_end(TRACE_CHANNEL_MAP, query_start, NULL);
+  return response;
+}
+
+void get_channel_map(snd_pcm_t *alsa_handle, char *channel_map_store) {
+  if (channel_map_store != NULL) {
+    uint64_t query_start = trace_start();
+    backend->get_channel_map(alsa_handle, channel_map_store);
+    trace_end(TRACE_CHANNEL_MAP, query_start, NULL);
   } else {
     debug(1, "no memory allocated for a channel map store");
   }
 }
 
-// can have up to 32 rates
-static unsigned int rates_to_check[] = {5512,  8000,  11025, 16000,  22050,  32000,  44100, 48000,
-                                        64000, 88200, 96000, 176400, 192000, 352800, 384000};
-
-static snd_pcm_format_t formats_to_check[] = {SND_PCM_FORMAT_S8,
-                                              SND_PCM_FORMAT_U8,
-                                              SND_PCM_FORMAT_S16_LE,
-                                              SND_PCM_FORMAT_S16_BE,
-                                              SND_PCM_FORMAT_U16_LE,
-                                              SND_PCM_FORMAT_U16_BE,
-                                              SND_PCM_FORMAT_S24_LE,
-                                              SND_PCM_FORMAT_S24_BE,
-                                              SND_PCM_FORMAT_U24_LE,
-                                              SND_PCM_FORMAT_U24_BE,
-                                              SND_PCM_FORMAT_S32_LE,
-                                              SND_PCM_FORMAT_S32_BE,
-                                              SND_PCM_FORMAT_U32_LE,
-                                              SND_PCM_FORMAT_U32_BE,
-                                              SND_PCM_FORMAT_FLOAT_LE,
-                                              SND_PCM_FORMAT_FLOAT_BE,
-                                              SND_PCM_FORMAT_FLOAT64_LE,
-                                              SND_PCM_FORMAT_FLOAT64_BE,
-                                              SND_PCM_FORMAT_IEC958_SUBFRAME_LE,
-                                              SND_PCM_FORMAT_IEC958_SUBFRAME_BE,
-                                              SND_PCM_FORMAT_MU_LAW,
-                                              SND_PCM_FORMAT_A_LAW,
-                                              SND_PCM_FORMAT_IMA_ADPCM,
-                                              SND_PCM_FORMAT_MPEG,
-                                              SND_PCM_FORMAT_GSM,
-                                              SND_PCM_FORMAT_SPECIAL,
-                                              SND_PCM_FORMAT_S24_3LE,
-                                              SND_PCM_FORMAT_S24_3BE,
-                                              SND_PCM_FORMAT_U24_3LE,
-                                              SND_PCM_FORMAT_U24_3BE,
-                                              SND_PCM_FORMAT_S20_3LE,
-                                              SND_PCM_FORMAT_S20_3BE,
-                                              SND_PCM_FORMAT_U20_3LE,
-                                              SND_PCM_FORMAT_U20_3BE,
-                                              SND_PCM_FORMAT_S18_3LE,
-                                              SND_PCM_FORMAT_S18_3BE,
-                                              SND_PCM_FORMAT_U18_3LE,
-                                              SND_PCM_FORMAT_U18_3BE,
-                                              SND_PCM_FORMAT_G723_24,
-                                              SND_PCM_FORMAT_G723_24_1B,
-                                              SND_PCM_FORMAT_G723_40,
-                                              SND_PCM_FORMAT_G723_40_1B,
-                                              SND_PCM_FORMAT_DSD_U8,
-                                              SND_PCM_FORMAT_DSD_U16_LE,
-                                              SND_PCM_FORMAT_DSD_U32_LE,
-                                              SND_PCM_FORMAT_DSD_U16_BE,
-                                              SND_PCM_FORMAT_DSD_U32_BE};
+// Channel maps are interned in a table for the run, along with their types, and configuration
+// sets refer to them by number. Number 0 means no channel map. The strings are never freed or
+// moved, so a pointer returned by channel_map_name() stays valid.
 
 typedef struct {
-  uint32_t rate_set, channel_set;
-  uint64_t format_set;
-  char channel_mappings[32][128];
-} configuration_set;
+  char *map;
+  int type;
+} interned_channel_map;
+
+static interned_channel_map *channel_maps = NULL; // channel_maps[n - 1] is channel map n
+static size_t channel_map_count = 0;
+static size_t channel_maps_allocated = 0;
+static pthread_mutex_t channel_map_lock = PTHREAD_MUTEX_INITIALIZER;
+
+uint16_t intern_channel_map(const char *channel_map, int type) {
+  uint16_t response = 0;
+  if ((channel_map != NULL) && (channel_map[0] != '\0')) {
+    pthread_mutex_lock(&channel_map_lock);
+    size_t i;
+    for (i = 0; (i < channel_map_count) && (response == 0); i++)
+      if ((channel_maps[i].type == type) && (strcmp(channel_maps[i].map, channel_map) == 0))
+        response = i + 1;
+    if ((response == 0) && (channel_map_count < UINT16_MAX)) {
+      if (channel_map_count == channel_maps_allocated) {
+        size_t new_size = channel_maps_allocated == 0 ? 32 : channel_maps_allocated * 2;
+        interned_channel_map *new_channel_maps =
+            realloc(channel_maps, sizeof(interned_channel_map) * new_size);
+        if (new_channel_maps != NULL) {
+          channel_maps = new_channel_maps;
+          channel_maps_allocated = new_size;
+        }
+      }
+      if (channel_map_count < channel_maps_allocated) {
+        char *copy = strdup(channel_map);
+        if (copy != NULL) {
+          channel_maps[channel_map_count].map = copy;
+          channel_maps[channel_map_count++].type = type;
+          response = channel_map_count;
+        }
+      }
+    }
+    pthread_mutex_unlock(&channel_map_lock);
+    if (response == 0)
+      debug(1, "could not intern the channel map \"%s\".", channel_map);
+  }
+  return response;
+}
 
-typedef struct {
-  configuration_set *configuration_sets; // this will be a malloced array of type configuration_set
-  size_t configuration_sets_count; // the size of the array. Not all the elements will be valid!
-  int error_status;
-  int already_handled;
-  char interface_name[64];
-  char device_name[64];
-  char subdevice_name[64];
-  unsigned int card_number;
-  unsigned int device_number;
-  unsigned int subdevice_number;
-} configuration_bundle;
+const char *channel_map_name(uint16_t channel_map) {
+  const char *response = "";
+  if (channel_map != 0) {
+    pthread_mutex_lock(&channel_map_lock);
+    if (channel_map <= channel_map_count)
+      response = channel_maps[channel_map - 1].map;
+    pthread_mutex_unlock(&channel_map_lock);
+  }
+  return response;
+}
+
+int channel_map_type(uint16_t channel_map) {
+  int response = SND_CHMAP_TYPE_NONE;
+  if (channel_map != 0) {
+    pthread_mutex_lock(&channel_map_lock);
+    if (channel_map <= channel_map_count)
+      response = channel_maps[channel_map - 1].type;
+    pthread_mutex_unlock(&channel_map_lock);
+  }
+  return response;
+}
+
+// Buffer limits are interned in the same way, so that a configuration set needs only a number
+// for each of its rates. Number 0 means that the limits weren't read.
+
+static buffer_limits *buffer_limits_table = NULL; // buffer_limits_table[n - 1] is limits n
+static size_t buffer_limits_count = 0;
+static size_t buffer_limits_allocated = 0;
+static pthread_mutex_t buffer_limits_lock = PTHREAD_MUTEX_INITIALIZER;
+
+uint16_t intern_buffer_limits(const buffer_limits *limits) {
+  uint16_t response = 0;
+  if (limits->buffer_size_max != 0) {
+    pthread_mutex_lock(&buffer_limits_lock);
+    size_t i;
+    for (i = 0; (i < buffer_limits_count) && (response == 0); i++)
+      if (memcmp(&buffer_limits_table[i], limits, sizeof(buffer_limits)) == 0)
+        response = i + 1;
+    if ((response == 0) && (buffer_limits_count < UINT16_MAX)) {
+      if (buffer_limits_count == buffer_limits_allocated) {
+        size_t new_size = buffer_limits_allocated == 0 ? 32 : buffer_limits_allocated * 2;
+        buffer_limits *new_table = realloc(buffer_limits_table, sizeof(buffer_limits) * new_size);
+        if (new_table != NULL) {
+          buffer_limits_table = new_table;
+          buffer_limits_allocated = new_size;
+        }
+      }
+      if (buffer_limits_count < buffer_limits_allocated) {
+        buffer_limits_table[buffer_limits_count++] = *limits;
+        response = buffer_limits_count;
+      }
+    }
+    pthread_mutex_unlock(&buffer_limits_lock);
+    if (response == 0)
+      debug(1, "could not intern the buffer limits.");
+  }
+  return response;
+}
+
+void get_buffer_limits(uint16_t number, buffer_limits *limits) {
+  memset(limits, 0, sizeof(buffer_limits));
+  if (number != 0) {
+    pthread_mutex_lock(&buffer_limits_lock);
+    if (number <= buffer_limits_count)
+      *limits = buffer_limits_table[number - 1];
+    pthread_mutex_unlock(&buffer_limits_lock);
+  }
+}
+
+// More rates can be added, up to MAXIMUM_RATES of them, in ascending order.
+static unsigned int rates_to_check[] = {5512,   8000,   11025,  16000,  22050,  32000,
+                                        44100,  48000,  64000,  88200,  96000,  176400,
+                                        192000, 352800, 384000, 705600, 768000};
+
+#define RATE_COUNT (sizeof(rates_to_check) / sizeof(unsigned int))
+
+_Static_assert(RATE_COUNT <= BITSET_SIZE, "too many rates for a bitset");
+_Static_assert(RATE_COUNT <= MAXIMUM_RATES, "too many rates for the buffer limits");
+_Static_assert(SND_PCM_FORMAT_LAST < BITSET_SIZE, "too many formats for a bitset");
+
+// the largest number of channels that will be checked -- the largest a channel set can hold
+#define MAXIMUM_CHANNELS (BITSET_SIZE - 1)
+
+// every format up to SND_PCM_FORMAT_LAST that alsa-lib has a name for
+static bitset formats_to_check;
+static pthread_once_t formats_to_check_once = PTHREAD_ONCE_INIT;
+
+static void find_formats_to_check(void) {
+  int fi;
+  bitset_clear(&formats_to_check);
+  for (fi = 0; fi <= SND_PCM_FORMAT_LAST; fi++)
+    if (snd_pcm_format_name((snd_pcm_format_t)fi) != NULL)
+      bitset_add(&formats_to_check, fi);
+  debug(2, "%u formats to check.", bitset_count(&formats_to_check));
+}
 
 // if the new configuration can be added to an existing configuration set
 // i.e. same format set and same channel set but a new rate, then add it in
 
 // otherwise add a new configuration set
 
-void add_to_configuration_sets(unsigned int channel_count, uint32_t rate_index, uint32_t format_set,
-                               char *channel_map, configuration_bundle *configuration) {
-  if (configuration->configuration_sets_count == 0) {
-    configuration->configuration_sets = malloc(sizeof(configuration_set));
-    configuration->configuration_sets[0].rate_set = rate_index;
-    configuration->configuration_sets[0].format_set = format_set;
-    configuration->configuration_sets[0].channel_set = (1 << channel_count);
-    memset(configuration->configuration_sets[0].channel_mappings, 0, sizeof(char[128]) * 32);
-    if (channel_map != NULL)
-      strncpy(configuration->configuration_sets[0].channel_mappings[channel_count], channel_map,
-              sizeof(char[128]));
-    configuration->configuration_sets_count = 1;
+// return a new, empty configuration set at the end of the bundle's array, or NULL if there's no
+// room for it. The array doubles in size when it's full.
+static configuration_set *new_configuration_set(configuration_bundle *configuration) {
+  if (configuration->configuration_sets_count == configuration->configuration_sets_allocated) {
+    size_t new_size = configuration->configuration_sets_allocated == 0
+                          ? 8
+                          : configuration->configuration_sets_allocated * 2;
+    configuration_set *new_sets = arena_grow(
+        configuration->arena, configuration->configuration_sets,
+        sizeof(configuration_set) * configuration->configuration_sets_allocated,
+        sizeof(configuration_set) * new_size);
+    if (new_sets == NULL) {
+      debug(1, "could not allocate memory for the configuration sets of \"%s\".",
+            configuration->interface_name);
+      return NULL;
+    }
+    configuration->configuration_sets = new_sets;
+    configuration->configuration_sets_allocated = new_size;
+  }
+  return &configuration->configuration_sets[configuration->configuration_sets_count++];
+}
+
+// the time it takes to play the smallest buffer at the rate, in microseconds, rounded up
+static unsigned int minimum_latency(const buffer_limits *limits, unsigned int rate) {
+  return ((uint64_t)limits->buffer_size_min * 1000000 + rate - 1) / rate;
+}
+
+// widen limits to take in other as well
+static void widen_buffer_limits(buffer_limits *limits, const buffer_limits *other) {
+  if (other->buffer_size_max == 0)
+    return; // there is nothing to take in
+  if (limits->buffer_size_max == 0) {
+    *limits = *other;
+    return;
+  }
+  if (other->period_size_min < limits->period_size_min)
+    limits->period_size_min = other->period_size_min;
+  if (other->period_size_max > limits->period_size_max)
+    limits->period_size_max = other->period_size_max;
+  if (other->buffer_size_min < limits->buffer_size_min)
+    limits->buffer_size_min = other->buffer_size_min;
+  if (other->buffer_size_max > limits->buffer_size_max)
+    limits->buffer_size_max = other->buffer_size_max;
+  if (other->periods_min < limits->periods_min)
+    limits->periods_min = other->periods_min;
+  if (other->periods_max > limits->periods_max)
+    limits->periods_max = other->periods_max;
+}
+
+// limits may be NULL if the period and buffer size limits weren't read
+void add_to_configuration_sets(unsigned int channel_count, unsigned int rate_index,
+                               const bitset *format_set, uint16_t channel_map,
+                               const buffer_limits *limits, configuration_bundle *configuration) {
+  // check each configuration set in turn to see if they can be merged
+  unsigned int i = 0;
+  int can_be_merged = 0;
+  while ((i < configuration->configuration_sets_count) && (can_be_merged == 0)) {
+    bitset channel_set;
+    bitset_clear(&channel_set);
+    bitset_add(&channel_set, channel_count);
+    if ((bitset_equal(&configuration->configuration_sets[i].channel_set, &channel_set)) &&
+        (bitset_equal(&configuration->configuration_sets[i].format_set, format_set)) &&
+        (configuration->configuration_sets[i].channel_maps[channel_count] == channel_map)) {
+      can_be_merged = 1;
+    }
+    if (can_be_merged != 0) {
+      bitset_add(&configuration->configuration_sets[i].rate_set, rate_index);
+      configuration->configuration_sets[i].limits[rate_index] =
+          limits != NULL ? intern_buffer_limits(limits) : 0;
+    } else {
+      i++;
+    }
+  }
+  if (can_be_merged == 0) {
+    configuration_set *new_set = new_configuration_set(configuration);
+    if (new_set != NULL) {
+      bitset_clear(&new_set->rate_set);
+      bitset_add(&new_set->rate_set, rate_index);
+      new_set->format_set = *format_set;
+      bitset_clear(&new_set->channel_set);
+      bitset_add(&new_set->channel_set, channel_count);
+      memset(new_set->channel_maps, 0, sizeof(new_set->channel_maps));
+      new_set->channel_maps[channel_count] = channel_map;
+      memset(new_set->limits, 0, sizeof(new_set->limits));
+      if (limits != NULL)
+        new_set->limits[rate_index] = intern_buffer_limits(limits);
+    }
+  }
+}
+
+typedef enum {
+  PROBE_ENGINE_REFINED = 0, // narrow the refined parameter space and test only what is left
+  PROBE_ENGINE_EXHAUSTIVE,  // test every channel, rate and format combination
+  PROBE_ENGINE_VERIFY,      // use both and check that they agree
+} probe_engine_t;
+
+probe_engine_t probe_engine = PROBE_ENGINE_REFINED;
+int probe_without_committing = 0; // in the refined engine, get channel maps from the driver's list
+int infer_subdevices = 0; // in the refined engine, take the results of matching subdevices
+unsigned int probe_mismatches = 0; // the total over all the probe contexts
+unsigned int probe_timeouts = 0;   // likewise
+
+// snd_pcm_hw_params_any() and snd_pcm_hw_params(), timed
+static int traced_hw_params_any(snd_pcm_t *alsa_handle, snd_pcm_hw_params_t *params) {
+  uint64_t start = trace_start();
+  int response = backend->hw_params_any(alsa_handle, params);
+  trace_end(TRACE_HW_PARAMS_ANY, start, NULL);
+  return response;
+}
+
+static int traced_hw_params(snd_pcm_t *alsa_handle, snd_pcm_hw_params_t *params) {
+  uint64_t start = trace_start();
+  int response = backend->hw_params(alsa_handle, params);
+  trace_end(TRACE_HW_PARAMS, start, NULL);
+  return response;
+}
+
+// read the period and buffer size limits left in a combination's configuration space, before it
+// is committed and they are fixed, if they are being reported; otherwise they are all zero
+static void read_buffer_limits(snd_pcm_t *alsa_handle, const snd_pcm_hw_params_t *params,
+                               buffer_limits *limits) {
+  memset(limits, 0, sizeof(buffer_limits));
+  if ((report_buffer_limits != 0) &&
+      (backend->hw_params_get_buffer_limits(alsa_handle, params, limits) != 0)) {
+    debug(2, "could not read the period and buffer size limits.");
+    memset(limits, 0, sizeof(buffer_limits));
+  }
+}
+
+// check if a specific channel/rate/format combination can be used by committing it to the device
+// return 0 if it can be used, with the channel map, if any, in channel_map_store and its period
+// and buffer size limits in limits
+static int probe_combination(snd_pcm_t *alsa_handle, snd_pcm_hw_params_t *local_alsa_params,
+                             const char *interface_name, unsigned int ci, unsigned int ri,
+                             unsigned int fi, char *channel_map_store, buffer_limits *limits) {
+  memset(local_alsa_params, 0, snd_pcm_hw_params_sizeof());
+  backend->hw_free(alsa_handle); // remove any previous configurations
+  traced_hw_params_any(alsa_handle, local_alsa_params);
+
+  int local_response = traced_hw_params_any(alsa_handle, local_alsa_params);
+  if (local_response == 0) {
+    if ((backend->hw_params_set_access(alsa_handle, local_alsa_params,
+                                       SND_PCM_ACCESS_RW_INTERLEAVED) == 0) ||
+        (backend->hw_params_set_access(alsa_handle, local_alsa_params,
+                                       SND_PCM_ACCESS_MMAP_INTERLEAVED) == 0)) {
+      local_response = backend->hw_params_set_channels(
+          alsa_handle, local_alsa_params, ci); // the channel index is the channel count too
+      if (local_response == 0) {
+        local_response =
+            backend->hw_params_set_format(alsa_handle, local_alsa_params, (snd_pcm_format_t)fi);
+        if (local_response == 0) {
+          unsigned int actual_sample_rate = rates_to_check[ri];
+          int dir = 0;
+          local_response = backend->hw_params_set_rate_near(alsa_handle, local_alsa_params,
+                                                            &actual_sample_rate, &dir);
+          if (local_response == 0) {
+            if (actual_sample_rate != rates_to_check[ri]) {
+              local_response = -EINVAL;
+              debug(3, "Sample rate set, %u, is different to sample rate requested, %u.",
+                    actual_sample_rate, rates_to_check[ri]);
+            } else {
+              // success -- this combination of channel ci, rate ri and format fi works
+              debug(3, "\"%s\": snd_pcm_hw_params for  %u/%s/%u.", interface_name,
+                    rates_to_check[ri], snd_pcm_format_name((snd_pcm_format_t)fi), ci);
+              read_buffer_limits(alsa_handle, local_alsa_params, limits);
+              local_response = traced_hw_params(alsa_handle, local_alsa_params);
+              if (local_response == 0) {
+                get_channel_map(alsa_handle, channel_map_store);
+                if (channel_map_store[0] == '\0') {
+                  debug(3, "\"%s\": %u/%s/%u/", interface_name, rates_to_check[ri],
+                        snd_pcm_format_name((snd_pcm_format_t)fi), ci);
+                } else {
+                  debug(3, "\"%s\": %u/%s/%u/<%s>", interface_name, rates_to_check[ri],
+                        snd_pcm_format_name((snd_pcm_format_t)fi), ci, channel_map_store);
+                }
+              } else {
+                debug(3, "Unable to set hw parameters for device \"%s\": %d: \"%s\".%s",
+                      interface_name, local_response, snd_strerror(local_response),
+                      local_response == -ENOSPC
+                          ? "  This seems to be a USB error and may be caused by an "
+                            "incompatibility between the system and the device."
+                          : "");
+              }
+            }
+          } else {
+            debug(3, "could not set output rate %u for device \"%s\", error  \"%s\".",
+                  rates_to_check[ri], interface_name, snd_strerror(local_response));
+          }
+        } else {
+          debug(3, "could not set output format \"%s\" for device: \"%s\".",
+                snd_pcm_format_name((snd_pcm_format_t)fi), snd_strerror(local_response));
+        }
+      } else {
+        debug(3, "%u channel output is not available for device: \"%s\"", ci,
+              snd_strerror(local_response));
+      }
+    } else {
+      local_response = -EINVAL;
+      debug(1, "interleaved access not available for device: \"%s\".", interface_name);
+    }
+  } else {
+    debug(1,
+          "broken configuration for device \"%s\": no configurations available -- "
+          "error %d: \"%s\".",
+          interface_name, local_response, snd_strerror(local_response));
+  }
+  return local_response;
+}
+
+// check if format fi can be used by committing it to the device, starting from a snapshot of
+// the configuration space that has already been narrowed to a channel count and a rate
+// If known_channel_map isn't NULL, it is the channel map for the channel count, and the format is
+// taken to be usable if the snapshot can be narrowed to it, without committing it.
+// return 0 if it can be used, with the channel map, if any, in channel_map_store and its period
+// and buffer size limits in limits
+static int probe_format_in_snapshot(snd_pcm_t *alsa_handle, snd_pcm_hw_params_t *local_alsa_params,
+                                    const snd_pcm_hw_params_t *snapshot,
+                                    const char *known_channel_map, const char *interface_name,
+                                    unsigned int ci, unsigned int ri, unsigned int fi,
+                                    char *channel_map_store, buffer_limits *limits) {
+  snd_pcm_hw_params_copy(local_alsa_params, snapshot);
+  int local_response =
+      backend->hw_params_set_format(alsa_handle, local_alsa_params, (snd_pcm_format_t)fi);
+  if (local_response == 0)
+    read_buffer_limits(alsa_handle, local_alsa_params, limits);
+  if ((local_response == 0) && (known_channel_map != NULL)) {
+    snprintf(channel_map_store, CHANNEL_MAP_STORE_SIZE, "%s", known_channel_map);
+    debug(3, "\"%s\": %u/%s/%u/<%s>, not committed.", interface_name, rates_to_check[ri],
+          snd_pcm_format_name((snd_pcm_format_t)fi), ci, channel_map_store);
+  } else if (local_response == 0) {
+    debug(3, "\"%s\": snd_pcm_hw_params for  %u/%s/%u.", interface_name, rates_to_check[ri],
+          snd_pcm_format_name((snd_pcm_format_t)fi), ci);
+    backend->hw_free(alsa_handle); // remove the previous configuration
+    local_response = traced_hw_params(alsa_handle, local_alsa_params);
+    if (local_response == 0) {
+      get_channel_map(alsa_handle, channel_map_store);
+      debug(3, "\"%s\": %u/%s/%u/<%s>", interface_name, rates_to_check[ri],
+            snd_pcm_format_name((snd_pcm_format_t)fi), ci, channel_map_store);
+    } else {
+      debug(3, "Unable to set hw parameters for device \"%s\": %d: \"%s\".%s", interface_name,
+            local_response, snd_strerror(local_response),
+            local_response == -ENOSPC ? "  This seems to be a USB error and may be caused by an "
+                                        "incompatibility between the system and the device."
+                                      : "");
+    }
+  } else {
+    debug(3, "could not set output format \"%s\" for device: \"%s\".",
+          snd_pcm_format_name((snd_pcm_format_t)fi), snd_strerror(local_response));
+  }
+  return local_response;
+}
+
+// check each of the candidate formats at channel count ci and rate ri, adding
+// the ones that work to the configuration sets
+// If snapshot isn't NULL, it is the configuration space narrowed to ci and ri, and each format is
+// tried from it, with known_channel_map as in probe_format_in_snapshot(), of type
+// known_channel_map_type; otherwise each combination is set up from scratch.
+// returns the number of combinations committed to the device
+static unsigned int probe_formats(snd_pcm_t *alsa_handle, snd_pcm_hw_params_t *local_alsa_params,
+                                  const snd_pcm_hw_params_t *snapshot,
+                                  const char *known_channel_map, int known_channel_map_type,
+                                  const char *interface_name,
+                                  unsigned int ci, unsigned int ri,
+                                  const bitset *format_candidates,
+                                  configuration_bundle *configuration) {
+  unsigned int combinations_tried = 0;
+  char local_channel_map_store[CHANNEL_MAP_STORE_SIZE];
+  uint16_t channel_map = 0;
+  int channel_map_type = SND_CHMAP_TYPE_NONE; // a map read from a committed configuration
+  if ((snapshot != NULL) && (known_channel_map != NULL) &&
+      ((known_channel_map_type == SND_CHMAP_TYPE_VAR) ||
+       (known_channel_map_type == SND_CHMAP_TYPE_PAIRED)))
+    channel_map_type = known_channel_map_type;
+  bitset format_set;
+  bitset_clear(&format_set);
+  buffer_limits limits; // the widest over the formats in the format set
+  memset(&limits, 0, sizeof(limits));
+  int fi; // format index
+  // for each format among the formats that could be used...
+  bitset_for_each(fi, format_candidates) {
+    combinations_tried++;
+    buffer_limits format_limits;
+    int local_response =
+        snapshot != NULL
+            ? probe_format_in_snapshot(alsa_handle, local_alsa_params, snapshot,
+                                       known_channel_map, interface_name, ci, ri, fi,
+                                       local_channel_map_store, &format_limits)
+            : probe_combination(alsa_handle, local_alsa_params, interface_name, ci, ri, fi,
+                                local_channel_map_store, &format_limits);
+    if (local_response == 0) {
+      uint16_t local_channel_map = intern_channel_map(local_channel_map_store, channel_map_type);
+      // here, we know that this new format works with the given rate and channel count
+      // if the format set is empty, then we should store the channel map, if any
+      // if the format set is non-empty, then we should check that the channel maps are the
+      // same and if they are different, we should add the current configuration set and
+      // start a new one
+      if (bitset_is_empty(&format_set)) {
+        bitset_add(&format_set, fi);
+        channel_map = local_channel_map;
+        limits = format_limits;
+      } else if (local_channel_map != channel_map) {
+        debug(1, "found to be different");
+        add_to_configuration_sets(ci, ri, &format_set, channel_map, &limits, configuration);
+        bitset_clear(&format_set);
+        bitset_add(&format_set, fi);
+        channel_map = local_channel_map;
+        limits = format_limits;
+      } else {
+        bitset_add(&format_set, fi);
+        widen_buffer_limits(&limits, &format_limits);
+      }
+    }
+  }
+  if (!bitset_is_empty(&format_set)) {
+    add_to_configuration_sets(ci, ri, &format_set, channel_map, &limits, configuration);
+  }
+  return combinations_tried;
+}
+
+// the original search -- work out which channel counts, rates and formats are possible
+// individually and then try every combination of them
+static void probe_exhaustive(probe_context *context, const char *interface_name,
+                             configuration_bundle *configuration) {
+  snd_pcm_t *alsa_handle = context->alsa_handle;
+  snd_pcm_hw_params_t *local_alsa_params = context->alsa_params;
+  bitset possible_channel_mask;
+  bitset possible_rate_mask;
+  bitset possible_format_mask;
+  bitset_clear(&possible_channel_mask);
+  bitset_clear(&possible_rate_mask);
+  bitset_clear(&possible_format_mask);
+  unsigned int combinations_tried = 0;
+
+  // check what numbers of channels the device can provide, trying only those
+  // within the range it gives...
+  unsigned int i;
+  unsigned int channels_min = 1;
+  unsigned int channels_max = 0;
+  backend->hw_free(alsa_handle);
+  if ((traced_hw_params_any(alsa_handle, local_alsa_params) == 0) &&
+      (backend->hw_params_get_channels_min(alsa_handle, local_alsa_params, &channels_min) == 0) &&
+      (backend->hw_params_get_channels_max(alsa_handle, local_alsa_params, &channels_max) == 0)) {
+    if (channels_min == 0)
+      channels_min = 1;
+    if (channels_max > MAXIMUM_CHANNELS) {
+      debug(1, "\"%s\" can handle up to %u channels, but only up to %u will be checked.",
+            interface_name, channels_max, MAXIMUM_CHANNELS);
+      channels_max = MAXIMUM_CHANNELS;
+    }
+  }
+  for (i = channels_min; i <= channels_max; i++) {
+    backend->hw_free(alsa_handle); // remove any previous configurations
+    int local_response = traced_hw_params_any(alsa_handle, local_alsa_params);
+    if (local_response == 0) {
+      local_response = backend->hw_params_test_channels(alsa_handle, local_alsa_params, i);
+      if (local_response == 0) {
+        bitset_add(&possible_channel_mask, i);
+        debug(3, "\"%s\" can handle %u channels.", interface_name, i);
+      } else {
+        debug(3, "\"%s\" can not handle %u channels.", interface_name, i);
+      }
+    }
+  }
+
+  // check what rates the device can handle
+  for (i = 0; i < RATE_COUNT; i++) {
+    backend->hw_free(alsa_handle); // remove any previous configurations
+    int local_response = traced_hw_params_any(alsa_handle, local_alsa_params);
+    if (local_response == 0) {
+      // We don't't use snd_pcm_hw_params_test_rate() here because it its too strict, it
+      // seems. It excludes situations where the rate is nominally the requested rate but
+      // might be a bit higher or lower, as indicated by the dir value returned when you use
+      // snd_pcm_hw_params_set_rate_near().
+      unsigned int actual_sample_rate = rates_to_check[i];
+      int dir = 0;
+
+      local_response = backend->hw_params_set_rate_near(alsa_handle, local_alsa_params,
+                                                        &actual_sample_rate, &dir);
+      // a returned dir value of 0 would mean exact rate only,
+      // -1 means the rate chosen will be less, and +1 greater.
+      // however, we also check that the nominal actual returned rate is the same.
+      if ((local_response == 0) && (actual_sample_rate == rates_to_check[i])) {
+        bitset_add(&possible_rate_mask, i);
+        debug(3, "\"%s\" can handle %u fps, dir: %d.", interface_name, rates_to_check[i], dir);
+      } else {
+        debug(3, "\"%s\" can not handle %u fps.", interface_name, rates_to_check[i]);
+      }
+    }
+  }
+
+  // check what formats the device can handle
+  int fi;
+  bitset_for_each(fi, &formats_to_check) {
+    backend->hw_free(alsa_handle); // remove any previous configurations
+    int local_response = traced_hw_params_any(alsa_handle, local_alsa_params);
+    if (local_response == 0) {
+      local_response =
+          backend->hw_params_test_format(alsa_handle, local_alsa_params, (snd_pcm_format_t)fi);
+      if (local_response == 0) {
+        bitset_add(&possible_format_mask, fi);
+        debug(3, "\"%s\" can accept the %s format.", interface_name,
+              snd_pcm_format_name((snd_pcm_format_t)fi));
+      } else {
+        debug(3, "\"%s\" can not accept the %s format.", interface_name,
+              snd_pcm_format_name((snd_pcm_format_t)fi));
+      }
+    }
+  }
+
+  // now we know the maximum possible number of configurations
+  // so let's check them out
+  int ci; // channel index
+  // for each channel count among the channel counts that could be used...
+  bitset_for_each(ci, &possible_channel_mask) {
+    int ri; // rate index
+    // for each rate among the rates that could be used...
+    bitset_for_each(ri, &possible_rate_mask) {
+      combinations_tried += probe_formats(alsa_handle, local_alsa_params, NULL, NULL,
+                                          SND_CHMAP_TYPE_NONE, interface_name, ci, ri,
+                                          &possible_format_mask, configuration);
+    }
+  }
+  debug(2, "\"%s\": exhaustive search tried %u combinations.", interface_name,
+        combinations_tried);
+}
+
+// Work from the device's refined configuration space rather than from the full list of
+// possibilities. The format mask and the channel and rate intervals are read once and then
+// narrowed, channel count by channel count and rate by rate, so that only those combinations
+// that the refinement leaves open are committed to the device. Each narrowed space is a snapshot
+// that the next level down starts from, so a combination is committed by setting just its format
+// on a copy of its rate's snapshot, and a channel count or rate that fails is not explored.
+static void probe_refined(probe_context *context, const char *interface_name,
+                          configuration_bundle *configuration) {
+  snd_pcm_t *alsa_handle = context->alsa_handle;
+  snd_pcm_hw_params_t *local_alsa_params = context->alsa_params;
+  unsigned int combinations_tried = 0;
+  snd_pcm_hw_params_t *space = NULL; // the whole configuration space for interleaved access
+  snd_pcm_hw_params_alloca(&space);
+  snd_pcm_hw_params_t *channel_space = NULL; // ...narrowed to one channel count
+  snd_pcm_hw_params_alloca(&channel_space);
+  snd_pcm_hw_params_t *rate_space = NULL; // ...narrowed to one channel count and one rate
+  snd_pcm_hw_params_alloca(&rate_space);
+  snd_pcm_format_mask_t *format_mask = NULL;
+  snd_pcm_format_mask_alloca(&format_mask);
+
+  backend->hw_free(alsa_handle); // remove any previous configurations
+  int local_response = traced_hw_params_any(alsa_handle, space);
+  if (local_response == 0) {
+    if ((backend->hw_params_set_access(alsa_handle, space, SND_PCM_ACCESS_RW_INTERLEAVED) == 0) ||
+        (backend->hw_params_set_access(alsa_handle, space, SND_PCM_ACCESS_MMAP_INTERLEAVED) ==
+         0)) {
+      unsigned int channels_min = 0, channels_max = 0;
+      unsigned int rate_min = 0, rate_max = 0;
+      backend->hw_params_get_channels_min(alsa_handle, space, &channels_min);
+      backend->hw_params_get_channels_max(alsa_handle, space, &channels_max);
+      backend->hw_params_get_format_mask(alsa_handle, space, format_mask);
+      bitset possible_format_mask;
+      bitset_clear(&possible_format_mask);
+      int fi; // format index
+      bitset_for_each(fi, &formats_to_check) {
+        if (snd_pcm_format_mask_test(format_mask, (snd_pcm_format_t)fi))
+          bitset_add(&possible_format_mask, fi);
+      }
+      debug(3, "\"%s\" has from %u to %u channels and %u of the formats.", interface_name,
+            channels_min, channels_max, bitset_count(&possible_format_mask));
+      if (channels_min < 1)
+        channels_min = 1;
+      if (channels_max > MAXIMUM_CHANNELS) {
+        debug(1, "\"%s\" can handle up to %u channels, but only up to %u will be checked.",
+              interface_name, channels_max, MAXIMUM_CHANNELS);
+        channels_max = MAXIMUM_CHANNELS;
+      }
+      channel_map_list *channel_maps = NULL;
+      if (probe_without_committing != 0) {
+        channel_maps = malloc(sizeof(channel_map_list));
+        if ((channel_maps != NULL) && (query_channel_maps(alsa_handle, channel_maps) != 0)) {
+          debug(2, "\"%s\" can't list its channel maps, so each combination will be committed.",
+                interface_name);
+          free(channel_maps);
+          channel_maps = NULL;
+        }
+      }
+      unsigned int ci; // channel index
+      for (ci = channels_min; (ci <= channels_max) && (!bitset_is_empty(&possible_format_mask));
+           ci++) {
+        snd_pcm_hw_params_copy(channel_space, space);
+        bitset channel_formats; // the formats still possible with this channel count
+        bitset_clear(&channel_formats);
+        if (backend->hw_params_set_channels(alsa_handle, channel_space, ci) == 0) {
+          backend->hw_params_get_format_mask(alsa_handle, channel_space, format_mask);
+          bitset_for_each(fi, &possible_format_mask) {
+            if (snd_pcm_format_mask_test(format_mask, (snd_pcm_format_t)fi))
+              bitset_add(&channel_formats, fi);
+          }
+        }
+        if (bitset_is_empty(&channel_formats)) {
+          debug(3, "\"%s\" can not handle %u channels.", interface_name, ci);
+        } else {
+          // a channel count without a listed map is committed, to see what map it gets
+          const char *known_channel_map = NULL;
+          int known_channel_map_type = SND_CHMAP_TYPE_NONE;
+          if ((channel_maps != NULL) && (bitset_contains(&channel_maps->channel_counts, ci))) {
+            known_channel_map = channel_maps->map[ci];
+            known_channel_map_type = channel_maps->type[ci];
+          }
+          backend->hw_params_get_rate_min(alsa_handle, channel_space, &rate_min);
+          backend->hw_params_get_rate_max(alsa_handle, channel_space, &rate_max);
+          debug(3, "\"%s\" can handle %u channels at rates from %u to %u.", interface_name, ci,
+                rate_min, rate_max);
+          unsigned int ri; // rate index
+          for (ri = 0; ri < RATE_COUNT; ri++) {
+            if ((rates_to_check[ri] >= rate_min) && (rates_to_check[ri] <= rate_max)) {
+              // As in the exhaustive search, use snd_pcm_hw_params_set_rate_near() and check the
+              // nominal rate, rather than snd_pcm_hw_params_test_rate(), which is too strict.
+              unsigned int actual_sample_rate = rates_to_check[ri];
+              int dir = 0;
+              snd_pcm_hw_params_copy(rate_space, channel_space);
+              if ((backend->hw_params_set_rate_near(alsa_handle, rate_space, &actual_sample_rate,
+                                                    &dir) == 0) &&
+                  (actual_sample_rate == rates_to_check[ri])) {
+                // only the formats left in the mask are worth trying
+                backend->hw_params_get_format_mask(alsa_handle, rate_space, format_mask);
+                bitset format_candidates;
+                bitset_clear(&format_candidates);
+                bitset_for_each(fi, &channel_formats) {
+                  if (snd_pcm_format_mask_test(format_mask, (snd_pcm_format_t)fi))
+                    bitset_add(&format_candidates, fi);
+                }
+                combinations_tried += probe_formats(
+                    alsa_handle, local_alsa_params, rate_space, known_channel_map,
+                    known_channel_map_type, interface_name, ci, ri, &format_candidates,
+                    configuration);
+              } else {
+                debug(3, "\"%s\" can not handle %u fps with %u channels.", interface_name,
+                      rates_to_check[ri], ci);
+              }
+            }
+          }
+        }
+      }
+      free(channel_maps);
+    } else {
+      debug(1, "interleaved access not available for device: \"%s\".", interface_name);
+    }
+  } else {
+    debug(1,
+          "broken configuration for device \"%s\": no configurations available -- "
+          "error %d: \"%s\".",
+          interface_name, local_response, snd_strerror(local_response));
+  }
+  debug(2, "\"%s\": refined search tried %u combinations.", interface_name, combinations_tried);
+}
+
+// Fingerprints are FNV-1a hashes of the words that make up what is being fingerprinted.
+#define FINGERPRINT_BASIS UINT64_C(0xcbf29ce484222325)
+
+static uint64_t fingerprint_add(uint64_t fingerprint, uint64_t word) {
+  unsigned int i;
+  for (i = 0; i < 8; i++) {
+    fingerprint ^= (word >> (i * 8)) & 0xff;
+    fingerprint *= UINT64_C(0x100000001b3);
+  }
+  return fingerprint;
+}
+
+static uint64_t rates_and_formats_fingerprint(const configuration_set *set) {
+  uint64_t fingerprint = FINGERPRINT_BASIS;
+  unsigned int w;
+  for (w = 0; w < BITSET_WORDS; w++) {
+    fingerprint = fingerprint_add(fingerprint, set->rate_set.word[w]);
+    fingerprint = fingerprint_add(fingerprint, set->format_set.word[w]);
+  }
+  return fingerprint;
+}
+
+// sets that are the same -- rates, formats, channel counts and the channel map of each channel
+// count -- have the same fingerprint
+static uint64_t configuration_set_fingerprint(const configuration_set *set) {
+  uint64_t fingerprint = rates_and_formats_fingerprint(set);
+  int ci;
+  bitset_for_each(ci, &set->channel_set) {
+    fingerprint = fingerprint_add(fingerprint, ci);
+    fingerprint = fingerprint_add(fingerprint, set->channel_maps[ci]);
+  }
+  return fingerprint;
+}
+
+// bundles whose valid configuration sets are the same, in the same order, have the same
+// fingerprint
+static uint64_t configuration_bundle_fingerprint(const configuration_bundle *configuration) {
+  uint64_t fingerprint = FINGERPRINT_BASIS;
+  size_t si;
+  for (si = 0; si < configuration->configuration_sets_count; si++)
+    if (!bitset_is_empty(&configuration->configuration_sets[si].channel_set))
+      fingerprint = fingerprint_add(
+          fingerprint, configuration_set_fingerprint(&configuration->configuration_sets[si]));
+  return fingerprint;
+}
+
+// return the number of slots in a hash table big enough for count entries -- a power of two
+static size_t hash_table_size(size_t count) {
+  size_t size = 16;
+  while (size < count * 2)
+    size *= 2;
+  return size;
+}
+
+// Merge sets that have the same rates and formats but different sets of channels, the later one
+// into the earlier one, as long as the channel maps of any channel counts they share are the
+// same. Sets with the same rates and formats are found through a hash table, each slot of
+// which holds the first of a chain of sets with the same rates and formats.
+static void merge_configuration_sets(configuration_bundle *configuration) {
+  size_t count = configuration->configuration_sets_count;
+  if (count < 2)
+    return;
+  size_t table_size = hash_table_size(count);
+  size_t *table = calloc(table_size, sizeof(size_t)); // the index of a chain's first set, plus one
+  size_t *next = calloc(count, sizeof(size_t));       // the index of the next set, plus one
+  if ((table == NULL) || (next == NULL)) {
+    debug(1, "could not allocate memory to merge the configuration sets of \"%s\".",
+          configuration->interface_name);
+  } else {
+    size_t j;
+    for (j = 0; j < count; j++) {
+      configuration_set *sj = &configuration->configuration_sets[j];
+      if (bitset_is_empty(&sj->channel_set))
+        continue;
+      size_t slot = rates_and_formats_fingerprint(sj) & (table_size - 1);
+      while ((table[slot] != 0) &&
+             ((!bitset_equal(&configuration->configuration_sets[table[slot] - 1].rate_set,
+                             &sj->rate_set)) ||
+              (!bitset_equal(&configuration->configuration_sets[table[slot] - 1].format_set,
+                             &sj->format_set))))
+        slot = (slot + 1) & (table_size - 1);
+      if (table[slot] == 0) {
+        table[slot] = j + 1;
+      } else {
+        // try each earlier set in the chain in turn
+        size_t i = table[slot] - 1;
+        int merged = 0;
+        while (merged == 0) {
+          configuration_set *si = &configuration->configuration_sets[i];
+          // check that the channel maps for channels in both configurations are identical
+          int can_merge = 1;
+          int ci;
+          bitset channels = si->channel_set;
+          bitset_intersect(&channels, &sj->channel_set);
+          bitset_for_each(ci, &channels) {
+            if (si->channel_maps[ci] != sj->channel_maps[ci]) {
+              can_merge = 0;
+              break;
+            }
+          }
+          if (can_merge != 0) {
+            // copy in any new channel maps
+            channels = sj->channel_set;
+            bitset_subtract(&channels, &si->channel_set);
+            bitset_for_each(ci, &channels) {
+              si->channel_maps[ci] = sj->channel_maps[ci];
+            }
+            bitset_union(&si->channel_set, &sj->channel_set);
+            int ri;
+            bitset_for_each(ri, &si->rate_set) {
+              if (si->limits[ri] != sj->limits[ri]) {
+                buffer_limits limits, other_limits;
+                get_buffer_limits(si->limits[ri], &limits);
+                get_buffer_limits(sj->limits[ri], &other_limits);
+                widen_buffer_limits(&limits, &other_limits);
+                si->limits[ri] = intern_buffer_limits(&limits);
+              }
+            }
+            bitset_clear(&sj->channel_set); // flag it as empty
+            merged = 1;
+          } else if (next[i] == 0) {
+            next[i] = j + 1; // it starts off on its own at the end of the chain
+            merged = 1;
+          } else {
+            i = next[i] - 1;
+          }
+        }
+      }
+    }
+  }
+  free(next);
+  free(table);
+}
+
+// return 0 if the valid configuration sets of a and b are the same, in the same order
+static int configuration_sets_differ(configuration_bundle *a, configuration_bundle *b) {
+  size_t i = 0, j = 0;
+  int response = 0;
+  while (response == 0) {
+    while ((i < a->configuration_sets_count) &&
+           (bitset_is_empty(&a->configuration_sets[i].channel_set)))
+      i++;
+    while ((j < b->configuration_sets_count) &&
+           (bitset_is_empty(&b->configuration_sets[j].channel_set)))
+      j++;
+    if ((i == a->configuration_sets_count) || (j == b->configuration_sets_count)) {
+      if ((i != a->configuration_sets_count) || (j != b->configuration_sets_count))
+        response = 1; // one has more valid sets than the other
+      break;
+    }
+    configuration_set *ca = &a->configuration_sets[i];
+    configuration_set *cb = &b->configuration_sets[j];
+    if ((!bitset_equal(&ca->rate_set, &cb->rate_set)) ||
+        (!bitset_equal(&ca->channel_set, &cb->channel_set)) ||
+        (!bitset_equal(&ca->format_set, &cb->format_set))) {
+      response = 1;
+    } else {
+      int ci;
+      bitset_for_each(ci, &ca->channel_set) {
+        if (ca->channel_maps[ci] != cb->channel_maps[ci]) {
+          response = 1;
+          break;
+        }
+      }
+      int ri;
+      bitset_for_each(ri, &ca->rate_set) {
+        if (ca->limits[ri] != cb->limits[ri]) {
+          response = 1;
+          break;
+        }
+      }
+    }
+    i++;
+    j++;
+  }
+  return response;
+}
+
+// Interfaces such as "hdmi:" and "iec958:" are often just the "hw:" interface of the same device
+// with hooks that set up the control elements when the PCM is opened. If an interface is a hw or
+// hooks PCM on the same card, device and subdevice as one already probed, and offers the same
+// configuration space, the results of the earlier probe are used rather than probing it again.
+//
+// The subdevices of a device are almost always identical, too. With infer_subdevices, the
+// signature also has a fingerprint of the rates and formats left at each channel count, and an
+// interface whose signature matches that of an interface on another subdevice of the same device,
+// measured earlier, is given its results. If they don't match, the interface is probed in full.
+
+static int pcm_type_may_be_alias(snd_pcm_type_t type) {
+  return (type == SND_PCM_TYPE_HW) || (type == SND_PCM_TYPE_HOOKS);
+}
+
+// fill in the signature of the open PCM, leaving it invalid if it can't be fully read
+static void get_pcm_signature(snd_pcm_t *alsa_handle, snd_pcm_hw_params_t *params,
+                              pcm_signature *signature) {
+  memset(signature, 0, sizeof(pcm_signature));
+  if (backend->pcm_identity(alsa_handle, signature) != 0)
+    return;
+  backend->hw_free(alsa_handle);
+  if ((traced_hw_params_any(alsa_handle, params) != 0) ||
+      ((backend->hw_params_set_access(alsa_handle, params, SND_PCM_ACCESS_RW_INTERLEAVED) != 0) &&
+       (backend->hw_params_set_access(alsa_handle, params, SND_PCM_ACCESS_MMAP_INTERLEAVED) != 0)))
+    return;
+  snd_pcm_format_mask_t *format_mask = NULL;
+  snd_pcm_format_mask_alloca(&format_mask);
+  backend->hw_params_get_channels_min(alsa_handle, params, &signature->channels_min);
+  backend->hw_params_get_channels_max(alsa_handle, params, &signature->channels_max);
+  backend->hw_params_get_rate_min(alsa_handle, params, &signature->rate_min);
+  backend->hw_params_get_rate_max(alsa_handle, params, &signature->rate_max);
+  backend->hw_params_get_format_mask(alsa_handle, params, format_mask);
+  bitset_clear(&signature->format_set);
+  int fi;
+  bitset_for_each(fi, &formats_to_check) {
+    if (snd_pcm_format_mask_test(format_mask, (snd_pcm_format_t)fi))
+      bitset_add(&signature->format_set, fi);
+  }
+  if (infer_subdevices != 0) {
+    snd_pcm_hw_params_t *channel_space = NULL;
+    snd_pcm_hw_params_alloca(&channel_space);
+    uint64_t fingerprint = FINGERPRINT_BASIS;
+    unsigned int ci;
+    for (ci = signature->channels_min < 1 ? 1 : signature->channels_min;
+         (ci <= signature->channels_max) && (ci <= MAXIMUM_CHANNELS); ci++) {
+      snd_pcm_hw_params_copy(channel_space, params);
+      if (backend->hw_params_set_channels(alsa_handle, channel_space, ci) == 0) {
+        unsigned int rate_min = 0, rate_max = 0;
+        backend->hw_params_get_rate_min(alsa_handle, channel_space, &rate_min);
+        backend->hw_params_get_rate_max(alsa_handle, channel_space, &rate_max);
+        backend->hw_params_get_format_mask(alsa_handle, channel_space, format_mask);
+        fingerprint = fingerprint_add(fingerprint, ci);
+        fingerprint = fingerprint_add(fingerprint, rate_min);
+        fingerprint = fingerprint_add(fingerprint, rate_max);
+        bitset_for_each(fi, &signature->format_set) {
+          if (snd_pcm_format_mask_test(format_mask, (snd_pcm_format_t)fi))
+            fingerprint = fingerprint_add(fingerprint, fi);
+        }
+      }
+    }
+    signature->space_fingerprint = fingerprint;
+  }
+  signature->valid = 1;
+}
+
+static int pcm_spaces_match(const pcm_signature *a, const pcm_signature *b) {
+  return (a->valid != 0) && (b->valid != 0) && (a->channels_min == b->channels_min) &&
+         (a->channels_max == b->channels_max) && (a->rate_min == b->rate_min) &&
+         (a->rate_max == b->rate_max) && (bitset_equal(&a->format_set, &b->format_set)) &&
+         (a->space_fingerprint == b->space_fingerprint);
+}
+
+static int pcm_is_alias(const pcm_signature *a, const pcm_signature *b) {
+  return (pcm_type_may_be_alias(a->type)) && (pcm_type_may_be_alias(b->type)) &&
+         (a->card == b->card) && (a->device == b->device) && (a->subdevice == b->subdevice) &&
+         (pcm_spaces_match(a, b));
+}
+
+static int pcm_is_like_other_subdevice(const pcm_signature *a, const pcm_signature *b) {
+  return (a->type == b->type) && (a->card == b->card) && (a->device == b->device) &&
+         (a->subdevice != b->subdevice) && (pcm_spaces_match(a, b));
+}
+
+// Return the first of the candidates that was probed successfully and uses the same PCM or,
+// failing that and if allowed, the first that was measured on a matching subdevice, setting
+// inferred. Return NULL if there isn't one.
+static configuration_bundle *find_results_to_reuse(const pcm_signature *signature,
+                                                   const interface_probe *candidates,
+                                                   size_t candidate_count, int *inferred) {
+  size_t i;
+  for (i = 0; i < candidate_count; i++) {
+    configuration_bundle *base = candidates[i].configuration;
+    if ((base != NULL) && (base->error_status == 0) && (pcm_is_alias(signature, &base->signature)))
+      return base;
+  }
+  if (infer_subdevices != 0) {
+    for (i = 0; i < candidate_count; i++) {
+      configuration_bundle *base = candidates[i].configuration;
+      if ((base != NULL) && (base->error_status == 0) && (base->alias_of[0] == '\0') &&
+          (base->inferred_from[0] == '\0') &&
+          (pcm_is_like_other_subdevice(signature, &base->signature))) {
+        *inferred = 1;
+        return base;
+      }
+    }
+  }
+  return NULL;
+}
+
+// give the configuration a copy of the base's configuration sets
+static int copy_configuration_sets(configuration_bundle *configuration,
+                                   const configuration_bundle *base) {
+  size_t count = base->configuration_sets_count;
+  if (count != 0) {
+    configuration->configuration_sets =
+        arena_alloc(configuration->arena, sizeof(configuration_set) * count);
+    if (configuration->configuration_sets == NULL)
+      return -1;
+    memcpy(configuration->configuration_sets, base->configuration_sets,
+           sizeof(configuration_set) * count);
+  }
+  configuration->configuration_sets_count = count;
+  configuration->configuration_sets_allocated = count;
+  return 0;
+}
+
+// the bundle and its configuration sets are allocated from the arena
+// With the refined engine, an interface that turns out to be an alias of one of the candidates
+// is given a copy of its results. Pass NULL if there are no candidates to consider.
+static configuration_bundle *
+get_permissible_configuration_settings(probe_context *context, arena *arena,
+                                       const char *interface_name, snd_pcm_stream_t stream,
+                                       const char *device_name, const char *subdevice_name,
+                                       const interface_probe *candidates, size_t candidate_count) {
+  debug(1, "get_permissible_configuration_settings for \"%s\".", interface_name);
+  uint64_t interface_start = trace_start();
+  int ret = 0;
+  configuration_bundle *configuration = arena_alloc(arena, sizeof(configuration_bundle));
+  if (configuration != NULL) {
+    configuration->arena = arena;
+    strncpy(configuration->interface_name, interface_name,
+            sizeof(configuration->interface_name) - 1);
+    strncpy(configuration->device_name, device_name, sizeof(configuration->device_name) - 1);
+    strncpy(configuration->subdevice_name, subdevice_name,
+            sizeof(configuration->subdevice_name) - 1);
+
+    uint64_t open_start = trace_start();
+    ret = backend->pcm_open(&context->alsa_handle, interface_name, stream);
+    trace_end(TRACE_PCM_OPEN, open_start, NULL);
+    if (ret == 0) {
+      configuration_bundle *base = NULL;
+      if ((probe_engine == PROBE_ENGINE_REFINED) && (candidates != NULL)) {
+        get_pcm_signature(context->alsa_handle, context->alsa_params, &configuration->signature);
+        int inferred = 0;
+        base = find_results_to_reuse(&configuration->signature, candidates, candidate_count,
+                                     &inferred);
+        if ((base != NULL) && (copy_configuration_sets(configuration, base) == 0)) {
+          if (inferred != 0) {
+            snprintf(configuration->inferred_from, sizeof(configuration->inferred_from), "%s",
+                     base->interface_name);
+            debug(1, "\"%s\" has the same configuration space as \"%s\", so its results are used.",
+                  interface_name, base->interface_name);
+          } else {
+            snprintf(configuration->alias_of, sizeof(configuration->alias_of), "%s",
+                     base->interface_name);
+            debug(1, "\"%s\" uses the same PCM as \"%s\", so its results are used.",
+                  interface_name, base->interface_name);
+          }
+        } else {
+          base = NULL;
+        }
+      }
+      if (base == NULL) {
+        if (probe_engine == PROBE_ENGINE_EXHAUSTIVE)
+          probe_exhaustive(context, interface_name, configuration);
+        else
+          probe_refined(context, interface_name, configuration);
+        merge_configuration_sets(configuration);
+      }
+
+      if (probe_engine == PROBE_ENGINE_VERIFY) {
+        configuration_bundle reference;
+        memset(&reference, 0, sizeof(configuration_bundle));
+        reference.arena = arena; // its sets are left in the arena until the card is released
+        probe_exhaustive(context, interface_name, &reference);
+        merge_configuration_sets(&reference);
+        if (configuration_sets_differ(configuration, &reference) != 0) {
+          warn("the refined and exhaustive probes of \"%s\" give different results.",
+               interface_name);
+          context->probe_mismatches++;
+        } else {
+          debug(1, "the refined and exhaustive probes of \"%s\" agree.", interface_name);
+        }
+      }
+      uint64_t close_start = trace_start();
+      backend->pcm_close(context->alsa_handle);
+      trace_end(TRACE_PCM_CLOSE, close_start, NULL);
+      context->alsa_handle = NULL;
+    }
+    configuration->error_status = ret;
+    if (ret != 0)
+      debug(1, "get_permissible_configuration_settings: error %d (\"%s\") on device \"%s\".", ret,
+            snd_strerror(ret), interface_name);
+  } else {
+    debug(1, "could not allocate an initial configuration bundle");
+  }
+  trace_end(TRACE_INTERFACE, interface_start, interface_name);
+  return configuration;
+}
+
+// With --timeout or --budget, each interface is probed by a worker process -- this program run
+// again with --probe-worker -- so that a device that never answers can be abandoned. The worker
+// writes what it found to its standard output: a worker_result_header, then the rate, format
+// and channel sets of each configuration set, each followed by the channel map of each of its
+// channel counts as a length, the characters of the name and its type.
+
+unsigned int probe_timeout = 0; // the most seconds an interface may take, or 0 for no limit
+unsigned int probe_budget = 0;  // the most seconds the scan may take, or 0 for no limit
+static uint64_t probe_budget_deadline = 0; // when the budget runs out, 0 if there isn't one
+static char worker_path[PATH_MAX];         // this program, run again as a worker
+
+typedef struct {
+  int32_t error_status;
+  uint32_t probe_mismatches;
+  uint32_t configuration_set_count;
+} worker_result_header;
+
+static uint64_t monotonic_time_in_ns(void) {
+  struct timespec tn;
+  clock_gettime(CLOCK_MONOTONIC, &tn);
+  return (uint64_t)tn.tv_sec * 1000000000 + tn.tv_nsec;
+}
+
+static int probe_workers_in_use(void) {
+  return ((probe_timeout != 0) || (probe_budget != 0)) && (backend == &alsa_backend);
+}
+
+// return the time by which a probe, or a call on a card, must be done, or UINT64_MAX if there
+// is no limit
+static uint64_t probe_deadline(void) {
+  uint64_t deadline = UINT64_MAX;
+  if (probe_timeout != 0)
+    deadline = monotonic_time_in_ns() + (uint64_t)probe_timeout * 1000000000;
+  if ((probe_budget_deadline != 0) && (probe_budget_deadline < deadline))
+    deadline = probe_budget_deadline;
+  return deadline;
+}
+
+// The calls made on the cards' control interfaces -- listing the cards, reading a card's
+// information and its devices, and loading its mixers -- are made in this process, so with
+// --timeout or --budget each is made on a thread of its own, under the same deadline as the
+// probes, so that a control interface that never answers can be abandoned too. The call works
+// on a copy of what it fills in, which is copied back only if it finishes in time. Otherwise
+// the thread is left to finish, if it ever does, and to free the copy.
+typedef struct {
+  void (*call)(void *subject);
+  void (*release)(void *subject); // frees what an abandoned call made, if it isn't NULL
+  int finished;
+  int abandoned;
+  pthread_mutex_t lock;
+  pthread_cond_t finished_changed;
+  char subject[];
+} deadline_call;
+
+static void deadline_call_free(deadline_call *dc) {
+  pthread_cond_destroy(&dc->finished_changed);
+  pthread_mutex_destroy(&dc->lock);
+  free(dc);
+}
+
+static void *deadline_call_thread(void *arg) {
+  deadline_call *dc = (deadline_call *)arg;
+  dc->call(dc->subject);
+  pthread_mutex_lock(&dc->lock);
+  dc->finished = 1;
+  int abandoned = dc->abandoned;
+  pthread_cond_signal(&dc->finished_changed);
+  pthread_mutex_unlock(&dc->lock);
+  if (abandoned != 0) {
+    if (dc->release != NULL)
+      dc->release(dc->subject);
+    deadline_call_free(dc);
+  }
+  return NULL;
+}
+
+// make the call on the subject, of subject_size bytes, giving up on it if it hasn't finished by
+// the deadline; return 0 if it finished, or -ETIMEDOUT, leaving the subject as it was
+static int call_before_deadline(void (*call)(void *subject), void (*release)(void *subject),
+                                void *subject, size_t subject_size, uint64_t deadline) {
+  if (monotonic_time_in_ns() >= deadline)
+    return -ETIMEDOUT;
+  deadline_call *dc = malloc(sizeof(deadline_call) + subject_size);
+  if (dc == NULL) {
+    debug(1, "could not allocate a call with a deadline -- making it without one.");
+    call(subject);
+    return 0;
+  }
+  memset(dc, 0, sizeof(deadline_call));
+  dc->call = call;
+  dc->release = release;
+  memcpy(dc->subject, subject, subject_size);
+  pthread_mutex_init(&dc->lock, NULL);
+  pthread_condattr_t attributes;
+  pthread_condattr_init(&attributes);
+  pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+  pthread_cond_init(&dc->finished_changed, &attributes);
+  pthread_condattr_destroy(&attributes);
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, deadline_call_thread, dc) != 0) {
+    debug(1, "could not start a thread for a call with a deadline -- making it without one.");
+    deadline_call_free(dc);
+    call(subject);
+    return 0;
+  }
+  pthread_detach(thread);
+  struct timespec until;
+  until.tv_sec = deadline / 1000000000;
+  until.tv_nsec = deadline % 1000000000;
+  int result = 0;
+  pthread_mutex_lock(&dc->lock);
+  while ((dc->finished == 0) && (result != ETIMEDOUT))
+    result = pthread_cond_timedwait(&dc->finished_changed, &dc->lock, &until);
+  if (dc->finished == 0)
+    dc->abandoned = 1; // the thread frees it now
+  pthread_mutex_unlock(&dc->lock);
+  if (dc->abandoned != 0)
+    return -ETIMEDOUT;
+  memcpy(subject, dc->subject, subject_size);
+  deadline_call_free(dc);
+  return 0;
+}
+
+typedef struct {
+  int (*call)(const char *control_interface_name, card_probe *card);
+  char control_interface_name[64];
+  card_probe card;
+  int result;
+} card_call;
+
+static void make_card_call(void *subject) {
+  card_call *cc = (card_call *)subject;
+  cc->result = cc->call(cc->control_interface_name, &cc->card);
+}
+
+// make one of the backend's calls on the card, abandoning it if it takes too long
+static int call_card(int (*call)(const char *control_interface_name, card_probe *card),
+                     const char *control_interface_name, card_probe *card) {
+  if (probe_workers_in_use() == 0)
+    return call(control_interface_name, card);
+  card_call cc;
+  memset(&cc, 0, sizeof(cc));
+  cc.call = call;
+  snprintf(cc.control_interface_name, sizeof(cc.control_interface_name), "%s",
+           control_interface_name);
+  cc.card = *card;
+  if (call_before_deadline(make_card_call, NULL, &cc, sizeof(cc), probe_deadline()) != 0) {
+    warn("\"%s\" did not respond in time and was abandoned.", control_interface_name);
+    card->arena_shared = 1;
+    return -ETIMEDOUT;
+  }
+  *card = cc.card;
+  return cc.result;
+}
+
+static int load_card_mixers(const char *control_interface_name, card_probe *card) {
+  return backend->load_mixers(control_interface_name, &card->mixers);
+}
+
+typedef struct {
+  char **names;
+  size_t count;
+} control_interface_list;
+
+static void list_control_interfaces(void *subject) {
+  control_interface_list *list = (control_interface_list *)subject;
+  list->count = backend->get_control_interface_names(&list->names);
+}
+
+static void release_control_interfaces(void *subject) {
+  control_interface_list *list = (control_interface_list *)subject;
+  free_control_interface_names(list->names, list->count);
+}
+
+// list the cards' control interfaces, abandoning the list if it takes too long
+static size_t list_control_interfaces_in_time(char ***control_interface_names) {
+  control_interface_list list;
+  memset(&list, 0, sizeof(list));
+  if (probe_workers_in_use() == 0)
+    list_control_interfaces(&list);
+  else if (call_before_deadline(list_control_interfaces, release_control_interfaces, &list,
+                                sizeof(list), probe_deadline()) != 0)
+    warn("the sound cards could not be listed in time.");
+  *control_interface_names = list.names;
+  return list.count;
+}
+
+static void write_worker_result(configuration_bundle *configuration, unsigned int mismatches,
+                                FILE *output) {
+  worker_result_header header;
+  memset(&header, 0, sizeof(header));
+  header.error_status = configuration->error_status;
+  header.probe_mismatches = mismatches;
+  size_t si;
+  for (si = 0; si < configuration->configuration_sets_count; si++)
+    if (bitset_is_empty(&configuration->configuration_sets[si].channel_set) == 0)
+      header.configuration_set_count++;
+  fwrite(&header, sizeof(header), 1, output);
+  for (si = 0; si < configuration->configuration_sets_count; si++) {
+    configuration_set *set = &configuration->configuration_sets[si];
+    if (bitset_is_empty(&set->channel_set) == 0) {
+      fwrite(&set->rate_set, sizeof(bitset), 1, output);
+      fwrite(&set->format_set, sizeof(bitset), 1, output);
+      fwrite(&set->channel_set, sizeof(bitset), 1, output);
+      int channels;
+      bitset_for_each(channels, &set->channel_set) {
+        const char *channel_map = channel_map_name(set->channel_maps[channels]);
+        uint16_t length = strlen(channel_map);
+        int32_t type = channel_map_type(set->channel_maps[channels]);
+        fwrite(&length, sizeof(length), 1, output);
+        fwrite(channel_map, 1, length, output);
+        fwrite(&type, sizeof(type), 1, output);
+      }
+      int rates;
+      bitset_for_each(rates, &set->rate_set) {
+        buffer_limits limits;
+        get_buffer_limits(set->limits[rates], &limits);
+        fwrite(&limits, sizeof(buffer_limits), 1, output);
+      }
+    }
+  }
+}
+
+// take size bytes from the worker's result, if there are that many left
+static int take_from_result(const char **cursor, size_t *remaining, void *destination,
+                            size_t size) {
+  if (*remaining < size)
+    return -1;
+  memcpy(destination, *cursor, size);
+  *cursor += size;
+  *remaining -= size;
+  return 0;
+}
+
+// return 0 if the worker's result could be read into the configuration bundle
+static int read_worker_result(const char *result, size_t size, configuration_bundle *configuration,
+                              probe_context *context) {
+  worker_result_header header;
+  if (take_from_result(&result, &size, &header, sizeof(header)) != 0)
+    return -1;
+  uint32_t i;
+  for (i = 0; i < header.configuration_set_count; i++) {
+    configuration_set *set = new_configuration_set(configuration);
+    if (set == NULL)
+      return -1;
+    memset(set, 0, sizeof(configuration_set));
+    if ((take_from_result(&result, &size, &set->rate_set, sizeof(bitset)) != 0) ||
+        (take_from_result(&result, &size, &set->format_set, sizeof(bitset)) != 0) ||
+        (take_from_result(&result, &size, &set->channel_set, sizeof(bitset)) != 0))
+      return -1;
+    int channels;
+    bitset_for_each(channels, &set->channel_set) {
+      uint16_t length;
+      char channel_map[CHANNEL_MAP_STORE_SIZE];
+      int32_t type;
+      if ((take_from_result(&result, &size, &length, sizeof(length)) != 0) ||
+          (length >= sizeof(channel_map)) ||
+          (take_from_result(&result, &size, channel_map, length) != 0) ||
+          (take_from_result(&result, &size, &type, sizeof(type)) != 0))
+        return -1;
+      channel_map[length] = '\0';
+      set->channel_maps[channels] = intern_channel_map(channel_map, type);
+    }
+    int rates;
+    bitset_for_each(rates, &set->rate_set) {
+      buffer_limits limits;
+      if ((rates >= MAXIMUM_RATES) ||
+          (take_from_result(&result, &size, &limits, sizeof(buffer_limits)) != 0))
+        return -1;
+      set->limits[rates] = intern_buffer_limits(&limits);
+    }
+  }
+  if (size != 0)
+    return -1;
+  configuration->error_status = header.error_status;
+  context->probe_mismatches += header.probe_mismatches;
+  return 0;
+}
+
+// wait until the worker has finished or the deadline has passed, and return what it wrote
+static char *read_from_worker(int fd, uint64_t deadline, size_t *size, int *timed_out) {
+  char *result = NULL;
+  size_t allocated = 0;
+  *size = 0;
+  *timed_out = 0;
+  while (1) {
+    uint64_t now = monotonic_time_in_ns();
+    if (now >= deadline) {
+      *timed_out = 1;
+      break;
+    }
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    int milliseconds = (deadline - now + 999999) / 1000000;
+    int ret = poll(&pfd, 1, milliseconds);
+    if ((ret < 0) && (errno != EINTR))
+      break;
+    if (ret <= 0)
+      continue;
+    if (*size == allocated) {
+      size_t new_size = allocated == 0 ? 4096 : allocated * 2;
+      char *new_result = realloc(result, new_size);
+      if (new_result == NULL)
+        break;
+      result = new_result;
+      allocated = new_size;
+    }
+    ssize_t count = read(fd, result + *size, allocated - *size);
+    if (count > 0)
+      *size += count;
+    else if ((count == 0) || (errno != EINTR))
+      break; // the worker has finished, or the pipe is broken
+  }
+  return result;
+}
+
+// probe the interface in a worker process, giving up on it if it takes too long
+static configuration_bundle *get_configuration_settings_in_worker(probe_context *context,
+                                                                  arena *arena,
+                                                                  const char *interface_name,
+                                                                  snd_pcm_stream_t stream,
+                                                                  const char *device_name,
+                                                                  const char *subdevice_name) {
+  uint64_t interface_start = trace_start();
+  configuration_bundle *configuration = arena_alloc(arena, sizeof(configuration_bundle));
+  if (configuration == NULL) {
+    debug(1, "could not allocate an initial configuration bundle");
+    return NULL;
+  }
+  configuration->arena = arena;
+  snprintf(configuration->interface_name, sizeof(configuration->interface_name), "%s",
+           interface_name);
+  snprintf(configuration->device_name, sizeof(configuration->device_name), "%s", device_name);
+  snprintf(configuration->subdevice_name, sizeof(configuration->subdevice_name), "%s",
+           subdevice_name);
+  configuration->error_status = -EIO;
+
+  uint64_t deadline = probe_deadline();
+
+  // everything the worker needs is prepared before it is forked
+  char worker_argument[sizeof("--probe-worker=") + sizeof(configuration->interface_name)];
+  snprintf(worker_argument, sizeof(worker_argument), "--probe-worker=%s", interface_name);
+  char *worker_arguments[] = {worker_path, worker_argument, NULL, NULL, NULL, NULL, NULL};
+  int wi = 2;
+  if (stream == SND_PCM_STREAM_CAPTURE)
+    worker_arguments[wi++] = "--capture"; // to a worker, this means probe the capture stream
+  if (probe_engine == PROBE_ENGINE_EXHAUSTIVE)
+    worker_arguments[wi++] = "--exhaustive";
+  else if (probe_engine == PROBE_ENGINE_VERIFY)
+    worker_arguments[wi++] = "--verify";
+  if (probe_without_committing != 0)
+    worker_arguments[wi++] = "--no-commit";
+  if (report_buffer_limits != 0)
+    worker_arguments[wi++] = "--latency";
+
+  int fds[2];
+  if (monotonic_time_in_ns() >= deadline) {
+    debug(1, "there is no time left to probe \"%s\".", interface_name);
+    configuration->error_status = -ETIMEDOUT;
+    context->probe_timeouts++;
+  } else if (pipe2(fds, O_CLOEXEC) != 0) {
+    debug(1, "could not make a pipe to probe \"%s\": \"%s\".", interface_name, strerror(errno));
+  } else {
+    pid_t pid = fork();
+    if (pid == 0) {
+      // only async-signal-safe calls may be made here
+      if (dup2(fds[1], STDOUT_FILENO) == STDOUT_FILENO)
+        execv(worker_path, worker_arguments);
+      _exit(127);
+    }
+    close(fds[1]);
+    if (pid < 0) {
+      debug(1, "could not start a worker to probe \"%s\": \"%s\".", interface_name,
+            strerror(errno));
+    } else {
+      size_t size;
+      int timed_out;
+      char *result = read_from_worker(fds[0], deadline, &size, &timed_out);
+      int status = 0;
+      if (timed_out != 0) {
+        kill(pid, SIGKILL);
+        // a worker stuck in the kernel may not die straight away -- if so, it is left behind
+        int tries;
+        for (tries = 0; (tries < 100) && (waitpid(pid, &status, WNOHANG) == 0); tries++)
+          usleep(1000);
+        warn("\"%s\" did not respond in time and was abandoned.", interface_name);
+        configuration->error_status = -ETIMEDOUT;
+        context->probe_timeouts++;
+      } else if ((waitpid(pid, &status, 0) != pid) || (WIFEXITED(status) == 0) ||
+                 (WEXITSTATUS(status) != 0) ||
+                 (read_worker_result(result, size, configuration, context) != 0)) {
+        debug(1, "the worker probing \"%s\" failed.", interface_name);
+        configuration->configuration_sets_count = 0;
+        configuration->error_status = -EIO;
+      }
+      free(result);
+    }
+    close(fds[0]);
+  }
+  if (configuration->error_status != 0)
+    debug(1, "get_configuration_settings_in_worker: error %d (\"%s\") on device \"%s\".",
+          configuration->error_status, snd_strerror(configuration->error_status),
+          interface_name);
+  trace_end(TRACE_INTERFACE, interface_start, interface_name);
+  return configuration;
+}
+
+// probe the interface and write the result to standard output -- what a worker process does
+static int run_probe_worker(const char *interface_name) {
+  int result = 1;
+  probe_context context;
+  arena *arena = arena_create();
+  if ((arena != NULL) && (probe_context_init(&context) == 0)) {
+    snd_pcm_stream_t stream =
+        probe_capture != 0 ? SND_PCM_STREAM_CAPTURE : SND_PCM_STREAM_PLAYBACK;
+    configuration_bundle *configuration = get_permissible_configuration_settings(
+        &context, arena, interface_name, stream, "", "", NULL, 0);
+    if (configuration != NULL) {
+      write_worker_result(configuration, context.probe_mismatches, stdout);
+      if (fflush(stdout) == 0)
+        result = 0;
+    }
+    probe_context_free(&context);
+  }
+  if (arena != NULL)
+    arena_release(arena);
+  return result;
+}
+
+// return 0 if both were probed without error and their valid configuration sets are the same,
+// in the same order
+int configurations_equal(configuration_bundle *a, configuration_bundle *b) {
+  int response = 1; // assume they are different
+  if ((a == NULL) || (b == NULL)) {
+    debug(1, "configurations_equal: null configuration bundle");
+  } else {
+    if (a->error_status != 0)
+      debug(3, "Error a %d (\"%s\") on %s.", a->error_status, snd_strerror(a->error_status),
+            a->device_name);
+    if (b->error_status != 0)
+      debug(3, "Error b %d (\"%s\") on %s.", b->error_status, snd_strerror(b->error_status),
+            b->device_name);
+    if ((a->error_status == 0) && (b->error_status == 0))
+      response = configuration_sets_differ(a, b);
+  }
+  return response;
+}
+
+// Group the configurations that were probed without error and are the same, using a hash
+// table of their fingerprints. The first configuration of each group is left as it is; each
+// of the others is marked as already handled. next_in_group[ci] is the index, plus one, of the
+// next configuration in the same group as configuration ci, or zero if there are no more.
+static void group_identical_configurations(configuration_bundle **configurations, size_t count,
+                                           size_t *next_in_group) {
+  memset(next_in_group, 0, sizeof(size_t) * count);
+  size_t table_size = hash_table_size(count);
+  size_t *table = calloc(table_size, sizeof(size_t)); // a group's first and last index, plus one
+  size_t *last = calloc(table_size, sizeof(size_t));
+  uint64_t *fingerprints = calloc(table_size, sizeof(uint64_t));
+  if ((table == NULL) || (last == NULL) || (fingerprints == NULL)) {
+    debug(1, "could not allocate memory to group the interfaces' configurations.");
+  } else {
+    size_t ci;
+    for (ci = 0; ci < count; ci++) {
+      if (configurations[ci]->error_status != 0)
+        continue;
+      uint64_t fingerprint = configuration_bundle_fingerprint(configurations[ci]);
+      size_t slot = fingerprint & (table_size - 1);
+      while ((table[slot] != 0) &&
+             ((fingerprints[slot] != fingerprint) ||
+              (configurations_equal(configurations[table[slot] - 1], configurations[ci]) != 0)))
+        slot = (slot + 1) & (table_size - 1);
+      if (table[slot] == 0) {
+        table[slot] = ci + 1;
+        fingerprints[slot] = fingerprint;
+      } else {
+        next_in_group[last[slot] - 1] = ci + 1;
+        configurations[ci]->already_handled = 1;
+      }
+      last[slot] = ci + 1;
+    }
+  }
+  free(fingerprints);
+  free(last);
+  free(table);
+}
+
+// the line above and below the headings of a table of configurations, and below the table
+// the channel map, followed by its type if its channels can be rearranged
+static void describe_channel_map(uint16_t channel_map, char *description, size_t size) {
+  int type = channel_map_type(channel_map);
+  if (type == SND_CHMAP_TYPE_NONE)
+    snprintf(description, size, "%s", channel_map_name(channel_map));
+  else
+    snprintf(description, size, "%s (%s)", channel_map_name(channel_map),
+             snd_pcm_chmap_type_name((enum snd_pcm_chmap_type)type));
+}
+
+static void print_configuration_rule(FILE *output) {
+  fprintf(output, "                       "
+                  "-------------------------------------------------------------------------------"
+                  "------------------------------");
+  if (report_buffer_limits != 0)
+    fprintf(output, "----------------------------------------------------------------");
+  fprintf(output, "\n");
+}
+
+// print the period size, buffer size and period count ranges, and the minimum latency, as
+// columns of a table of configurations, e.g. "32-16384" -- or blanks if they weren't read
+static void print_buffer_limits(uint16_t limits_number, unsigned int rate, FILE *output) {
+  buffer_limits limits_store;
+  const buffer_limits *limits = &limits_store;
+  get_buffer_limits(limits_number, &limits_store);
+  if (limits->buffer_size_max == 0) {
+    fprintf(output, "|%15s |%15s |%9s |%17s ", "", "", "", "");
+  } else {
+    char period_sizes[24], buffer_sizes[24], periods[24];
+    snprintf(period_sizes, sizeof(period_sizes), "%u-%u", limits->period_size_min,
+             limits->period_size_max);
+    snprintf(buffer_sizes, sizeof(buffer_sizes), "%u-%u", limits->buffer_size_min,
+             limits->buffer_size_max);
+    snprintf(periods, sizeof(periods), "%u-%u", limits->periods_min, limits->periods_max);
+    fprintf(output, "|%15s |%15s |%9s |%17u ", period_sizes, buffer_sizes, periods,
+            minimum_latency(limits, rate));
+  }
+}
+
+void print_configuration(configuration_bundle *configuration, unsigned int similar_interface_count,
+                         FILE *output) {
+  if (configuration != NULL) {
+    unsigned int i;
+    unsigned int valid_configuration_sets = 0;
+    for (i = 0; i < configuration->configuration_sets_count; i++) {
+      if (!bitset_is_empty(&configuration->configuration_sets[i].channel_set)) {
+        valid_configuration_sets++;
+      }
+    }
+    unsigned int printed_configuration_sets = 0;
+    for (i = 0; i < configuration->configuration_sets_count; i++) {
+
+      if (!bitset_is_empty(&configuration->configuration_sets[i].channel_set)) {
+        if (printed_configuration_sets == 0) {
+          if (similar_interface_count == 1)
+            fprintf(output, "                  This interface supports ");
+          else
+            fprintf(output, "                  These interfaces support ");
+        } else {
+          if (similar_interface_count == 1)
+            fprintf(output, "                    It also supports ");
+          else
+            fprintf(output, "                    They also support ");
+        }
+        fprintf(output, "any rate, format and channel combination from the "
+                        "following "
+                        "table:\n");
+        print_configuration_rule(output);
+        fprintf(output, "                      |    Rate ");
+        if (report_buffer_limits != 0)
+          fprintf(output, "|%15s |%15s |%9s |%17s ", "Period Size", "Buffer Size", "Periods",
+                  "Min Latency (us)");
+        fprintf(output, "|              Format |  Channels | "
+                        "Channel Map                                                     |\n");
+        print_configuration_rule(output);
+        configuration_set *tcs = &configuration->configuration_sets[i];
+        // the rates, formats and channel counts are listed side by side, one of each per row
+        int tri = bitset_next(&tcs->rate_set, -1);
+        int tfi = bitset_next(&tcs->format_set, -1);
+        int tci = bitset_next(&tcs->channel_set, -1);
+        while ((tri >= 0) || (tfi >= 0) || (tci >= 0)) {
+          // next rate
+          if (tri >= 0) {
+            fprintf(output, "                      |%8d ", rates_to_check[tri]);
+            if (report_buffer_limits != 0)
+              print_buffer_limits(tcs->limits[tri], rates_to_check[tri], output);
+            tri = bitset_next(&tcs->rate_set, tri);
+          } else {
+            fprintf(output, "                      |         ");
+            if (report_buffer_limits != 0)
+              fprintf(output, "|%15s |%15s |%9s |%17s ", "", "", "", "");
+          }
+          // next format
+          if (tfi >= 0) {
+            fprintf(output, "|%20s ", snd_pcm_format_name((snd_pcm_format_t)tfi));
+            tfi = bitset_next(&tcs->format_set, tfi);
+          } else {
+            fprintf(output, "|                     ");
+          }
+          // next channel count
+          if (tci >= 0) {
+            char channel_map[CHANNEL_MAP_STORE_SIZE + 16];
+            describe_channel_map(tcs->channel_maps[tci], channel_map, sizeof(channel_map));
+            fprintf(output, "|%10d | %-63s |\n", tci, channel_map);
+            tci = bitset_next(&tcs->channel_set, tci);
+          } else {
+            fprintf(output, "|%10s | %-63s |\n", "", "");
+          }
+        }
+        print_configuration_rule(output);
+        printed_configuration_sets++;
+      }
+    }
+  } else {
+    debug(1, "no configuration to print!");
+  }
+}
+
+// The machine-readable formats. Each record is an object with a "type" of "header", "card",
+// "mixer", "interface", "configuration_set", "stress" or "end", and is emitted as soon as what it
+// describes is known. The header gives the schema version, which changes if a field is
+// removed or changes its meaning; fields may be added without changing it.
+
+#define JSON_SCHEMA_VERSION 1
+
+static const char *interface_status(int error_status) {
+  switch (error_status) {
+  case 0:
+    return "ok";
+  case -EBUSY:
+    return "busy";
+  case -524:
+    return "uninitialised";
+  case -ENODEV:
+    return "not_found";
+  case -ETIMEDOUT:
+    return "timeout";
+  default:
+    return "error";
+  }
+}
+
+static const char *stream_name(snd_pcm_stream_t stream) {
+  return stream == SND_PCM_STREAM_CAPTURE ? "capture" : "playback";
+}
+
+static void emit_header_record(json_writer *writer, unsigned int card_count) {
+  json_record_begin(writer);
+  json_string(writer, "type", "header");
+  json_string(writer, "schema", "dacquery");
+  json_integer(writer, "schema_version", JSON_SCHEMA_VERSION);
+  json_string(writer, "alsa_version", backend->library_version());
+  json_integer(writer, "card_count", card_count);
+  json_record_end(writer);
+  json_output_record(writer);
+}
+
+static void emit_end_record(json_writer *writer, unsigned int card_count) {
+  json_record_begin(writer);
+  json_string(writer, "type", "end");
+  json_integer(writer, "card_count", card_count);
+  json_record_end(writer);
+  json_output_record(writer);
+}
+
+static void emit_card_record(probe_context *context, card_probe *card) {
+  if (output_format == OUTPUT_FORMAT_TEXT)
+    return;
+  json_writer *writer = &context->writer;
+  json_record_begin(writer);
+  json_string(writer, "type", "card");
+  json_integer(writer, "card", card->card_number);
+  json_string(writer, "ctl", card->control_interface_name);
+  json_string(writer, "name", card->name);
+  json_string(writer, "long_name", card->longname);
+  json_string(writer, "driver", card->driver);
+  json_string(writer, "components", card->components);
+  json_array_begin(writer, "devices");
+  size_t di;
+  for (di = 0; di < card->device_count; di++) {
+    json_object_begin(writer, NULL);
+    json_integer(writer, "device", card->devices[di].number);
+    json_string(writer, "name", card->devices[di].name);
+    json_string(writer, "id", card->devices[di].id);
+    json_integer(writer, "subdevices", card->devices[di].subdevices_available);
+    json_object_end(writer);
+  }
+  json_array_end(writer);
+  json_record_end(writer);
+  json_output_record(writer);
+}
+
+static void emit_mixer_records(probe_context *context, card_probe *card) {
+  if ((output_format == OUTPUT_FORMAT_TEXT) || (card->mixer_status != 0))
+    return;
+  json_writer *writer = &context->writer;
+  size_t mi;
+  for (mi = 0; mi < card->mixers.first_free; mi++) {
+    mixer_info_t *mixer = &card->mixers.mixer[mi];
+    json_record_begin(writer);
+    json_string(writer, "type", "mixer");
+    json_integer(writer, "card", card->card_number);
+    json_string(writer, "name", mixer->name);
+    json_integer(writer, "index", mixer->index);
+    json_string(writer, "stream", mixer->capture != 0 ? "capture" : "playback");
+    json_integer(writer, "min", mixer->minv);
+    json_integer(writer, "max", mixer->maxv);
+    json_boolean(writer, "has_db_range", mixer->has_a_decibel_range);
+    if (mixer->has_a_decibel_range != 0) {
+      json_boolean(writer, "lowest_value_is_mute", mixer->lowest_value_is_mute);
+      json_number(writer, "min_db", mixer->mindecibels * 0.01);
+      json_number(writer, "max_db", mixer->maxdecibels * 0.01);
+    }
+    if (mixer->volume_curve != VOLUME_CURVE_NONE) {
+      json_object_begin(writer, "volume_curve");
+      json_string(writer, "kind", volume_curve_name(mixer->volume_curve));
+      json_number(writer, "error_db", mixer->volume_curve_error * 0.01);
+      json_array_begin(writer, "points");
+      unsigned int pi;
+      for (pi = 0; pi < mixer->volume_point_count; pi++) {
+        json_object_begin(writer, NULL);
+        json_integer(writer, "volume", mixer->volume_points[pi].volume);
+        json_number(writer, "db", mixer->volume_points[pi].decibels * 0.01);
+        json_object_end(writer);
+      }
+      json_array_end(writer);
+      json_object_end(writer);
+    }
+    json_record_end(writer);
+    json_output_record(writer);
+  }
+}
+
+// emit the interface, followed by each of its configuration sets
+static void emit_interface_records(probe_context *context, card_probe *card,
+                                   interface_probe *probe) {
+  configuration_bundle *configuration = probe->configuration;
+  if ((output_format == OUTPUT_FORMAT_TEXT) || (configuration == NULL) ||
+      (configuration->error_status == -ENOENT))
+    return;
+  json_writer *writer = &context->writer;
+  card_device *device = &card->devices[probe->device_index];
+  unsigned int set_count = 0;
+  size_t si;
+  for (si = 0; si < configuration->configuration_sets_count; si++)
+    if (!bitset_is_empty(&configuration->configuration_sets[si].channel_set))
+      set_count++;
+  json_record_begin(writer);
+  json_string(writer, "type", "interface");
+  json_integer(writer, "card", card->card_number);
+  json_string(writer, "interface", probe->interface_name);
+  json_string(writer, "stream", stream_name(probe->stream));
+  json_integer(writer, "device", device->number);
+  json_string(writer, "device_name", device->name);
+  json_integer(writer, "subdevice", probe->subdevice);
+  json_string(writer, "subdevice_name", probe->subdevice_name);
+  json_string(writer, "status", interface_status(configuration->error_status));
+  if (configuration->error_status != 0) {
+    json_integer(writer, "error", configuration->error_status);
+    json_string(writer, "error_text", snd_strerror(configuration->error_status));
+  }
+  json_integer(writer, "configuration_set_count", set_count);
+  if (configuration->alias_of[0] != '\0')
+    json_string(writer, "alias_of", configuration->alias_of);
+  if (configuration->inferred_from[0] != '\0')
+    json_string(writer, "inferred_from", configuration->inferred_from);
+  json_record_end(writer);
+  json_output_record(writer);
+
+  unsigned int set_number = 0;
+  for (si = 0; si < configuration->configuration_sets_count; si++) {
+    configuration_set *set = &configuration->configuration_sets[si];
+    if (!bitset_is_empty(&set->channel_set)) {
+      json_record_begin(writer);
+      json_string(writer, "type", "configuration_set");
+      json_integer(writer, "card", card->card_number);
+      json_string(writer, "interface", probe->interface_name);
+      json_string(writer, "stream", stream_name(probe->stream));
+      json_integer(writer, "set", set_number++);
+      int i;
+      json_array_begin(writer, "rates");
+      bitset_for_each(i, &set->rate_set) {
+        json_integer(writer, NULL, rates_to_check[i]);
+      }
+      json_array_end(writer);
+      json_array_begin(writer, "formats");
+      bitset_for_each(i, &set->format_set) {
+        json_string(writer, NULL, snd_pcm_format_name((snd_pcm_format_t)i));
+      }
+      json_array_end(writer);
+      json_array_begin(writer, "channels");
+      bitset_for_each(i, &set->channel_set) {
+        json_object_begin(writer, NULL);
+        json_integer(writer, "count", i);
+        if (set->channel_maps[i] != 0)
+          json_string(writer, "channel_map", channel_map_name(set->channel_maps[i]));
+        if (channel_map_type(set->channel_maps[i]) != SND_CHMAP_TYPE_NONE)
+          json_string(writer, "channel_map_type",
+                      snd_pcm_chmap_type_name(
+                          (enum snd_pcm_chmap_type)channel_map_type(set->channel_maps[i])));
+        json_object_end(writer);
+      }
+      json_array_end(writer);
+      if (report_buffer_limits != 0) {
+        json_array_begin(writer, "buffer_limits");
+        bitset_for_each(i, &set->rate_set) {
+          buffer_limits limits_store;
+          const buffer_limits *limits = &limits_store;
+          get_buffer_limits(set->limits[i], &limits_store);
+          if (limits->buffer_size_max != 0) {
+            json_object_begin(writer, NULL);
+            json_integer(writer, "rate", rates_to_check[i]);
+            json_integer(writer, "period_size_min", limits->period_size_min);
+            json_integer(writer, "period_size_max", limits->period_size_max);
+            json_integer(writer, "buffer_size_min", limits->buffer_size_min);
+            json_integer(writer, "buffer_size_max", limits->buffer_size_max);
+            json_integer(writer, "periods_min", limits->periods_min);
+            json_integer(writer, "periods_max", limits->periods_max);
+            json_integer(writer, "min_latency_us", minimum_latency(limits, rates_to_check[i]));
+            json_object_end(writer);
+          }
+        }
+        json_array_end(writer);
+      }
+      json_record_end(writer);
+      json_output_record(writer);
+    }
+  }
+}
+
+// Interfaces enumerated under the same device and subdevice share the same hardware PCM, so they
+// are put in a group and probed one after the other. Different groups are probed at the same
+// time, up to interface_probe_jobs at once. With infer_subdevices, the interfaces of every
+// subdevice of a device are put in the same group, so that the results of one subdevice are
+// there to be used for the others.
+typedef struct {
+  card_probe *card;
+  size_t *group_starts; // the index of the first probe of each group, plus one past the last
+  size_t group_count;
+  size_t next_group; // the next group to be picked up by a worker
+  unsigned int probe_mismatches;
+  unsigned int probe_timeouts;
+  pthread_mutex_t lock;
+} interface_probe_queue;
+
+// probe the interface unless it has already been probed
+// If the interface was probed and the result is final, i.e. it won't be probed again because it
+// was busy, it is emitted straight away in the machine-readable formats. The probes from
+// first_candidate up to, but not including, end_candidate are already done or are not being
+// done by anything else, so the interface may be found to be an alias of one of them.
+static void probe_interface(probe_context *context, card_probe *card, interface_probe *probe,
+                            int busy_is_final, size_t first_candidate, size_t end_candidate) {
+  if (probe->configuration != NULL)
+    return;
+  if (probe_workers_in_use())
+    probe->configuration = get_configuration_settings_in_worker(
+        context, card->arena, probe->interface_name, probe->stream,
+        card->devices[probe->device_index].name, probe->subdevice_name);
+  else
+    probe->configuration = get_permissible_configuration_settings(
+        context, card->arena, probe->interface_name, probe->stream,
+        card->devices[probe->device_index].name, probe->subdevice_name,
+        &card->probes[first_candidate], end_candidate - first_candidate);
+  if (probe->configuration == NULL)
+    debug(1, "no configuration bundle for interface \"%s\".", probe->interface_name);
+  else if ((busy_is_final != 0) || (probe->configuration->error_status != -EBUSY))
+    emit_interface_records(context, card, probe);
+}
+
+static void *interface_probe_worker(void *arg) {
+  interface_probe_queue *queue = (interface_probe_queue *)arg;
+  probe_context context;
+  if (probe_context_init(&context) == 0) {
+    int finished = 0;
+    while (finished == 0) {
+      size_t group = queue->group_count;
+      pthread_mutex_lock(&queue->lock);
+      if (queue->next_group < queue->group_count)
+        group = queue->next_group++;
+      pthread_mutex_unlock(&queue->lock);
+      if (group < queue->group_count) {
+        size_t pi;
+        for (pi = queue->group_starts[group]; pi < queue->group_starts[group + 1]; pi++)
+          probe_interface(&context, queue->card, &queue->card->probes[pi], 0,
+                          queue->group_starts[group], pi);
+      } else {
+        finished = 1;
+      }
+    }
+    pthread_mutex_lock(&queue->lock);
+    queue->probe_mismatches += context.probe_mismatches;
+    queue->probe_timeouts += context.probe_timeouts;
+    pthread_mutex_unlock(&queue->lock);
+    probe_context_free(&context);
+  } else {
+    debug(1, "could not allocate a probe context for an interface worker");
+  }
+  return NULL;
+}
+
+// probe the interfaces from first up to, but not including, end
+static void probe_interface_range(card_probe *card, probe_context *context, size_t first,
+                                  size_t end) {
+  interface_probe *probes = card->probes;
+  size_t probe_count = end - first;
+  unsigned int workers_started = 0;
+  if ((interface_probe_jobs > 1) && (probe_count > 1)) {
+    interface_probe_queue queue;
+    memset(&queue, 0, sizeof(queue));
+    queue.card = card;
+    queue.group_starts = malloc(sizeof(size_t) * (probe_count + 1));
+    if (queue.group_starts != NULL) {
+      size_t pi;
+      for (pi = first; pi < end; pi++)
+        if ((pi == first) || (probes[pi].device_index != probes[pi - 1].device_index) ||
+            ((infer_subdevices == 0) && (probes[pi].subdevice != probes[pi - 1].subdevice)))
+          queue.group_starts[queue.group_count++] = pi;
+      queue.group_starts[queue.group_count] = end;
+      debug(2, "%zu interfaces in %zu groups.", probe_count, queue.group_count);
+      if (queue.group_count > 1) {
+        unsigned int worker_count = interface_probe_jobs;
+        if (worker_count > queue.group_count)
+          worker_count = queue.group_count;
+        pthread_t *workers = malloc(sizeof(pthread_t) * worker_count);
+        if (workers != NULL) {
+          pthread_mutex_init(&queue.lock, NULL);
+          while ((workers_started < worker_count) &&
+                 (pthread_create(&workers[workers_started], NULL, interface_probe_worker,
+                                 &queue) == 0))
+            workers_started++;
+          unsigned int wi;
+          for (wi = 0; wi < workers_started; wi++)
+            pthread_join(workers[wi], NULL);
+          pthread_mutex_destroy(&queue.lock);
+          context->probe_mismatches += queue.probe_mismatches;
+          context->probe_timeouts += queue.probe_timeouts;
+          free(workers);
+        }
+      }
+      free(queue.group_starts);
+    }
+  }
+  size_t pi;
+  if (workers_started == 0) {
+    for (pi = first; pi < end; pi++)
+      probe_interface(context, card, &probes[pi], 1, first, pi);
+  } else {
+    // An interface in one group may turn out to use the same hardware as an interface in
+    // another group, e.g. "hdmi:CARD=x,DEV=0" may be a view of "hw:CARD=x,DEV=3", so a probe
+    // that found its interface busy is done again now that nothing else is being probed.
+    for (pi = first; pi < end; pi++) {
+      if ((probes[pi].configuration != NULL) &&
+          (probes[pi].configuration->error_status == -EBUSY)) {
+        debug(2, "probing \"%s\" again as it was busy.", probes[pi].interface_name);
+        probes[pi].configuration = NULL; // its space is reclaimed when the card is released
+        probe_interface(context, card, &probes[pi], 1, first, end);
+      }
+    }
+  }
+}
+
+// return the index of the first capture interface of the card, or the number of interfaces if
+// there isn't one
+static size_t first_capture_probe(const card_probe *card) {
+  size_t pi = 0;
+  while ((pi < card->probe_count) && (card->probes[pi].stream != SND_PCM_STREAM_CAPTURE))
+    pi++;
+  return pi;
+}
+
+// Playback and capture are separate substreams, so the capture interfaces are probed on a thread
+// of their own while the playback interfaces are being probed.
+typedef struct {
+  card_probe *card;
+  size_t first, end;
+  unsigned int probe_mismatches;
+  unsigned int probe_timeouts;
+} capture_probe_job;
+
+static void *capture_probe_worker(void *arg) {
+  capture_probe_job *job = (capture_probe_job *)arg;
+  probe_context context;
+  if (probe_context_init(&context) == 0) {
+    probe_interface_range(job->card, &context, job->first, job->end);
+    job->probe_mismatches = context.probe_mismatches;
+    job->probe_timeouts = context.probe_timeouts;
+    probe_context_free(&context);
+  } else {
+    debug(1, "could not allocate a probe context for the capture interfaces");
+  }
+  return NULL;
+}
+
+static void probe_interfaces(card_probe *card, probe_context *context) {
+  size_t capture_start = first_capture_probe(card);
+  capture_probe_job job;
+  memset(&job, 0, sizeof(job));
+  job.card = card;
+  job.first = capture_start;
+  job.end = card->probe_count;
+  pthread_t capture_thread;
+  int capture_thread_started = 0;
+  if (capture_start < card->probe_count)
+    capture_thread_started =
+        pthread_create(&capture_thread, NULL, capture_probe_worker, &job) == 0;
+  probe_interface_range(card, context, 0, capture_start);
+  if (capture_thread_started != 0) {
+    pthread_join(capture_thread, NULL);
+    context->probe_mismatches += job.probe_mismatches;
+    context->probe_timeouts += job.probe_timeouts;
+  } else {
+    probe_interface_range(card, context, capture_start, card->probe_count);
+  }
+}
+
+void card_probe_free(card_probe *card) {
+  if (card->arena_shared == 0)
+    arena_release(card->arena);
+  card->arena = NULL;
+  card->probes = NULL;
+  card->probe_count = 0;
+  card->devices = NULL;
+  card->device_count = 0;
+}
+
+// add an interface, e.g. "hdmi:CARD=Generic,DEV=3", on one of the card's devices to the card's
+// list of them; return non-zero if there's no room for it
+static int add_interface(card_probe *card, size_t *probes_allocated, const char *prefix,
+                         size_t device_index, int sub_device, const char *subdevice_name,
+                         snd_pcm_stream_t stream) {
+  const char *card_name = card->control_interface_name + strlen("hw:CARD=");
+  int dev = card->devices[device_index].number;
+  if (card->probe_count == *probes_allocated) {
+    size_t new_size = *probes_allocated == 0 ? 16 : *probes_allocated * 2;
+    interface_probe *new_probes =
+        arena_grow(card->arena, card->probes, sizeof(interface_probe) * *probes_allocated,
+                   sizeof(interface_probe) * new_size);
+    if (new_probes == NULL) {
+      debug(1, "could not allocate memory for the interfaces on card %d.", card->card_number);
+      return -ENOMEM;
+    }
+    card->probes = new_probes;
+    *probes_allocated = new_size;
+  }
+  interface_probe *probe = &card->probes[card->probe_count];
+  probe->device_index = device_index;
+  probe->subdevice = sub_device;
+  probe->stream = stream;
+  strncpy(probe->subdevice_name, subdevice_name, sizeof(probe->subdevice_name) - 1);
+  // the card name is at most 55 characters, so the name should always fit
+  int name_length;
+  if (sub_device == 0) {
+    if (dev == 0) {
+      name_length = snprintf(probe->interface_name, sizeof(probe->interface_name), "%s:%s",
+                             prefix, card_name);
+    } else {
+      name_length = snprintf(probe->interface_name, sizeof(probe->interface_name),
+                             "%s:CARD=%s,DEV=%i", prefix, card_name, dev);
+    }
+  } else {
+    name_length =
+        snprintf(probe->interface_name, sizeof(probe->interface_name),
+                 "%s:CARD=%s,DEV=%i,SUBDEV=%i", prefix, card_name, dev, sub_device);
+  }
+  if ((name_length < 0) || ((size_t)name_length >= sizeof(probe->interface_name))) {
+    debug(1, "the name of interface \"%s\" on card %d is too long.", probe->interface_name,
+          card->card_number);
+    memset(probe, 0, sizeof(interface_probe));
+  } else {
+    card->probe_count++;
+  }
+  return 0;
+}
+
+// list the devices, subdevices and interfaces on the card, ready to be probed
+static void enumerate_card(snd_ctl_t *handle, card_probe *card) {
+  char *prefixes[] = {"hw", "hdmi", "iec958"};
+  int card_number = card->card_number;
+  size_t devices_allocated = 0;
+  size_t probes_allocated = 0;
+  int err;
+
+  snd_pcm_info_t *pcminfo;
+  snd_pcm_info_alloca(&pcminfo);
+  if ((err = snd_ctl_pcm_info(handle, pcminfo)) == 0) {
+    int dev = -1;
+    while ((snd_ctl_pcm_next_device(handle, &dev) == 0) && (dev != -1)) {
+      debug(1, "device: %u", dev);
+      if (card->device_count == devices_allocated) {
+        size_t new_size = devices_allocated == 0 ? 8 : devices_allocated * 2;
+        card_device *new_devices =
+            arena_grow(card->arena, card->devices, sizeof(card_device) * devices_allocated,
+                       sizeof(card_device) * new_size);
+        if (new_devices == NULL) {
+          debug(1, "could not allocate memory for device %d on card %d.", dev, card_number);
+          break;
+        }
+        card->devices = new_devices;
+        devices_allocated = new_size;
+      }
+      card_device *device = &card->devices[card->device_count++];
+      device->number = dev;
+      snd_pcm_info_set_device(pcminfo, dev);
+      snd_pcm_info_set_subdevice(pcminfo, 0);
+      if ((err = snd_ctl_pcm_info(handle, pcminfo)) == 0) {
+        device->info_available = 1;
+        strncpy(device->name, snd_pcm_info_get_name(pcminfo), sizeof(device->name) - 1);
+        strncpy(device->id, snd_pcm_info_get_id(pcminfo), sizeof(device->id) - 1);
+        int sub_device_count = snd_pcm_info_get_subdevices_avail(pcminfo);
+        device->subdevices_available = sub_device_count;
+        // a zero can happen if the device is busy, so pretend there is at least one.
+        if (sub_device_count == 0)
+          sub_device_count = 1; // pretend there is one subdevice
+
+        int sub_device;
+        for (sub_device = 0; sub_device < sub_device_count; sub_device++) {
+          debug(3, "subdevice: %u", sub_device);
+          snd_pcm_info_set_subdevice(pcminfo, sub_device);
+          snd_pcm_info_set_stream(pcminfo, SND_PCM_STREAM_PLAYBACK);
+          if ((err = snd_ctl_pcm_info(handle, pcminfo)) < 0) {
+            if (err != -ENOENT)
+              debug(1, "snd_ctl_pcm_info error for card %i, subdevice %i: %s", card_number,
+                    sub_device, snd_strerror(err));
+          }
+          unsigned int pn;
+          for (pn = 0; pn < sizeof(prefixes) / sizeof(char *); pn++)
+            if (add_interface(card, &probes_allocated, prefixes[pn], card->device_count - 1,
+                              sub_device, snd_pcm_info_get_subdevice_name(pcminfo),
+                              SND_PCM_STREAM_PLAYBACK) != 0)
+              break;
+        }
+      } else {
+        debug(1, "card %i, device %i: error %d, %s", card_number, dev, err, snd_strerror(err));
+      }
+    }
+    // capture interfaces go after the playback ones, under the devices they were found on;
+    // "hdmi:" and "iec958:" interfaces are only for output
+    size_t di;
+    for (di = 0; (probe_capture != 0) && (di < card->device_count); di++) {
+      card_device *device = &card->devices[di];
+      snd_pcm_info_set_device(pcminfo, device->number);
+      snd_pcm_info_set_subdevice(pcminfo, 0);
+      snd_pcm_info_set_stream(pcminfo, SND_PCM_STREAM_CAPTURE);
+      if ((err = snd_ctl_pcm_info(handle, pcminfo)) == 0) {
+        if (device->info_available == 0) {
+          strncpy(device->name, snd_pcm_info_get_name(pcminfo), sizeof(device->name) - 1);
+          strncpy(device->id, snd_pcm_info_get_id(pcminfo), sizeof(device->id) - 1);
+        }
+        int sub_device_count = snd_pcm_info_get_subdevices_avail(pcminfo);
+        if (sub_device_count == 0)
+          sub_device_count = 1; // it may be busy, as above
+        int sub_device;
+        for (sub_device = 0; sub_device < sub_device_count; sub_device++) {
+          snd_pcm_info_set_subdevice(pcminfo, sub_device);
+          if ((err = snd_ctl_pcm_info(handle, pcminfo)) < 0)
+            debug(1, "snd_ctl_pcm_info error for capture on card %i, subdevice %i: %s",
+                  card_number, sub_device, snd_strerror(err));
+          if (add_interface(card, &probes_allocated, "hw", di, sub_device,
+                            err == 0 ? snd_pcm_info_get_subdevice_name(pcminfo) : "",
+                            SND_PCM_STREAM_CAPTURE) != 0)
+            break;
+        }
+      } else {
+        debug(3, "card %i, device %i has no capture stream.", card_number, device->number);
+      }
+    }
+  } else {
+    debug(1, "card %i, error %d, %s", card_number, err, snd_strerror(err));
+  }
+}
+
+// an interface that could not be checked because of the state it was in, rather than because
+// of what it is, is probed again even if the card's results came from the cache
+static int probe_result_is_transient(configuration_bundle *configuration) {
+  return (configuration != NULL) &&
+         ((configuration->error_status == -EBUSY) || (configuration->error_status == -524) ||
+          (configuration->error_status == -ENODEV) ||
+          (configuration->error_status == -ETIMEDOUT));
+}
+
+// read the card's number and names
+static int alsa_get_card_info(const char *control_interface_name, card_probe *card) {
+  snd_ctl_t *handle;
+  int err = snd_ctl_open(&handle, control_interface_name, 0);
+  if (err == 0) {
+    snd_ctl_card_info_t *info;
+    snd_ctl_card_info_alloca(&info);
+    err = snd_ctl_card_info(handle, info);
+    if (err == 0) {
+      card->card_number = snd_ctl_card_info_get_card(info);
+      strncpy(card->control_interface_name, control_interface_name,
+              sizeof(card->control_interface_name) - 1);
+      strncpy(card->driver, snd_ctl_card_info_get_driver(info), sizeof(card->driver) - 1);
+      strncpy(card->name, snd_ctl_card_info_get_name(info), sizeof(card->name) - 1);
+      strncpy(card->longname, snd_ctl_card_info_get_longname(info),
+              sizeof(card->longname) - 1);
+      strncpy(card->components, snd_ctl_card_info_get_components(info),
+              sizeof(card->components) - 1);
+
+      debug(2,
+            "ctl: name \"%s\", index %d, components \"%s\", name \"%s\", longname \"%s\", "
+            "mixer \"%s\", driver \"%s\".",
+            control_interface_name, snd_ctl_card_info_get_card(info),
+            snd_ctl_card_info_get_components(info), snd_ctl_card_info_get_name(info),
+            snd_ctl_card_info_get_longname(info), snd_ctl_card_info_get_mixername(info),
+            snd_ctl_card_info_get_driver(info));
+    }
+    snd_ctl_close(handle);
+  }
+  return err;
+}
+
+static int alsa_enumerate_card(const char *control_interface_name, card_probe *card) {
+  snd_ctl_t *handle;
+  int err = snd_ctl_open(&handle, control_interface_name, 0);
+  if (err == 0) {
+    enumerate_card(handle, card);
+    snd_ctl_close(handle);
+  } else {
+    debug(1, "can't open \"%s\" to list its devices -- error %d (\"%s\").",
+          control_interface_name, err, snd_strerror(err));
+  }
+  return err;
+}
+
+// Build the card's part of the model of the system: its number and names, its devices and their
+// subdevices, and the interfaces to be probed. If use_cached_results is non-zero and the card is
+// in the probe cache, it all comes from there, along with the results of probing the interfaces
+// and the mixers; an interface whose result was transient is left with no configuration, so that
+// it is probed again. No PCM is opened.
+int build_card_model(const char *control_interface_name, card_probe *card,
+                     int use_cached_results) {
+  memset(card, 0, sizeof(card_probe));
+  card->arena = arena_create();
+  if (card->arena == NULL) {
+    debug(1, "could not create an arena for \"%s\".", control_interface_name);
+    return -ENOMEM;
+  }
+  int err = call_card(backend->get_card_info, control_interface_name, card);
+  if (err == 0) {
+    probe_cache_key key;
+    probe_cache_make_key(card, &key);
+    if ((card_cache != NULL) && (use_cached_results != 0) &&
+        (probe_cache_lookup(card_cache, &key, card) == 0)) {
+      debug(1, "card \"%s\" found in the probe cache.", control_interface_name);
+      card->from_cache = 1;
+      size_t pi;
+      for (pi = 0; pi < card->probe_count; pi++)
+        if (probe_result_is_transient(card->probes[pi].configuration))
+          card->probes[pi].configuration = NULL;
+    } else if (call_card(backend->enumerate_card, control_interface_name, card) == -ETIMEDOUT) {
+      err = -ETIMEDOUT; // the card's model is incomplete
+    }
+  }
+  return err;
+}
+
+// return non-zero if a mixer with a dB range has no volume curve
+static int volume_curves_missing(card_probe *card) {
+  size_t mi;
+  for (mi = 0; mi < card->mixers.first_free; mi++)
+    if ((card->mixers.mixer[mi].has_a_decibel_range != 0) &&
+        (card->mixers.mixer[mi].volume_curve == VOLUME_CURVE_NONE))
+      return 1;
+  return 0;
+}
+
+// probe each interface in the card's model that has no result yet, load the mixers if they
+// aren't known -- or, with sample_volume_curves, their curves aren't -- and update the cache
+void probe_card_model(probe_context *context, card_probe *card) {
+  uint64_t card_start = trace_start();
+  probe_cache_key key;
+  probe_cache_make_key(card, &key);
+  emit_card_record(context, card);
+  if (card->from_cache != 0) {
+    int update_cache = 0; // non-zero if something is now known that the cache lacks
+    if ((sample_volume_curves != 0) && (volume_curves_missing(card) != 0)) {
+      debug(2, "loading the mixers of \"%s\" again to sample their volume curves.",
+            card->control_interface_name);
+      memset(&card->mixers, 0, sizeof(mixer_bundle_t)); // the old ones are left in the arena
+      card->mixers.arena = card->arena;
+      card->mixer_status = call_card(load_card_mixers, card->control_interface_name, card);
+      update_cache = card->mixer_status != -ETIMEDOUT;
+    }
+    emit_mixer_records(context, card);
+    unsigned int transient_results = 0;
+    size_t pi;
+    for (pi = 0; pi < card->probe_count; pi++) {
+      if (card->probes[pi].configuration == NULL)
+        transient_results++;
+      else
+        emit_interface_records(context, card, &card->probes[pi]);
+    }
+    if (transient_results != 0) {
+      debug(2, "probing %u interfaces on \"%s\" again.", transient_results,
+            card->control_interface_name);
+      probe_interfaces(card, context);
+      // keep anything that is now known for certain
+      unsigned int still_transient = 0;
+      for (pi = 0; pi < card->probe_count; pi++)
+        if (probe_result_is_transient(card->probes[pi].configuration))
+          still_transient++;
+      if (still_transient < transient_results)
+        update_cache = 1;
+    }
+    if (update_cache != 0)
+      probe_cache_store(card_cache, &key, card);
+  } else {
+    probe_interfaces(card, context);
+    card->mixers.arena = card->arena;
+    card->mixer_status = call_card(load_card_mixers, card->control_interface_name, card);
+    emit_mixer_records(context, card);
+    if ((card_cache != NULL) && (card->mixer_status != -ETIMEDOUT))
+      probe_cache_store(card_cache, &key, card);
+  }
+  debug(2, "\"%s\" uses %zu bytes in %zu allocations, in an arena of %zu bytes.",
+        card->control_interface_name, card->arena->bytes_allocated,
+        card->arena->allocation_count, card->arena->bytes_reserved);
+  trace_end(TRACE_CARD, card_start, card->control_interface_name);
+}
+
+// find out everything about the card, from the probe cache if use_cached_results is non-zero
+// and the card is in it
+int probe_card(const char *control_interface_name, probe_context *context, card_probe *card,
+               int use_cached_results) {
+  int err = build_card_model(control_interface_name, card, use_cached_results);
+  if (err == 0)
+    probe_card_model(context, card);
+  return err;
+}
+
+// list the points of each mixer's volume curve, four to a line
+static void print_volume_curves(mixer_bundle_t *mixer_info, int capture, FILE *output) {
+  fprintf(output,
+          "        --- %s (the dB value at each point, with straight lines between them):\n",
+          capture != 0 ? "Capture Volume Curves" : "Volume Curves");
+  size_t i;
+  for (i = 0; i < mixer_info->first_free; i++) {
+    mixer_info_t *mixer = &mixer_info->mixer[i];
+    if ((mixer->capture == capture) && (mixer->volume_curve != VOLUME_CURVE_NONE)) {
+      fprintf(output, "              >>> Mixer \"%s\", index %u: %s", mixer->name, mixer->index,
+              volume_curve_name(mixer->volume_curve));
+      if (mixer->volume_curve == VOLUME_CURVE_APPROXIMATE)
+        fprintf(output, ", to within %.2f dB", mixer->volume_curve_error * 0.01);
+      fprintf(output, ":\n");
+      unsigned int pi;
+      for (pi = 0; pi < mixer->volume_point_count; pi++)
+        fprintf(output, "%s%8ld: %8.2f dB%s", pi % 4 == 0 ? "                 " : "",
+                mixer->volume_points[pi].volume, mixer->volume_points[pi].decibels * 0.01,
+                ((pi % 4 == 3) || (pi + 1 == mixer->volume_point_count)) ? "\n" : "  ");
+    }
+  }
+}
+
+// print the table of playback or capture mixers
+static void print_mixers(mixer_bundle_t *mixer_info, int capture, FILE *output) {
+  size_t mixer_count = 0;
+  size_t mi;
+  for (mi = 0; mi < mixer_info->first_free; mi++)
+    if (mixer_info->mixer[mi].capture == capture)
+      mixer_count++;
+  if (mixer_count == 0) {
+    fprintf(output, "        --- No %smixers found.\n", capture != 0 ? "capture " : "");
   } else {
-    // check each configuration set in turn to see if they can be merged
-    unsigned int i = 0;
-    int can_be_merged = 0;
-    while ((i < configuration->configuration_sets_count) && (can_be_merged == 0)) {
-      if ((configuration->configuration_sets[i].channel_set == (uint32_t)(1 << channel_count)) &&
-          (configuration->configuration_sets[i].format_set == format_set)) {
-        // now see if the channel maps are compatible
-        if ((configuration->configuration_sets[i].channel_mappings[channel_count][0] == '\0') &&
-            (channel_map == NULL)) {
-          can_be_merged = 1;
-        } else if ((channel_map != NULL) &&
-                   (strcmp(configuration->configuration_sets[i].channel_mappings[channel_count],
-                           channel_map) == 0)) {
-          can_be_merged = 1;
-        }
-      }
-      if (can_be_merged != 0) {
-        configuration->configuration_sets[i].rate_set |= rate_index;
+    if (mixer_count == 1)
+      fprintf(output, "        --- %s:\n", capture != 0 ? "Capture Mixer" : "Mixer");
+    else
+      fprintf(output, "        --- %s:\n", capture != 0 ? "Capture Mixers" : "Mixers");
+    fprintf(output, "               "
+                    "--------------------------------------------------------------------"
+                    "------------------------------------\n");
+    fprintf(output,
+            "              |  %-32s  |  %5s  |  %6s  |  %6s  |  %7s  |  %7s"
+            "  |  %7s  |\n",
+            "Name", "Index", "Min", "Max", "Mute dB", "Min dB", "Max dB");
+    fprintf(output, "               "
+                    "--------------------------------------------------------------------"
+                    "------------------------------------\n");
+    unsigned int i;
+    for (i = 0; i < mixer_info->first_free; i++) {
+      if (mixer_info->mixer[i].capture != capture) {
+        continue;
+      } else if (mixer_info->mixer[i].has_a_decibel_range != 0) {
+        // if (i % 2 == 0) {
+        fprintf(output,
+                "              |  %-32s  |  %5u  |  %6ld  |  %6ld  |  %7s  |  %7.2f  | "
+                " %7.2f  |\n",
+                mixer_info->mixer[i].name, mixer_info->mixer[i].index,
+                mixer_info->mixer[i].minv, mixer_info->mixer[i].maxv,
+                mixer_info->mixer[i].lowest_value_is_mute ? "Yes" : "No",
+                mixer_info->mixer[i].mindecibels * 0.01,
+                mixer_info->mixer[i].maxdecibels * 0.01);
       } else {
-        i++;
+        fprintf(output,
+                "              |  %-32s  |  %5u  |  %6ld  |  %6ld  |  %7s  |  %7s  "
+                "|  %7s  |\n",
+                mixer_info->mixer[i].name, mixer_info->mixer[i].index,
+                mixer_info->mixer[i].minv, mixer_info->mixer[i].maxv, " ", " ", " ");
       }
     }
-    if (can_be_merged == 0) {
-      // debug(1,"added");
-      configuration->configuration_sets =
-          realloc(configuration->configuration_sets,
-                  sizeof(configuration_set) * (configuration->configuration_sets_count + 1));
-      configuration->configuration_sets[configuration->configuration_sets_count].rate_set =
-          rate_index;
-      configuration->configuration_sets[configuration->configuration_sets_count].format_set =
-          format_set;
-      configuration->configuration_sets[configuration->configuration_sets_count].channel_set =
-          (1 << channel_count);
-      memset(configuration->configuration_sets[configuration->configuration_sets_count]
-                 .channel_mappings,
-             0, sizeof(char[128]) * 32);
-      strncpy(configuration->configuration_sets[configuration->configuration_sets_count]
-                  .channel_mappings[channel_count],
-              channel_map, sizeof(char[128]));
-      configuration->configuration_sets_count++;
-    }
-  }
-}
-
-static configuration_bundle *get_permissible_configuration_settings(char *interface_name,
-                                                                    snd_pcm_info_t *pcminfo) {
-  debug(1, "get_permissible_configuration_settings for \"%s\".", interface_name);
-  // can have up to 31 channels
-  uint32_t possible_channel_mask = 0;
-  unsigned int possible_channel_count = 0;
-
-  uint32_t possible_rate_mask = 0;
-  unsigned int possible_rate_count = 0;
-
-  uint64_t possible_format_mask = 0;
-  unsigned int possible_format_count = 0;
-  int ret = 0;
-  configuration_bundle *configuration = malloc(sizeof(configuration_bundle));
-  if (configuration != NULL) {
-    memset(configuration, 0, sizeof(configuration_bundle));
-    strncpy(configuration->interface_name, interface_name,
-            sizeof(configuration->interface_name) - 1);
-    strncpy(configuration->device_name, snd_pcm_info_get_name(pcminfo),
-            sizeof(configuration->device_name) - 1);
-    strncpy(configuration->subdevice_name, snd_pcm_info_get_subdevice_name(pcminfo),
-            sizeof(configuration->subdevice_name) - 1);
+    fprintf(output, "               "
+                    "--------------------------------------------------------------------"
+                    "------------------------------------\n");
+    if (sample_volume_curves != 0)
+      print_volume_curves(mixer_info, capture, output);
+  }
+}
 
-    snd_pcm_hw_params_t *local_alsa_params = NULL;
-    snd_pcm_hw_params_alloca(&local_alsa_params);
-    ret = snd_pcm_open(&alsa_handle, interface_name, SND_PCM_STREAM_PLAYBACK, 0);
-    if (ret == 0) {
-      // check what numbers of channels the device can provide...
-      unsigned int i;
-      for (i = 1; i <= 8; i++) {
-        snd_pcm_hw_free(alsa_handle); // remove any previous configurations
-        int local_response = snd_pcm_hw_params_any(alsa_handle, local_alsa_params);
-        if (local_response == 0) {
-          local_response = snd_pcm_hw_params_test_channels(alsa_handle, local_alsa_params, i);
-          if (local_response == 0) {
-            possible_channel_mask |= (1 << i);
-            possible_channel_count++;
-            debug(3, "\"%s\" can handle %u channels.", interface_name, i);
-          } else {
-            debug(3, "\"%s\" can not handle %u channels.", interface_name, i);
-          }
-        }
+// print the results for the interfaces, with those that have the same results together
+static void print_interfaces(configuration_bundle **configurations, size_t count,
+                             const char *heading, FILE *output) {
+  size_t *next_in_group = NULL;
+  if (count != 0) {
+    next_in_group = malloc(sizeof(size_t) * count);
+    if (next_in_group == NULL) {
+      debug(1, "could not allocate memory to group the interfaces.");
+      count = 0;
+    } else {
+      group_identical_configurations(configurations, count, next_in_group);
+    }
+  }
+  size_t ci;
+  int configurations_printed = 0;
+  for (ci = 0; ci < count; ci++) {
+    // process the configuration
+    if ((configurations[ci] != NULL) && (configurations[ci] != NULL) &&
+        (configurations[ci]->error_status != -ENOENT) &&
+        (configurations[ci]->error_status != -EINVAL) &&
+        (configurations[ci]->already_handled == 0)) {
+      if (configurations_printed == 0) {
+        configurations_printed = 1;
+        fprintf(output, "        --- %s:\n", heading);
       }
-
-      if (ret == 0) {
-        // check what rates the device can handle
-        for (i = 0; i < sizeof(rates_to_check) / sizeof(unsigned int); i++) {
-          snd_pcm_hw_free(alsa_handle); // remove any previous configurations
-          int local_response = snd_pcm_hw_params_any(alsa_handle, local_alsa_params);
-          if (local_response == 0) {
-            // We don't't use snd_pcm_hw_params_test_rate() here because it its too strict, it
-            // seems. It excludes situations where the rate is nominally the requested rate but
-            // might be a bit higher or lower, as indicated by the dir value returned when you use
-            // snd_pcm_hw_params_set_rate_near().
-            unsigned int actual_sample_rate = rates_to_check[i];
-            int dir = 0;
-
-            local_response = snd_pcm_hw_params_set_rate_near(alsa_handle, local_alsa_params,
-                                                             &actual_sample_rate, &dir);
-            // a returned dir value of 0 would mean exact rate only,
-            // -1 means the rate chosen will be less, and +1 greater.
-            // however, we also check that the nominal actual returned rate is the same.
-            if ((local_response == 0) && (actual_sample_rate == rates_to_check[i])) {
-              possible_rate_mask |= (1 << i);
-              possible_rate_count++;
-              debug(3, "\"%s\" can handle %u fps, dir: %d.", interface_name, rates_to_check[i],
-                    dir);
-            } else {
-              debug(3, "\"%s\" can not handle %u fps.", interface_name, rates_to_check[i]);
-            }
-          }
+      fprintf(output, "              >>> Interface \"%s\":\n",
+              configurations[ci]->interface_name);
+      char indent[] = "                  ";
+      if (configurations[ci]->error_status == -EBUSY) {
+        fprintf(output, "%sThis interface is busy and can not be checked.\n", indent);
+        fprintf(output, "%sTo check it, take it out of use and try again.\n", indent);
+      } else if (configurations[ci]->error_status == -524) {
+        fprintf(output,
+                "%sThis interface appears to be for a disconnected or uninitialized HDMI "
+                "port. To test it, perform the following steps:\n",
+                indent);
+        fprintf(output, "%s   (1) connect it to the HDMI device,\n", indent);
+        fprintf(output,
+                "%s   (2) turn the HDMI device on and select this device as source,\n",
+                indent);
+        fprintf(output, "%s   (3) reboot and try again.\n", indent);
+      } else if (configurations[ci]->error_status == -ENODEV) {
+        fprintf(output,
+                "%sThis interface cannot be found (error 19). If it is for a HDMI port "
+                "then, to test it, perform the following steps:\n",
+                indent);
+        fprintf(output, "%s   (1) connect it to the HDMI device,\n", indent);
+        fprintf(output,
+                "%s   (2) turn the HDMI device on and select this device as source,\n",
+                indent);
+        fprintf(output, "%s   (3) reboot and try again.\n", indent);
+      } else if (configurations[ci]->error_status == -ETIMEDOUT) {
+        fprintf(output, "%sThis interface could not be probed in the time allowed.\n", indent);
+        fprintf(output, "%sTo check it, make sure it is working and try again.\n", indent);
+      } else if (configurations[ci]->error_status != 0) {
+        fprintf(output, "%sError %d (\"%s\").\n", indent, configurations[ci]->error_status,
+                snd_strerror(configurations[ci]->error_status));
+      } else {
+        unsigned int similar_interface_count = 1;
+        size_t cj;
+        for (cj = next_in_group[ci]; cj != 0; cj = next_in_group[cj - 1]) {
+          fprintf(output, "              >>> Interface \"%s\":\n",
+                  configurations[cj - 1]->interface_name);
+          similar_interface_count++;
         }
 
-        if (ret == 0) {
-          // check what formats the device can handle
-          for (i = 0; i < sizeof(formats_to_check) / sizeof(snd_pcm_format_t); i++) {
-            snd_pcm_hw_free(alsa_handle); // remove any previous configurations
-            int local_response = snd_pcm_hw_params_any(alsa_handle, local_alsa_params);
-            if (local_response == 0) {
-              local_response = snd_pcm_hw_params_test_format(alsa_handle, local_alsa_params,
-                                                             formats_to_check[i]);
-              if (local_response == 0) {
-                possible_format_mask |= (1 << i);
-                possible_format_count++;
-                debug(3, "\"%s\" can accept the %s format.", interface_name,
-                      snd_pcm_format_name(formats_to_check[i]));
-              } else {
-                debug(3, "\"%s\" can not accept the %s format.", interface_name,
-                      snd_pcm_format_name(formats_to_check[i]));
-              }
-            }
-          }
+        print_configuration(configurations[ci], similar_interface_count, output);
+        for (cj = ci + 1; cj != 0; cj = next_in_group[cj - 1]) {
+          configuration_bundle *similar = configurations[cj - 1];
+          if (similar->inferred_from[0] != '\0')
+            fprintf(output,
+                    "%sThe results for \"%s\" were inferred from those of \"%s\", "
+                    "not measured.\n",
+                    indent, similar->interface_name, similar->inferred_from);
         }
       }
+    }
+  }
+  free(next_in_group);
+}
 
-      // now we know the maximum possible number of configurations
-      // so let's check them out
-      // first, let's initialise the results store
-
-      if (ret == 0) {
-        int local_response = -EINVAL;
-        char local_channel_map_store[128];
-        char channel_map_store[128] = "";
-        unsigned int ci; // channel index
-        uint32_t format_set = 0;
-        for (ci = 1; ci <= 8; ci++) {
-          if ((possible_channel_mask & (1 << ci)) !=
-              0) { // if this channel count is among the channel counts that could be used...
-            unsigned int ri; // rate index
-            for (ri = 0; ri < sizeof(rates_to_check) / sizeof(unsigned int); ri++) {
-              if ((possible_rate_mask & (1 << ri)) !=
-                  0) { // if this rate is among the rates that could be used...
-                format_set = 0;
-                unsigned int fi; // format index
-                for (fi = 0; fi < sizeof(formats_to_check) / sizeof(snd_pcm_format_t); fi++) {
-
-                  // now check if this combination of formats is allowed
-                  if ((possible_format_mask & (1 << fi)) !=
-                      0) { // if this format is among the formats that could be used...
-                    // now check if this specific combination of channel/rate/format is allowed
-                    memset(local_alsa_params, 0, snd_pcm_hw_params_sizeof());
-                    snd_pcm_hw_free(alsa_handle); // remove any previous configurations
-                    snd_pcm_hw_params_any(alsa_handle, local_alsa_params);
-
-                    local_response = snd_pcm_hw_params_any(alsa_handle, local_alsa_params);
-                    if (local_response == 0) {
-                      if ((snd_pcm_hw_params_set_access(alsa_handle, local_alsa_params,
-                                                        SND_PCM_ACCESS_RW_INTERLEAVED) == 0) ||
-                          (snd_pcm_hw_params_set_access(alsa_handle, local_alsa_params,
-                                                        SND_PCM_ACCESS_MMAP_INTERLEAVED) == 0)) {
-                        local_response = snd_pcm_hw_params_set_channels(
-                            alsa_handle, local_alsa_params,
-                            ci); // the channel index is the channel count too
-                        if (local_response == 0) {
-                          local_response = snd_pcm_hw_params_set_format(
-                              alsa_handle, local_alsa_params, formats_to_check[fi]);
-                          if (local_response == 0) {
-                            unsigned int actual_sample_rate = rates_to_check[ri];
-                            int dir = 0;
-                            local_response = snd_pcm_hw_params_set_rate_near(
-                                alsa_handle, local_alsa_params, &actual_sample_rate, &dir);
-                            if (local_response == 0) {
-                              if (actual_sample_rate != rates_to_check[ri]) {
-                                local_response = -EINVAL;
-                                debug(3,
-                                      "Sample rate set, %u, is different to sample rate requested, "
-                                      "%u.",
-                                      actual_sample_rate, rates_to_check[ri]);
-                              } else {
-                                // success -- this combination of channel ci, rate ri and format fi
-                                // works
-
-                                debug(3, "\"%s\": snd_pcm_hw_params for  %u/%s/%u.", interface_name,
-                                      rates_to_check[ri], snd_pcm_format_name(formats_to_check[fi]),
-                                      ci);
-                                local_response = snd_pcm_hw_params(alsa_handle, local_alsa_params);
-                                if (local_response == 0) {
-                                  get_channel_map(alsa_handle, (char *)&local_channel_map_store);
-                                  if (local_channel_map_store[0] == '\0') {
-                                    debug(3, "\"%s\": %u/%s/%u/", interface_name,
-                                          rates_to_check[ri],
-                                          snd_pcm_format_name(formats_to_check[fi]), ci);
-                                  } else {
-                                    debug(3, "\"%s\": %u/%s/%u/<%s>", interface_name,
-                                          rates_to_check[ri],
-                                          snd_pcm_format_name(formats_to_check[fi]), ci,
-                                          local_channel_map_store);
-                                  }
-
-                                  // here, we know that this new format works with the given rate
-                                  // and channel count if the format set is empty, then we should
-                                  // store the channel map, if any if the format set is non-empty,
-                                  // then we should check that the channel maps are the same and if
-                                  // they are different, we should add the current configuration set
-                                  // and start a new one
-
-                                  if (format_set == 0) {
-                                    format_set |= (1 << fi);
-                                    strncpy(channel_map_store, local_channel_map_store,
-                                            sizeof(channel_map_store));
-                                  } else {
-                                    int different = 0;
-                                    if (strcmp(local_channel_map_store, channel_map_store) != 0) {
-                                      different = 1;
-                                    }
-                                    if (different != 0) {
-                                      debug(1, "found to be different");
-                                      add_to_configuration_sets(ci, (1 << ri), format_set,
-                                                                channel_map_store, configuration);
-                                      format_set = (1 << fi);
-                                      strncpy(channel_map_store, local_channel_map_store,
-                                              sizeof(channel_map_store));
-                                    } else {
-                                      format_set |= (1 << fi);
-                                    }
-                                  }
-                                } else {
-                                  debug(3,
-                                        "Unable to set hw parameters for device \"%s\": %d: "
-                                        "\"%s\".%s",
-                                        interface_name, local_response,
-                                        snd_strerror(local_response),
-                                        local_response == -ENOSPC
-                                            ? "  This seems to be a USB error and may be caused by "
-                                              "an "
-                                              "incompatibility between the system and the device."
-                                            : "");
-                                }
-                              }
-                            } else {
-                              debug(
-                                  3,
-                                  "could not set output rate %u for device \"%s\", error  \"%s\".",
-                                  rates_to_check[ri], interface_name, snd_strerror(local_response));
-                            }
-                          } else {
-                            debug(3, "could not set output format \"%s\" for device: \"%s\".",
-                                  snd_pcm_format_name(formats_to_check[fi]),
-                                  snd_strerror(local_response));
-                          }
-                        } else {
-                          debug(3, "%u channel output is not available for device: \"%s\"", ci,
-                                snd_strerror(local_response));
-                        }
-                      } else {
-                        debug(1, "interleaved access not available for device: \"%s\".",
-                              snd_strerror(local_response));
-                      }
-                    } else {
-                      debug(
-                          1,
-                          "broken configuration for device \"%s\": no configurations available -- "
-                          "error %d: \"%s\".",
-                          interface_name, local_response, snd_strerror(local_response));
-                    }
-
-                    if (local_response == 0) {
-                      // format_set |= (1 << fi); // this format is supported, but we need to check
-                      // the channel maps
-                    }
-                  }
-                }
-                // debug(1, "finished checking formats for %u fps and %u channels",
-                // rates_to_check[ri], ci);
-                if (format_set != 0) {
-                  add_to_configuration_sets(ci, (1 << ri), format_set, channel_map_store,
-                                            configuration);
-                }
-              }
-            }
-          }
-        }
-        // now merge sets that have the same rates and formats but different sets of channels
-        unsigned int i;
-        for (i = 0; i < configuration->configuration_sets_count; i++) {
-          unsigned int j;
-          for (j = i + 1; j < configuration->configuration_sets_count; j++) {
-            if ((configuration->configuration_sets[i].channel_set != 0) &&
-                (configuration->configuration_sets[i].rate_set ==
-                 configuration->configuration_sets[j].rate_set) &&
-                (configuration->configuration_sets[i].format_set ==
-                 configuration->configuration_sets[j].format_set)) {
-              // copy in the channel maps
-              int can_merge = 1;
-              int ci;
-              for (ci = 1; ci < 32; ci++) {
-                // check that the channel maps for channels in both configurations are identical
-                if (((configuration->configuration_sets[i].channel_set & (1 << ci)) != 0) &&
-                    ((configuration->configuration_sets[j].channel_set & (1 << ci)) != 0)) {
-                  if (strcmp(configuration->configuration_sets[i].channel_mappings[ci],
-                             configuration->configuration_sets[j].channel_mappings[ci]) != 0)
-                    can_merge = 0;
-                }
-              }
-              if (can_merge != 0) {
-                // debug(1, "channel merge -- the later one is merged into the earlier one");
-                int ci;
-                for (ci = 1; ci < 32; ci++) {
-                  // copy in any new channel maps
-                  if (((configuration->configuration_sets[i].channel_set & (1 << ci)) == 0) &&
-                      ((configuration->configuration_sets[j].channel_set & (1 << ci)) != 0)) {
-                    strncpy(configuration->configuration_sets[i].channel_mappings[ci],
-                            configuration->configuration_sets[j].channel_mappings[ci],
-                            sizeof(char[128]));
-                  }
-                }
-                configuration->configuration_sets[i].channel_set |=
-                    configuration->configuration_sets[j].channel_set;
+// print what was found on the card to output
+void print_card(card_probe *card, FILE *output) {
+  configuration_bundle **configurations = NULL;
+  size_t current_configuration = 0;
+  int err;
+
+  fprintf(output, "  --- Card %u:\n", card->card_number);
+  if (display_extended_information != 0)
+    fprintf(output, "        --- CTL name: \"%s\".\n", card->control_interface_name);
+  fprintf(output, "        --- Name: \"%s\".\n", card->name);
+  if (display_extended_information != 0)
+    fprintf(output, "        --- Long name: \"%s\".\n", card->longname);
+
+  size_t pi;
+  if (card->probe_count != 0) {
+    configurations = malloc(sizeof(configuration_bundle *) * card->probe_count);
+    if (configurations == NULL)
+      debug(1, "could not allocate memory to list the interfaces of \"%s\".",
+            card->control_interface_name);
+  }
+  size_t capture_start = first_capture_probe(card);
+  size_t playback_configuration_count = 0;
+  for (pi = 0; (pi < card->probe_count) && (configurations != NULL); pi++) {
+    configuration_bundle *configuration = card->probes[pi].configuration;
+    if (configuration != NULL) {
+      configuration->already_handled = 0;
+      if (configuration->error_status != -ENOENT) {
+        configurations[current_configuration++] = configuration;
+        if (pi < capture_start)
+          playback_configuration_count++;
+      } else {
+        debug(1, "error %d looking for configurations for \"%s\"", configuration->error_status,
+              card->probes[pi].interface_name);
+      }
+    }
+  }
 
-                configuration->configuration_sets[j].channel_set = 0; // flag it as empty
-              }
+  if (display_extended_information != 0) {
+    fprintf(output, "        --- Devices: %zu.\n", card->device_count);
+    size_t di;
+    pi = 0;
+    for (di = 0; di < card->device_count; di++) {
+      card_device *device = &card->devices[di];
+      fprintf(output, "              --- Device %u:\n", device->number);
+      fprintf(output, "                    --- Name: \"%s\".\n", device->name);
+      fprintf(output, "                    --- ID: \"%s\".\n", device->id);
+      if (device->info_available != 0) {
+        if (device->subdevices_available == 0)
+          fprintf(output, "                    --- Subdevices: Count not available. Is the "
+                          "device busy?\n");
+        else
+          fprintf(output, "                    --- Subdevices: %d.\n",
+                  device->subdevices_available);
+      }
+      while ((pi < capture_start) && (card->probes[pi].device_index == di)) {
+        int sub_device = card->probes[pi].subdevice;
+        fprintf(output, "                          --- Subdevice: %d:\n", sub_device);
+        fprintf(output, "                                --- Name: \"%s\".\n",
+                card->probes[pi].subdevice_name);
+        int at_least_on_interface_found = 0;
+        while ((pi < capture_start) && (card->probes[pi].device_index == di) &&
+               (card->probes[pi].subdevice == sub_device)) {
+          if ((card->probes[pi].configuration != NULL) &&
+              (card->probes[pi].configuration->error_status != -ENOENT)) {
+            if (at_least_on_interface_found == 0) {
+              fprintf(output, "                                --- Interfaces:\n");
+              at_least_on_interface_found = 1;
             }
+            fprintf(output, "                                      >>> \"%s\"\n",
+                    card->probes[pi].interface_name);
           }
+          pi++;
         }
       }
-      snd_pcm_close(alsa_handle);
     }
-    configuration->error_status = ret;
-    if (ret != 0)
-      debug(1, "get_permissible_configuration_settings: error %d (\"%s\") on device \"%s\".", ret,
-            snd_strerror(ret), interface_name);
+  }
+
+  err = card->mixer_status;
+  if (err == 0) {
+    debug(2, "%u mixers found.", card->mixers.first_free);
+    print_mixers(&card->mixers, 0, output);
+    if (probe_capture != 0)
+      print_mixers(&card->mixers, 1, output);
   } else {
-    debug(1, "could not malloc an initial configuration bundle");
+    debug(1, "Error %d (\"%s\") getting mixer information for card \"%s\".", err,
+          snd_strerror(err), card->control_interface_name);
   }
-  return configuration;
+  print_interfaces(configurations, playback_configuration_count,
+                   "Interfaces and Supported Formats", output);
+  if (probe_capture != 0)
+    print_interfaces(configurations + playback_configuration_count,
+                     current_configuration - playback_configuration_count,
+                     "Capture Interfaces and Supported Formats", output);
+  free(configurations);
 }
 
-// return 0 if they are equal
-int configurations_equal(configuration_bundle *a, configuration_bundle *b) {
-  int response = 1; // assume they are different
-  if ((a == NULL) || (b == NULL)) {
-    debug(1, "configurations_equal: null configuration bundle");
+// With --stress, each playback hw: interface of the card is streamed to, to find the smallest
+// period size at which it plays without an xrun. This is done for each rate of each of its
+// configuration sets, with the set's first format and its largest channel count, and the results
+// are printed after the card's interfaces or emitted as "stress" records. With
+// --stress-interface, only the interfaces named are streamed to -- any PCM, not just a card's --
+// after the cards have been probed; they are probed first, to find their configuration sets.
+
+static void print_stress_heading(unsigned int load_threads, FILE *output) {
+  fprintf(output, "        --- Smallest Xrun-Free Period Sizes, streaming for %u second%s at each "
+                  "size",
+          stress_seconds, stress_seconds == 1 ? "" : "s");
+  if (load_threads != 0)
+    fprintf(output, " with %u thread%s of load", load_threads, load_threads == 1 ? "" : "s");
+  if (stress_priority != 0)
+    fprintf(output, " at SCHED_FIFO priority %d", stress_priority);
+  fprintf(output, ":\n");
+}
+
+static void print_stress_rule(FILE *output) {
+  fprintf(output, "                       "
+                  "-------------------------------------------------------------------------------"
+                  "-------------------\n");
+}
+
+static void print_stress_result(unsigned int rate, snd_pcm_format_t format, unsigned int channels,
+                                const xrun_result *result, FILE *output) {
+  fprintf(output, "                      |%8u |%20s |%10u ", rate, snd_pcm_format_name(format),
+          channels);
+  if (result->error != 0) {
+    char error[64];
+    snprintf(error, sizeof(error), "error %d (\"%s\")", result->error,
+             snd_strerror(result->error));
+    fprintf(output, "| %-52s |\n", error);
   } else {
-    if (a->error_status != 0)
-      debug(3, "Error a %d (\"%s\") on %s.", a->error_status, snd_strerror(a->error_status),
-            a->device_name);
-    if (b->error_status != 0)
-      debug(3, "Error b %d (\"%s\") on %s.", b->error_status, snd_strerror(b->error_status),
-            b->device_name);
-    if ((a->error_status == 0) && (b->error_status == 0)) {
-      if (a->device_number == b->device_number) {
-        if (a->configuration_sets_count == b->configuration_sets_count) {
-          unsigned int si;
-          for (si = 0; si < a->configuration_sets_count; si++) {
-            response = 0; // assume they are equal and look for differences
-            configuration_set *ca = &a->configuration_sets[si];
-            configuration_set *cb = &b->configuration_sets[si];
-            if ((ca->rate_set == cb->rate_set) && (ca->channel_set == cb->channel_set) &&
-                (ca->format_set == cb->format_set)) {
-              unsigned int cmi = 0;
-              while ((cmi < 32) && (response == 0)) {
-                if (strcasecmp(ca->channel_mappings[cmi], cb->channel_mappings[cmi]) != 0) {
-                  response = 1;
-                } else {
-                  cmi++;
-                }
-              }
-            } else {
-              response = 1;
-            }
-          }
-        }
-      }
+    char period_size[16] = "none", buffer_size[16] = "", latency[16] = "", xruns[32] = "none";
+    if (result->period_size != 0) {
+      snprintf(period_size, sizeof(period_size), "%u", result->period_size);
+      snprintf(buffer_size, sizeof(buffer_size), "%u", result->buffer_size);
+      snprintf(latency, sizeof(latency), "%" PRIu64,
+               ((uint64_t)result->buffer_size * 1000000 + rate - 1) / rate);
     }
+    if (result->failed_period_size != 0)
+      snprintf(xruns, sizeof(xruns), "%u at %u", result->xruns, result->failed_period_size);
+    fprintf(output, "|%12s |%12s |%13s |%10s |\n", period_size, buffer_size, latency, xruns);
   }
-  return response;
 }
 
-void print_configuration(configuration_bundle *configuration,
-                         unsigned int similar_interface_count) {
-  if (configuration != NULL) {
-    unsigned int i;
-    unsigned int valid_configuration_sets = 0;
-    for (i = 0; i < configuration->configuration_sets_count; i++) {
-      if (configuration->configuration_sets[i].channel_set != 0) {
-        valid_configuration_sets++;
-      }
+// card is NULL for an interface named with --stress-interface
+static void emit_stress_record(probe_context *context, card_probe *card,
+                               const char *interface_name, unsigned int rate,
+                               snd_pcm_format_t format, unsigned int channels,
+                               unsigned int load_threads, const xrun_result *result) {
+  json_writer *writer = &context->writer;
+  json_record_begin(writer);
+  json_string(writer, "type", "stress");
+  if (card != NULL)
+    json_integer(writer, "card", card->card_number);
+  json_string(writer, "interface", interface_name);
+  json_integer(writer, "rate", rate);
+  json_string(writer, "format", snd_pcm_format_name(format));
+  json_integer(writer, "channels", channels);
+  json_integer(writer, "trial_seconds", stress_seconds);
+  json_integer(writer, "load_threads", load_threads);
+  json_boolean(writer, "realtime", result->realtime);
+  json_integer(writer, "trials", result->trials);
+  if (result->error != 0) {
+    json_string(writer, "status", "error");
+    json_integer(writer, "error", result->error);
+    json_string(writer, "error_text", snd_strerror(result->error));
+  } else {
+    json_string(writer, "status", result->period_size != 0 ? "ok" : "xruns");
+  }
+  if (result->period_size != 0) {
+    json_integer(writer, "period_size", result->period_size);
+    json_integer(writer, "buffer_size", result->buffer_size);
+    json_integer(writer, "latency_us",
+                 ((uint64_t)result->buffer_size * 1000000 + rate - 1) / rate);
+  }
+  if (result->failed_period_size != 0) {
+    json_integer(writer, "failed_period_size", result->failed_period_size);
+    json_integer(writer, "xruns", result->xruns);
+  }
+  json_record_end(writer);
+  json_output_record(writer);
+}
+
+// stream to the interface at each rate of each of its configuration sets and report what was
+// found; card is NULL for an interface named with --stress-interface
+static void stress_interface(probe_context *context, card_probe *card,
+                             configuration_bundle *configuration, unsigned int load_threads,
+                             FILE *output) {
+  xrun_settings settings;
+  settings.trial_milliseconds = stress_seconds * 1000;
+  settings.priority = stress_priority;
+  if (output_format == OUTPUT_FORMAT_TEXT) {
+    fprintf(output, "              >>> Interface \"%s\":\n", configuration->interface_name);
+    print_stress_rule(output);
+    fprintf(output, "                      |    Rate |              Format |  Channels "
+                    "| Period Size | Buffer Size | Latency (us) |     Xruns |\n");
+    print_stress_rule(output);
+  }
+  size_t si;
+  for (si = 0; si < configuration->configuration_sets_count; si++) {
+    configuration_set *set = &configuration->configuration_sets[si];
+    if (bitset_is_empty(&set->channel_set) || bitset_is_empty(&set->format_set))
+      continue;
+    snd_pcm_format_t format = (snd_pcm_format_t)bitset_next(&set->format_set, -1);
+    int channels = 0, ci;
+    bitset_for_each(ci, &set->channel_set) {
+      channels = ci;
     }
-    unsigned int printed_configuration_sets = 0;
-    for (i = 0; i < configuration->configuration_sets_count; i++) {
+    int ri;
+    bitset_for_each(ri, &set->rate_set) {
+      xrun_result result;
+      xrun_find_smallest_period(configuration->interface_name, format, channels,
+                                rates_to_check[ri], &settings, &result);
+      if (output_format == OUTPUT_FORMAT_TEXT)
+        print_stress_result(rates_to_check[ri], format, channels, &result, output);
+      else
+        emit_stress_record(context, card, configuration->interface_name, rates_to_check[ri],
+                           format, channels, load_threads, &result);
+    }
+  }
+  if (output_format == OUTPUT_FORMAT_TEXT)
+    print_stress_rule(output);
+}
 
-      if (configuration->configuration_sets[i].channel_set != 0) {
-        if (printed_configuration_sets == 0) {
-          if (similar_interface_count == 1)
-            printf("                  This interface supports ");
-          else
-            printf("                  These interfaces support ");
-        } else {
-          if (similar_interface_count == 1)
-            printf("                    It also supports ");
-          else
-            printf("                    They also support ");
-        }
-        printf("any rate, format and channel combination from the "
-               "following "
-               "table:\n");
-        printf(
-            "                       "
-            "-------------------------------------------------------------------------------------"
-            "------------------------\n");
-        printf("                      |    Rate |              Format |  Channels | Channel Map    "
-               "          "
-               "                                       |\n");
-        printf(
-            "                       "
-            "-------------------------------------------------------------------------------------"
-            "------------------------\n");
-        configuration_set tcs = configuration->configuration_sets[i];
-        unsigned int tri, tfi, tci;
-        tri = tfi = tci = 0;
-        while ((tcs.rate_set != 0) || (tcs.format_set != 0) || (tcs.channel_set != 0)) {
-          // while ((tcs.rate_set != 0) && (tcs.format_set != 0) && (tcs.channel_set !=
-          // 0)) { next rate
-          if (tcs.rate_set != 0) {
-            while ((tcs.rate_set & (1 << tri)) == 0)
-              tri++;
-            tcs.rate_set &= ~(1 << tri);
-            printf("                      |%8d ", rates_to_check[tri]);
-          } else {
-            printf("                      |         ");
-          }
-          // next format
-          if (tcs.format_set != 0) {
-            while ((tcs.format_set & (1 << tfi)) == 0)
-              tfi++;
-            tcs.format_set &= ~(1 << tfi);
-            printf("|%20s ", snd_pcm_format_name(formats_to_check[tfi]));
-          } else {
-            printf("|                     ");
-          }
-          // next channel count
-          if (tcs.channel_set != 0) {
-            while ((tcs.channel_set & (1 << tci)) == 0)
-              tci++;
-            tcs.channel_set &= ~(1 << tci);
-            printf("|%10d | %-63s |\n", tci, tcs.channel_mappings[tci]);
-          } else {
-            printf("|%10s | %-63s |\n", "", "");
-          }
-        }
-        printf(
-            "                       "
-            "-------------------------------------------------------------------------------------"
-            "------------------------\n");
-        printed_configuration_sets++;
+static void stress_card(probe_context *context, card_probe *card, FILE *output) {
+  unsigned int load_threads = 0;
+  int load_started = 0;
+  int heading_printed = 0;
+  size_t pi, capture_start = first_capture_probe(card);
+  for (pi = 0; pi < capture_start; pi++) {
+    interface_probe *probe = &card->probes[pi];
+    configuration_bundle *configuration = probe->configuration;
+    // an alias of another hw: interface is the same PCM, so it needn't be streamed to again
+    if ((strncmp(probe->interface_name, "hw:", strlen("hw:")) != 0) || (configuration == NULL) ||
+        (configuration->error_status != 0) ||
+        (strncmp(configuration->alias_of, "hw:", strlen("hw:")) == 0))
+      continue;
+    if (heading_printed == 0) {
+      if (stress_load_threads != 0) {
+        load_threads = xrun_load_start(stress_load_threads);
+        load_started = 1;
       }
+      if (output_format == OUTPUT_FORMAT_TEXT)
+        print_stress_heading(load_threads, output);
+      heading_printed = 1;
     }
+    stress_interface(context, card, configuration, load_threads, output);
+  }
+  if (load_started != 0)
+    xrun_load_stop();
+}
+
+// probe each interface named with --stress-interface and stream to it
+static void stress_named_interfaces(FILE *output) {
+  probe_context context;
+  arena *arena = arena_create();
+  if ((arena == NULL) || (probe_context_init(&context) != 0)) {
+    debug(1, "could not allocate memory to stress the interfaces named.");
+    arena_release(arena);
+    return;
+  }
+  unsigned int load_threads = 0;
+  if (stress_load_threads != 0)
+    load_threads = xrun_load_start(stress_load_threads);
+  if (output_format == OUTPUT_FORMAT_TEXT)
+    print_stress_heading(load_threads, output);
+  size_t ni;
+  for (ni = 0; ni < stress_interface_name_count; ni++) {
+    configuration_bundle *configuration = get_permissible_configuration_settings(
+        &context, arena, stress_interface_names[ni], SND_PCM_STREAM_PLAYBACK, "", "", NULL, 0);
+    if ((configuration == NULL) || (configuration->error_status != 0))
+      warn("\"%s\" could not be probed, so it has not been streamed to.",
+           stress_interface_names[ni]);
+    else
+      stress_interface(&context, NULL, configuration, load_threads, output);
+  }
+  if (stress_load_threads != 0)
+    xrun_load_stop();
+  probe_mismatches += context.probe_mismatches;
+  probe_context_free(&context);
+  arena_release(arena);
+}
+
+// A scan is made in passes over a model of the system. The first pass builds the model -- every
+// card, with its devices, subdevices and interfaces -- before any PCM is opened. The second
+// probes the interfaces that need it and the third prints the results, a card at a time, so
+// that a card's model is released as soon as it has been printed.
+
+typedef struct {
+  card_probe card;
+  int model_status; // the result of building the card's model
+  size_t interfaces_to_probe;
+  char *report; // the card's output
+  size_t report_size;
+  int done;
+} card_job;
+
+// probe a card in the model and print what was found on it to output
+static void process_card(card_job *job, FILE *output, probe_context *context) {
+  if (job->model_status == 0) {
+    probe_card_model(context, &job->card);
+    if (output_format == OUTPUT_FORMAT_TEXT)
+      print_card(&job->card, output);
+    if ((stress_interfaces != 0) && (stress_interface_name_count == 0))
+      stress_card(context, &job->card, output);
+  }
+  card_probe_free(&job->card);
+}
+
+static void process_cards_in_sequence(card_job *jobs, size_t count) {
+  probe_context context;
+  if (probe_context_init(&context) == 0) {
+    size_t i;
+    for (i = 0; i < count; i++)
+      process_card(&jobs[i], stdout, &context);
+    probe_mismatches += context.probe_mismatches;
+    probe_timeouts += context.probe_timeouts;
+    probe_context_free(&context);
   } else {
-    debug(1, "no configuration to print!");
+    debug(1, "could not allocate a probe context");
   }
 }
 
-static int process_cards() {
-  // get total number of cards
-  int card_count = 0;
-  {
-    void **hints;
-    if (snd_device_name_hint(-1, "ctl", &hints) == 0) {
-      void **control_interface_hints = hints;
-      while (*control_interface_hints != NULL) {
-        char *control_interface_name = snd_device_name_get_hint(*control_interface_hints, "NAME");
-        if (strstr(control_interface_name, "hw:CARD=") == control_interface_name) {
-          debug(1, "%s", control_interface_name);
-          card_count++;
-        }
-        free(control_interface_name);
-        control_interface_hints++;
+// With -j, cards are probed on a pool of worker threads, each with its own probe context.
+// The cards with the most interfaces to probe are started first, so that a big card isn't left
+// until last. Each card's report is written to memory and printed in the original card order as
+// soon as it and all the cards before it are done, so the output is the same as that of a serial
+// run.
+
+typedef struct {
+  card_job *jobs;
+  size_t *order; // the jobs in the order they are to be started
+  size_t job_count;
+  size_t next_job; // the next job in the order to be picked up by a worker
+  unsigned int probe_mismatches;
+  unsigned int probe_timeouts;
+  pthread_mutex_t lock;
+  pthread_cond_t job_done;
+} card_job_queue;
+
+static void *card_worker(void *arg) {
+  card_job_queue *queue = (card_job_queue *)arg;
+  probe_context context;
+  int context_ok = probe_context_init(&context);
+  if (context_ok != 0)
+    debug(1, "could not allocate a probe context for a card worker");
+  int finished = 0;
+  while (finished == 0) {
+    card_job *job = NULL;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->next_job < queue->job_count)
+      job = &queue->jobs[queue->order[queue->next_job++]];
+    pthread_mutex_unlock(&queue->lock);
+    if (job != NULL) {
+      FILE *output = open_memstream(&job->report, &job->report_size);
+      if (output != NULL) {
+        if (context_ok == 0)
+          process_card(job, output, &context);
+        fclose(output);
+      } else {
+        debug(1, "could not open a report stream for \"%s\".",
+              job->card.control_interface_name);
+        card_probe_free(&job->card);
       }
-      snd_device_name_free_hint(hints);
+      pthread_mutex_lock(&queue->lock);
+      job->done = 1;
+      pthread_cond_broadcast(&queue->job_done);
+      pthread_mutex_unlock(&queue->lock);
+    } else {
+      finished = 1;
     }
   }
-  printf("  --- Alsa Version: %s.\n", SND_LIB_VERSION_STR);
-  printf("  --- Sound Cards: %u.\n", card_count);
+  if (context_ok == 0) {
+    pthread_mutex_lock(&queue->lock);
+    queue->probe_mismatches += context.probe_mismatches;
+    queue->probe_timeouts += context.probe_timeouts;
+    pthread_mutex_unlock(&queue->lock);
+    probe_context_free(&context);
+  }
+  return NULL;
+}
 
-  char *prefixes[] = {"hw", "hdmi", "iec958"};
+static void process_cards_in_parallel(card_job *jobs, size_t count) {
+  card_job_queue queue;
+  memset(&queue, 0, sizeof(queue));
+  queue.order = malloc(sizeof(size_t) * count);
+  if (queue.order == NULL) {
+    debug(1, "could not allocate the card jobs -- probing in sequence.");
+    process_cards_in_sequence(jobs, count);
+    return;
+  }
+  queue.jobs = jobs;
+  queue.job_count = count;
+  pthread_mutex_init(&queue.lock, NULL);
+  pthread_cond_init(&queue.job_done, NULL);
+  // an insertion sort, largest first, keeping cards with the same number in card order
+  size_t i, j;
+  for (i = 0; i < count; i++) {
+    for (j = i; (j > 0) && (jobs[queue.order[j - 1]].interfaces_to_probe <
+                            jobs[i].interfaces_to_probe);
+         j--)
+      queue.order[j] = queue.order[j - 1];
+    queue.order[j] = i;
+  }
+
+  unsigned int worker_count = probe_jobs;
+  if (worker_count > count)
+    worker_count = count;
+  pthread_t *workers = malloc(sizeof(pthread_t) * worker_count);
+  unsigned int workers_started = 0;
+  if (workers != NULL) {
+    while ((workers_started < worker_count) &&
+           (pthread_create(&workers[workers_started], NULL, card_worker, &queue) == 0))
+      workers_started++;
+  }
+  debug(2, "%u card workers started.", workers_started);
+  if (workers_started == 0) // do the work on this thread instead
+    card_worker(&queue);
+
+  // print the reports in card order as they become available
+  for (i = 0; i < count; i++) {
+    pthread_mutex_lock(&queue.lock);
+    while (jobs[i].done == 0)
+      pthread_cond_wait(&queue.job_done, &queue.lock);
+    pthread_mutex_unlock(&queue.lock);
+    if (jobs[i].report != NULL) {
+      fwrite(jobs[i].report, 1, jobs[i].report_size, stdout);
+      free(jobs[i].report);
+    }
+  }
+  fflush(stdout);
+
+  unsigned int wi;
+  for (wi = 0; wi < workers_started; wi++)
+    pthread_join(workers[wi], NULL);
+  if (workers != NULL)
+    free(workers);
+  probe_mismatches += queue.probe_mismatches;
+  probe_timeouts += queue.probe_timeouts;
+  pthread_cond_destroy(&queue.job_done);
+  pthread_mutex_destroy(&queue.lock);
+  free(queue.order);
+}
+
+void print_report_header(FILE *output, unsigned int card_count) {
+  fprintf(output, "  --- Alsa Version: %s.\n", backend->library_version());
+  fprintf(output, "  --- Sound Cards: %u.\n", card_count);
+}
+
+// make a list of the cards' control interface names, e.g. "hw:CARD=Generic", in card order
+size_t get_control_interface_names(char ***control_interface_names) {
+  size_t control_interface_names_count = 0;
+  size_t control_interface_names_allocated = 0;
+  *control_interface_names = NULL;
   void **hints;
-  if (snd_device_name_hint(-1, "ctl", &hints) == 0) {
+  uint64_t hints_start = trace_start();
+  int err = snd_device_name_hint(-1, "ctl", &hints);
+  trace_end(TRACE_NAME_HINTS, hints_start, NULL);
+  if (err == 0) {
     void **control_interface_hints = hints;
     while (*control_interface_hints != NULL) {
       char *control_interface_name = snd_device_name_get_hint(*control_interface_hints, "NAME");
       // only accept names that have a "hw:" in them...
       debug(1, "control interface name: \"%s\"", control_interface_name);
-      if (strstr(control_interface_name, "hw:CARD=") == control_interface_name) {
-        char *card_name = control_interface_name + strlen("hw:CARD=");
-        snd_ctl_t *handle;
-        int err = snd_ctl_open(&handle, control_interface_name, 0);
-        if (err == 0) {
-          snd_ctl_card_info_t *info;
-          snd_ctl_card_info_alloca(&info);
-          err = snd_ctl_card_info(handle, info);
-          if (err == 0) {
-            const size_t maximum_configurations = 256;
-            configuration_bundle *configurations[maximum_configurations];
-            size_t current_configuration = 0;
-
-            // if ((err == 0) && (snd_ctl_card_info_get_card(info) != 0)) {
-            int card_number = snd_ctl_card_info_get_card(info);
-            printf("  --- Card %u:\n", card_number);
-            if (display_extended_information != 0) printf("        --- CTL name: \"%s\".\n", control_interface_name);
-            printf("        --- Name: \"%s\".\n", snd_ctl_card_info_get_name(info));
-            if (display_extended_information != 0) printf("        --- Long name: \"%s\".\n", snd_ctl_card_info_get_longname(info));
-
-            if (display_extended_information != 0)  {
-              // get device count
-              unsigned int l_device_count = 0;
-              {
-                int l_dev = -1;
-                while ((snd_ctl_pcm_next_device(handle, &l_dev) == 0) && (l_dev != -1))
-                  l_device_count++;
-              }
-              printf("        --- Devices: %u.\n", l_device_count);
-            }
-            debug(2,
-                  "ctl: name \"%s\", index %d, components \"%s\", name \"%s\", longname \"%s\", "
-                  "mixer \"%s\", driver \"%s\".",
-                  control_interface_name, snd_ctl_card_info_get_card(info),
-                  snd_ctl_card_info_get_components(info), snd_ctl_card_info_get_name(info),
-                  snd_ctl_card_info_get_longname(info), snd_ctl_card_info_get_mixername(info),
-                  snd_ctl_card_info_get_driver(info));
-
-            // get the all the names of the PCM interfaces on the card
-            char *interface_names[32];
-            unsigned int interface_names_count = 0;
-
-            void **name_hints;
-            if (snd_device_name_hint(snd_ctl_card_info_get_card(info), "pcm", &name_hints) == 0) {
-              void **device_on_card_hints = name_hints;
-              // for each virtual interface of interest on the card...
-              while (*device_on_card_hints != NULL) {
-                interface_names[interface_names_count++] =
-                    snd_device_name_get_hint(*device_on_card_hints, "NAME");
-                device_on_card_hints++;
-              }
-              snd_device_name_free_hint(name_hints);
-            }
-
-            {
-              unsigned int i;
-              for (i = 0; i < interface_names_count; i++) {
-                debug(1, "interface name %d is \"%s\".", i, interface_names[i]);
-              }
-            }
-
-            snd_pcm_info_t *pcminfo;
-            snd_pcm_info_alloca(&pcminfo);
-            unsigned int pn = 0;
-            /*
-                        for (pn = 0; pn < sizeof(prefixes) / sizeof(char *); pn++) {
-                          // check that the prefix is either "hw" (index 0) or prefixes one  of the
-               interface
-                          // names
-                          int prefix_is_valid = (pn == 0);
-                          if (prefix_is_valid == 0) {
-                            unsigned int ni = 0;
-                            while ((prefix_is_valid == 0) && (ni < interface_names_count)) {
-                              if (strstr(interface_names[ni], prefixes[pn]) == interface_names[ni])
-               { debug(3, "prefix \"%s\" is valid.", prefixes[pn]); prefix_is_valid = 1; } else {
-                                debug(3, "prefix \"%s\" is not valid against \"%s\".", prefixes[pn],
-                                      interface_names[ni]);
-                                ni++;
-                              }
-                            }
-                          }
-                          if (prefix_is_valid != 0) {
-            */
-            if ((err = snd_ctl_pcm_info(handle, pcminfo)) == 0) {
-              int dev = -1;
-              while ((snd_ctl_pcm_next_device(handle, &dev) == 0) && (dev != -1)) {
-                debug(1, "device: %u", dev);
-                snd_pcm_info_set_device(pcminfo, dev);
-                if (display_extended_information != 0) {
-                  printf("              --- Device %u:\n", dev);
-                  printf("                    --- Name: \"%s\".\n", snd_pcm_info_get_name(pcminfo));
-                  printf("                    --- ID: \"%s\".\n", snd_pcm_info_get_id(pcminfo));
-                }
-                snd_pcm_info_set_subdevice(pcminfo, 0);
-                if ((err = snd_ctl_pcm_info(handle, pcminfo)) == 0) {
-                  int sub_device_count = snd_pcm_info_get_subdevices_avail(pcminfo);
-                  if (sub_device_count == 0) {
-                    // printf("Note: no subdevices can be found on card %u, device %u!\n", card_number,
-                    //        dev);
-                    // this zero can happen if the device is busy, so pretend there is at least one.
-                    sub_device_count = 1; // pretend there is one subdevice
-                    if (display_extended_information != 0) printf("                    --- Subdevices: Count not available. Is the device busy?\n");
-                  } else if (display_extended_information != 0) {
-                    printf("                    --- Subdevices: %d.\n", sub_device_count);
-                  }
-
-                  int sub_device;
-                  for (sub_device = 0; sub_device < sub_device_count; sub_device++) {
-                    debug(3, "subdevice: %u", sub_device);
-                    snd_pcm_info_set_subdevice(pcminfo, sub_device);
-                    snd_pcm_info_set_stream(pcminfo, SND_PCM_STREAM_PLAYBACK);
-                    if ((err = snd_ctl_pcm_info(handle, pcminfo)) < 0) {
-                      if (err != -ENOENT)
-                        debug(1, "snd_ctl_pcm_info error for card %i, subdevice %i: %s",
-                              card_number, sub_device, snd_strerror(err));
-                    }
-                    if (display_extended_information != 0) {
-                    printf("                          --- Subdevice: %d:\n", sub_device);
-                    printf("                                --- Name: \"%s\".\n",
-                           snd_pcm_info_get_subdevice_name(pcminfo));
-                    }
-                    int at_least_on_interface_found = 0;
-                    for (pn = 0; pn < sizeof(prefixes) / sizeof(char *); pn++) {
-                      char interface_name[128];
-
-                      if (sub_device == 0) {
-                        if (dev == 0) {
-                          sprintf(interface_name, "%s:%s", prefixes[pn], card_name);
-                        } else {
-                          sprintf(interface_name, "%s:CARD=%s,DEV=%i", prefixes[pn], card_name,
-                                  dev);
-                        }
-                      } else {
-                        sprintf(interface_name, "%s:CARD=%s,DEV=%i,SUBDEV=%i", prefixes[pn],
-                                card_name, dev, sub_device);
-                      }
-
-                      configurations[current_configuration] =
-                          get_permissible_configuration_settings(interface_name, pcminfo);
-
-                      if (configurations[current_configuration] != NULL) {
-                        if  (configurations[current_configuration]->error_status != -ENOENT) {
-                          current_configuration++;
-                          if (display_extended_information != 0) {
-                          if (at_least_on_interface_found == 0) {
-                            printf("                                --- Interfaces:\n");
-                            at_least_on_interface_found = 1;
-                          }
-                          printf("                                      >>> \"%s\"\n",
-                                 interface_name);
-                          }
-                        } else {
-                          debug(1, "error %d looking for configurations for \"%s\"", configurations[current_configuration]->error_status, interface_name);
-                        }
-                      } else {
-                        debug(1, "no configuration bundle for interface \"%s\".", interface_name);
-                      }
-                    }
-                  }
-
-                } else {
-                  debug(1, "card %i, device %i: error %d, %s", card_number, dev, err,
-                        snd_strerror(err));
-                }
-              }
-            } else {
-              debug(1, "card %i, error %d, %s", snd_ctl_card_info_get_card(info), err,
-                    snd_strerror(err));
-            }
-            // }
-            // }
-
-            // free all those interface names
-            unsigned int ini;
-            for (ini = 0; ini < interface_names_count; ini++)
-              free(interface_names[ini]);
-
-            mixer_bundle_t mixer_info;
-            mixer_info.size = MIXER_BUNDLE_SIZE;
-            mixer_info.first_free = 0;
-            err = process_mixers(control_interface_name, &mixer_info);
-            if (err == 0) {
-              debug(2, "%u mixers found.", mixer_info.first_free);
-              if (mixer_info.first_free == 0)
-                printf("        --- No mixers found.\n");
-              else if (mixer_info.first_free > 0) {
-                if (mixer_info.first_free == 1)
-                  printf("        --- Mixer:\n");
-                else
-                  printf("        --- Mixers:\n");                
-                printf("               "
-                       "---------------------------------------------------------------------------"
-                       "-----------------------------\n");
-                printf("              |  %-32s  |  %5s  |  %6s  |  %6s  |  %7s  |  %7s"
-                       "  |  %7s  |\n",
-                       "Name", "Index", "Min", "Max", "Mute dB", "Min dB", "Max dB");
-                printf("               "
-                       "---------------------------------------------------------------------------"
-                       "-----------------------------\n");
-                unsigned int i;
-                for (i = 0; i < mixer_info.first_free; i++) {
-                  if (mixer_info.mixer[i].has_a_decibel_range != 0) {
-                    // if (i % 2 == 0) {
-                    printf("              |  %-32s  |  %5u  |  %6ld  |  %6ld  |  %7s  |  %7.2f  | "
-                           " %7.2f  |\n",
-                           mixer_info.mixer[i].name, mixer_info.mixer[i].index,
-                           mixer_info.mixer[i].minv, mixer_info.mixer[i].maxv,
-                           mixer_info.mixer[i].lowest_value_is_mute ? "Yes" : "No",
-                           mixer_info.mixer[i].mindecibels * 0.01,
-                           mixer_info.mixer[i].maxdecibels * 0.01);
-                  } else {
-                    printf("              |  %-32s  |  %5u  |  %6ld  |  %6ld  |  %7s  |  %7s  "
-                           "|  %7s  |\n",
-                           mixer_info.mixer[i].name, mixer_info.mixer[i].index,
-                           mixer_info.mixer[i].minv, mixer_info.mixer[i].maxv, " ", " ", " ");
-                  }
-                }
-                printf("               "
-                       "---------------------------------------------------------------------------"
-                       "-----------------------------\n");
-              }
-            } else {
-              debug(1, "Error %d (\"%s\") getting mixer information for card \"%s\".", err,
-                    snd_strerror(err), control_interface_name);
-            }
-            size_t ci;
-            int configurations_printed = 0;
-            for (ci = 0; ci < current_configuration; ci++) {
-              // process the configuration
-              if ((configurations[ci] != NULL) && (configurations[ci] != NULL) &&
-                  (configurations[ci]->error_status != -ENOENT) &&
-                  (configurations[ci]->error_status != -EINVAL) &&
-                  (configurations[ci]->already_handled == 0)) {
-                if (configurations_printed == 0) {
-                  configurations_printed = 1;
-                  printf("        --- Interfaces and Supported Formats:\n");
-                }
-                printf("              >>> Interface \"%s\":\n", configurations[ci]->interface_name);
-                char indent[] = "                  ";
-                if (configurations[ci]->error_status == -EBUSY) {
-                  printf("%sThis interface is busy and can not be "
-                         "checked.\n",
-                         indent);
-                  printf("%sTo check it, take it out of use and try again.\n", indent);
-                } else if (configurations[ci]->error_status == -524) {
-                  printf("%sThis interface appears to be for a disconnected or uninitialized HDMI port. To test it, perform the following steps:\n",
-                         indent);
-                  printf("%s   (1) connect it to the HDMI device,\n", indent);
-                  printf("%s   (2) turn the HDMI device on and select this device as "
-                         "source,\n",
-                         indent);
-                  printf("%s   (3) reboot and try again.\n", indent);
-                } else if (configurations[ci]->error_status == -ENODEV) {
-                  printf("%sThis interface cannot be found (error 19). If it is for a HDMI port then, to test it, perform the following steps:\n",
-                         indent);
-                  printf("%s   (1) connect it to the HDMI device,\n", indent);
-                  printf("%s   (2) turn the HDMI device on and select this device as "
-                         "source,\n",
-                         indent);
-                  printf("%s   (3) reboot and try again.\n", indent);
-                } else if (configurations[ci]->error_status != 0) {
-                  printf("%sError %d (\"%s\").\n", indent, configurations[ci]->error_status,
-                         snd_strerror(configurations[ci]->error_status));
-                } else {
-                  unsigned int similar_interface_count = 1;
-                  size_t cj;
-                  for (cj = ci + 1; cj < current_configuration; cj++) {
-                    if ((configurations[cj]->already_handled == 0) &&
-                        (configurations_equal(configurations[ci], configurations[cj]) == 0)) {
-                      // if (0) {
-                      printf("              >>> Interface \"%s\":\n",
-                             configurations[cj]->interface_name);
-                      configurations[cj]->already_handled = 1;
-                      similar_interface_count++;
-                    }
-                  }
-
-                  print_configuration(configurations[ci], similar_interface_count);
-                }
-              }
-            }
-
-            debug(1, "Pass 2");
-            for (ci = 0; ci < current_configuration; ci++) {
-              if (configurations[ci] != NULL) {
-                // delete configuration[ci]
-                if (configurations[ci]->configuration_sets != NULL)
-                  free(configurations[ci]->configuration_sets);
-                free(configurations[ci]);
-              }
-            }
+      if ((control_interface_name != NULL) &&
+          (strstr(control_interface_name, "hw:CARD=") == control_interface_name)) {
+        if (control_interface_names_count == control_interface_names_allocated) {
+          size_t new_size =
+              control_interface_names_allocated == 0 ? 8 : control_interface_names_allocated * 2;
+          char **new_names = realloc(*control_interface_names, sizeof(char *) * new_size);
+          if (new_names == NULL) {
+            debug(1, "could not allocate memory for the list of cards");
+            free(control_interface_name);
+            break;
           }
+          *control_interface_names = new_names;
+          control_interface_names_allocated = new_size;
         }
+        (*control_interface_names)[control_interface_names_count++] = control_interface_name;
+      } else if (control_interface_name != NULL) {
+        free(control_interface_name);
       }
-      free(control_interface_name);
       control_interface_hints++;
     }
     snd_device_name_free_hint(hints);
   } else {
     debug(1, "could not get list of control interfaces");
   }
+  return control_interface_names_count;
+}
+
+void free_control_interface_names(char **control_interface_names, size_t count) {
+  size_t ni;
+  for (ni = 0; ni < count; ni++)
+    free(control_interface_names[ni]);
+  if (control_interface_names != NULL)
+    free(control_interface_names);
+}
+
+static const char *alsa_library_version(void) { return SND_LIB_VERSION_STR; }
+
+static int alsa_pcm_open(snd_pcm_t **handle, const char *interface_name,
+                         snd_pcm_stream_t stream) {
+  return snd_pcm_open(handle, interface_name, stream, 0);
+}
+
+static int alsa_pcm_identity(snd_pcm_t *handle, pcm_signature *signature) {
+  snd_pcm_info_t *info = NULL;
+  snd_pcm_info_alloca(&info);
+  int response = snd_pcm_info(handle, info);
+  if (response == 0) {
+    signature->type = snd_pcm_type(handle);
+    signature->card = snd_pcm_info_get_card(info);
+    signature->device = snd_pcm_info_get_device(info);
+    signature->subdevice = snd_pcm_info_get_subdevice(info);
+  }
+  return response;
+}
+
+static int alsa_hw_params_get_channels_min(__attribute__((unused)) snd_pcm_t *handle,
+                                           const snd_pcm_hw_params_t *params,
+                                           unsigned int *channels) {
+  return snd_pcm_hw_params_get_channels_min(params, channels);
+}
+
+static int alsa_hw_params_get_channels_max(__attribute__((unused)) snd_pcm_t *handle,
+                                           const snd_pcm_hw_params_t *params,
+                                           unsigned int *channels) {
+  return snd_pcm_hw_params_get_channels_max(params, channels);
+}
+
+static int alsa_hw_params_get_rate_min(__attribute__((unused)) snd_pcm_t *handle,
+                                       const snd_pcm_hw_params_t *params, unsigned int *rate) {
+  return snd_pcm_hw_params_get_rate_min(params, rate, NULL);
+}
+
+static int alsa_hw_params_get_rate_max(__attribute__((unused)) snd_pcm_t *handle,
+                                       const snd_pcm_hw_params_t *params, unsigned int *rate) {
+  return snd_pcm_hw_params_get_rate_max(params, rate, NULL);
+}
+
+static void alsa_hw_params_get_format_mask(__attribute__((unused)) snd_pcm_t *handle,
+                                           snd_pcm_hw_params_t *params,
+                                           snd_pcm_format_mask_t *mask) {
+  snd_pcm_hw_params_get_format_mask(params, mask);
+}
+
+static int alsa_hw_params_get_buffer_limits(__attribute__((unused)) snd_pcm_t *handle,
+                                            const snd_pcm_hw_params_t *params,
+                                            buffer_limits *limits) {
+  snd_pcm_uframes_t period_size_min = 0, period_size_max = 0;
+  snd_pcm_uframes_t buffer_size_min = 0, buffer_size_max = 0;
+  int response = snd_pcm_hw_params_get_period_size_min(params, &period_size_min, NULL);
+  if (response == 0)
+    response = snd_pcm_hw_params_get_period_size_max(params, &period_size_max, NULL);
+  if (response == 0)
+    response = snd_pcm_hw_params_get_buffer_size_min(params, &buffer_size_min);
+  if (response == 0)
+    response = snd_pcm_hw_params_get_buffer_size_max(params, &buffer_size_max);
+  if (response == 0)
+    response = snd_pcm_hw_params_get_periods_min(params, &limits->periods_min, NULL);
+  if (response == 0)
+    response = snd_pcm_hw_params_get_periods_max(params, &limits->periods_max, NULL);
+  // no real device has a buffer of four thousand million frames
+  limits->period_size_min = period_size_min > UINT_MAX ? UINT_MAX : period_size_min;
+  limits->period_size_max = period_size_max > UINT_MAX ? UINT_MAX : period_size_max;
+  limits->buffer_size_min = buffer_size_min > UINT_MAX ? UINT_MAX : buffer_size_min;
+  limits->buffer_size_max = buffer_size_max > UINT_MAX ? UINT_MAX : buffer_size_max;
+  return response;
+}
+
+const probe_backend alsa_backend = {
+    .library_version = alsa_library_version,
+    .get_control_interface_names = get_control_interface_names,
+    .get_card_info = alsa_get_card_info,
+    .enumerate_card = alsa_enumerate_card,
+    .load_mixers = process_mixers,
+    .pcm_open = alsa_pcm_open,
+    .pcm_close = snd_pcm_close,
+    .pcm_identity = alsa_pcm_identity,
+    .hw_free = snd_pcm_hw_free,
+    .hw_params_any = snd_pcm_hw_params_any,
+    .hw_params_set_access = snd_pcm_hw_params_set_access,
+    .hw_params_set_channels = snd_pcm_hw_params_set_channels,
+    .hw_params_set_format = snd_pcm_hw_params_set_format,
+    .hw_params_set_rate_near = snd_pcm_hw_params_set_rate_near,
+    .hw_params_test_channels = snd_pcm_hw_params_test_channels,
+    .hw_params_test_format = snd_pcm_hw_params_test_format,
+    .hw_params_get_channels_min = alsa_hw_params_get_channels_min,
+    .hw_params_get_channels_max = alsa_hw_params_get_channels_max,
+    .hw_params_get_rate_min = alsa_hw_params_get_rate_min,
+    .hw_params_get_rate_max = alsa_hw_params_get_rate_max,
+    .hw_params_get_format_mask = alsa_hw_params_get_format_mask,
+    .hw_params_get_buffer_limits = alsa_hw_params_get_buffer_limits,
+    .hw_params = snd_pcm_hw_params,
+    .get_channel_map = alsa_get_channel_map,
+    .query_channel_maps = alsa_query_channel_maps};
+
+void open_card_cache(void) {
+  // the slower probe engines are for checking the probing itself, so they don't use old results
+  if (use_probe_cache != 0)
+    card_cache =
+        probe_cache_open(NULL, (refresh_probe_cache != 0) || (probe_engine != PROBE_ENGINE_REFINED));
+}
+
+void close_card_cache(void) {
+  probe_cache_close(card_cache);
+  card_cache = NULL;
+}
+
+static int process_cards() {
+  if (probe_budget != 0)
+    probe_budget_deadline = monotonic_time_in_ns() + (uint64_t)probe_budget * 1000000000;
+  char **control_interface_names;
+  size_t control_interface_names_count =
+      list_control_interfaces_in_time(&control_interface_names);
+  json_writer writer;
+  memset(&writer, 0, sizeof(writer));
+  if (output_format == OUTPUT_FORMAT_TEXT) {
+    print_report_header(stdout, control_interface_names_count);
+  } else {
+    json_output_begin(stdout, output_format == OUTPUT_FORMAT_NDJSON);
+    emit_header_record(&writer, control_interface_names_count);
+  }
+
+  if (control_interface_names_count != 0) {
+    open_card_cache();
+    card_job *jobs = calloc(control_interface_names_count, sizeof(card_job));
+    if (jobs == NULL) {
+      debug(1, "could not allocate memory for the model of the system.");
+    } else {
+      size_t i, pi;
+      size_t interface_count = 0, interfaces_to_probe = 0;
+      for (i = 0; i < control_interface_names_count; i++) {
+        jobs[i].model_status = build_card_model(control_interface_names[i], &jobs[i].card, 1);
+        if (jobs[i].model_status == 0) {
+          for (pi = 0; pi < jobs[i].card.probe_count; pi++)
+            if (jobs[i].card.probes[pi].configuration == NULL)
+              jobs[i].interfaces_to_probe++;
+          interface_count += jobs[i].card.probe_count;
+          interfaces_to_probe += jobs[i].interfaces_to_probe;
+        }
+      }
+      debug(1, "%zu cards with %zu interfaces, %zu of which are to be probed.",
+            control_interface_names_count, interface_count, interfaces_to_probe);
+      if ((probe_jobs > 1) && (control_interface_names_count > 1))
+        process_cards_in_parallel(jobs, control_interface_names_count);
+      else
+        process_cards_in_sequence(jobs, control_interface_names_count);
+      free(jobs);
+    }
+    close_card_cache();
+  }
+  if (stress_interface_name_count != 0)
+    stress_named_interfaces(stdout);
+
+  if (output_format != OUTPUT_FORMAT_TEXT) {
+    emit_end_record(&writer, control_interface_names_count);
+    json_output_end();
+  }
+  json_writer_free(&writer);
+  free_control_interface_names(control_interface_names, control_interface_names_count);
   return 0;
 }
 
@@ -1184,11 +3706,28 @@ void check_device_access() {
   }
 }
 
+static void print_run_statistics(FILE *output) {
+  arena_statistics memory;
+  arena_get_statistics(&memory);
+  fprintf(output, "  --- Memory: %zu bytes in %zu allocations from %zu arenas.\n",
+          memory.bytes_allocated, memory.allocation_count, memory.arena_count);
+  fprintf(output, "  --- Memory: %zu chunks, with at most %zu bytes held at once.\n",
+          memory.chunk_count, memory.peak_bytes_reserved);
+  trace_print_statistics(output);
+}
+
 int main(int argc, char *argv[]) {
   snd_lib_error_set_handler(
       (snd_lib_error_handler_t)snd_error_quiet); // quieten alsa diagnostic messages
   // int result = 0;
   int debug_level = 0;
+  int run_as_daemon = 0;
+  int query_the_daemon = 0;
+  char *socket_path = NULL;
+  char *trace_path = NULL;
+  char *record_path = NULL;
+  char *replay_path = NULL;
+  char *worker_interface_name = NULL; // the interface to probe as a worker process
   int i;
   for (i = 1; i < argc; ++i) {
     if (argv[i][0] == '-') {
@@ -1214,7 +3753,7 @@ int main(int argc, char *argv[]) {
             stdout,
             "Dacquery prints information about ALSA DACs -- (Digital to Analog Converters).\n"
             "It tries to open each DAC for interleaved operation at standard rates\n"
-            "and formats, with one to eight output channels.\n"
+            "and formats, with as many output channels as the DAC says it can take.\n"
             "Dacquery also prints information about output mixers it finds.\n\n"
             "Notes:\n"
             "1. This tool must be run by a user with access to audio devices,\n"
@@ -1229,6 +3768,43 @@ int main(int argc, char *argv[]) {
 
             "Command line arguments:\n"
             "    -e     display extended information, including a \"map\" of cards, devices, subdevices and interfaces,\n"
+            "    -j N   probe up to N cards at the same time,\n"
+            "    -J N   probe up to N interfaces of each card at the same time,\n"
+            "    --exhaustive  probe every channel, rate and format combination rather than\n"
+            "           just those left open by the device's refined configuration space,\n"
+            "    --verify      probe using both methods and report any interface on which they disagree,\n"
+            "    --no-commit   decide what can be used from the refined configuration space alone,\n"
+            "           and get channel maps from the device's list of them,\n"
+            "    --infer-subdevices  take the results for a subdevice from another subdevice of the\n"
+            "           same device if their configuration spaces match,\n"
+            "    --capture     probe the capture streams and list the capture mixers too,\n"
+            "    --latency     list the period and buffer size limits at each rate, and the\n"
+            "           lowest latency they allow,\n"
+            "    --volume-curves  sample the dB value of every volume step of each mixer and list\n"
+            "           the points that describe its curve,\n"
+            "    --stress      stream silence to each playback hw: interface at decreasing period\n"
+            "           sizes to find the smallest at which it plays without an xrun,\n"
+            "    --stress-interface=NAME  stream to the interface NAME instead, which may be any\n"
+            "           PCM, such as \"null\" -- give it more than once for more than one,\n"
+            "    --stress-duration=S  stream for S seconds at each period size -- the default is 2,\n"
+            "    --stress-load=N  run N threads of synthetic load on the other cores while streaming,\n"
+            "    --stress-priority=P  stream at SCHED_FIFO priority P,\n"
+            "    --refresh-cache  probe every card again and update the probe cache,\n"
+            "    --no-cache    neither use nor update the probe cache,\n"
+            "    --format=F    print the results as \"text\" (the default), \"json\" or \"ndjson\",\n"
+            "    --stats       print statistics about the run, such as its memory use and the time\n"
+            "           spent in each phase of probing, on stderr,\n"
+            "    --trace=FILE  write the time spent on each card, interface and phase of probing to\n"
+            "           FILE in the Chrome trace event format,\n"
+            "    --record=FILE write each call made to ALSA while probing, and what it returned,\n"
+            "           to FILE,\n"
+            "    --replay=FILE probe using the calls recorded in FILE rather than the sound cards,\n"
+            "    --timeout=S   abandon any card or interface that takes more than S seconds to probe,\n"
+            "    --budget=S    abandon any card or interface not probed within S seconds of the\n"
+            "           start,\n"
+            "    --daemon      keep running, keep the results up to date and serve them on a socket,\n"
+            "    --query       print the results held by a running daemon,\n"
+            "    --socket PATH the daemon's socket -- the default is $XDG_RUNTIME_DIR/dacquery.socket,\n"
             "    -V     display the version,\n"
             "    -v     turn on debugging messages -- not for general use,\n"
             "    -h     display this help text.\n");
@@ -1236,14 +3812,272 @@ int main(int argc, char *argv[]) {
         exit(EXIT_SUCCESS);
       } else if (strcmp(argv[i] + 1, "e") == 0) {
         display_extended_information = 1;
+      } else if (strncmp(argv[i] + 1, "j", 1) == 0) {
+        // -j N or -jN
+        char *jobs = argv[i] + 2;
+        if ((*jobs == '\0') && (i + 1 < argc))
+          jobs = argv[++i];
+        char *end = NULL;
+        long value = strtol(jobs, &end, 10);
+        if ((*jobs == '\0') || (*end != '\0') || (value < 1) || (value > 256)) {
+          fprintf(stdout, "%s -- the number of jobs must be from 1 to 256. Program terminated.\n",
+                  argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        probe_jobs = value;
+      } else if (strncmp(argv[i] + 1, "J", 1) == 0) {
+        // -J N or -JN
+        char *jobs = argv[i] + 2;
+        if ((*jobs == '\0') && (i + 1 < argc))
+          jobs = argv[++i];
+        char *end = NULL;
+        long value = strtol(jobs, &end, 10);
+        if ((*jobs == '\0') || (*end != '\0') || (value < 1) || (value > 256)) {
+          fprintf(stdout,
+                  "%s -- the number of interface jobs must be from 1 to 256. Program "
+                  "terminated.\n",
+                  argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        interface_probe_jobs = value;
+      } else if (strcmp(argv[i], "--exhaustive") == 0) {
+        probe_engine = PROBE_ENGINE_EXHAUSTIVE;
+      } else if (strcmp(argv[i], "--verify") == 0) {
+        probe_engine = PROBE_ENGINE_VERIFY;
+      } else if (strcmp(argv[i], "--no-commit") == 0) {
+        probe_without_committing = 1;
+      } else if (strcmp(argv[i], "--infer-subdevices") == 0) {
+        infer_subdevices = 1;
+      } else if (strcmp(argv[i], "--capture") == 0) {
+        probe_capture = 1;
+      } else if (strcmp(argv[i], "--latency") == 0) {
+        report_buffer_limits = 1;
+      } else if (strcmp(argv[i], "--stress") == 0) {
+        stress_interfaces = 1;
+      } else if (strncmp(argv[i], "--stress-interface=", strlen("--stress-interface=")) == 0) {
+        char *name = argv[i] + strlen("--stress-interface=");
+        if (*name == '\0') {
+          fprintf(stdout, "%s -- --stress-interface needs the name of an interface. Program "
+                          "terminated.\n",
+                  argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        char **names =
+            realloc(stress_interface_names, sizeof(char *) * (stress_interface_name_count + 1));
+        if (names == NULL) {
+          fprintf(stdout, "%s -- could not allocate memory. Program terminated.\n", argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        stress_interface_names = names;
+        stress_interface_names[stress_interface_name_count++] = name;
+        stress_interfaces = 1;
+      } else if ((strncmp(argv[i], "--stress-duration=", strlen("--stress-duration=")) == 0) ||
+                 (strncmp(argv[i], "--stress-load=", strlen("--stress-load=")) == 0) ||
+                 (strncmp(argv[i], "--stress-priority=", strlen("--stress-priority=")) == 0)) {
+        char setting = argv[i][strlen("--stress-")];
+        char *number = strchr(argv[i], '=') + 1;
+        char *end = NULL;
+        long value = strtol(number, &end, 10);
+        const char *name = "number of seconds";
+        long lowest = 1, highest = 3600;
+        if (setting == 'l') {
+          name = "number of load threads";
+          lowest = 0;
+          highest = 256;
+        } else if (setting == 'p') {
+          name = "priority";
+          lowest = sched_get_priority_min(SCHED_FIFO);
+          highest = sched_get_priority_max(SCHED_FIFO);
+        }
+        if ((*number == '\0') || (*end != '\0') || (value < lowest) || (value > highest)) {
+          fprintf(stdout, "%s -- the %s must be from %ld to %ld. Program terminated.\n", argv[0],
+                  name, lowest, highest);
+          exit(EXIT_FAILURE);
+        }
+        if (setting == 'l')
+          stress_load_threads = value;
+        else if (setting == 'p')
+          stress_priority = value;
+        else
+          stress_seconds = value;
+      } else if (strcmp(argv[i], "--volume-curves") == 0) {
+        sample_volume_curves = 1;
+      } else if (strcmp(argv[i], "--refresh-cache") == 0) {
+        refresh_probe_cache = 1;
+      } else if (strcmp(argv[i], "--no-cache") == 0) {
+        use_probe_cache = 0;
+      } else if (strcmp(argv[i], "--stats") == 0) {
+        print_statistics = 1;
+      } else if (strncmp(argv[i], "--trace=", strlen("--trace=")) == 0) {
+        trace_path = argv[i] + strlen("--trace=");
+        if (*trace_path == '\0') {
+          fprintf(stdout, "%s -- --trace needs a file name. Program terminated.\n", argv[0]);
+          exit(EXIT_FAILURE);
+        }
+      } else if (strncmp(argv[i], "--record=", strlen("--record=")) == 0) {
+        record_path = argv[i] + strlen("--record=");
+        if (*record_path == '\0') {
+          fprintf(stdout, "%s -- --record needs a file name. Program terminated.\n", argv[0]);
+          exit(EXIT_FAILURE);
+        }
+      } else if (strncmp(argv[i], "--replay=", strlen("--replay=")) == 0) {
+        replay_path = argv[i] + strlen("--replay=");
+        if (*replay_path == '\0') {
+          fprintf(stdout, "%s -- --replay needs a file name. Program terminated.\n", argv[0]);
+          exit(EXIT_FAILURE);
+        }
+      } else if ((strncmp(argv[i], "--timeout=", strlen("--timeout=")) == 0) ||
+                 (strncmp(argv[i], "--budget=", strlen("--budget=")) == 0)) {
+        char *seconds = strchr(argv[i], '=') + 1;
+        char *end = NULL;
+        long value = strtol(seconds, &end, 10);
+        if ((*seconds == '\0') || (*end != '\0') || (value < 0) || (value > 86400)) {
+          fprintf(stdout,
+                  "%s -- the number of seconds must be from 0 to 86400. Program terminated.\n",
+                  argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        if (argv[i][2] == 't')
+          probe_timeout = value;
+        else
+          probe_budget = value;
+      } else if (strncmp(argv[i], "--probe-worker=", strlen("--probe-worker=")) == 0) {
+        worker_interface_name = argv[i] + strlen("--probe-worker=");
+      } else if (strncmp(argv[i], "--format=", strlen("--format=")) == 0) {
+        char *format = argv[i] + strlen("--format=");
+        if (strcmp(format, "text") == 0) {
+          output_format = OUTPUT_FORMAT_TEXT;
+        } else if (strcmp(format, "json") == 0) {
+          output_format = OUTPUT_FORMAT_JSON;
+        } else if (strcmp(format, "ndjson") == 0) {
+          output_format = OUTPUT_FORMAT_NDJSON;
+        } else {
+          fprintf(stdout,
+                  "%s -- the format must be \"text\", \"json\" or \"ndjson\". Program "
+                  "terminated.\n",
+                  argv[0]);
+          exit(EXIT_FAILURE);
+        }
+      } else if (strcmp(argv[i], "--daemon") == 0) {
+        run_as_daemon = 1;
+      } else if (strcmp(argv[i], "--query") == 0) {
+        query_the_daemon = 1;
+      } else if (strcmp(argv[i], "--socket") == 0) {
+        if (i + 1 >= argc) {
+          fprintf(stdout, "%s -- --socket needs a path. Program terminated.\n", argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        socket_path = argv[++i];
       } else {
         fprintf(stdout, "%s -- unknown option. Program terminated.\n", argv[0]);
         exit(EXIT_FAILURE);
       }
     }
   }
+  if ((record_path != NULL) && (replay_path != NULL)) {
+    fprintf(stdout, "%s -- --record and --replay can't be used together. Program terminated.\n",
+            argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  if ((stress_interfaces != 0) && (replay_path != NULL)) {
+    fprintf(stdout, "%s -- --stress and --replay can't be used together. Program terminated.\n",
+            argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  if (stress_interfaces != 0)
+    probe_jobs = 1; // so that one card's streaming doesn't disturb another's
   debug_init(debug_level, 0, 1, 1);
-  check_device_access();
-  return process_cards() ? 1 : 0;
+  if (worker_interface_name != NULL)
+    return run_probe_worker(worker_interface_name);
+  if ((infer_subdevices != 0) && ((probe_timeout != 0) || (probe_budget != 0)) &&
+      (replay_path == NULL)) {
+    // each worker probes a single interface, so it has no other subdevices to compare with
+    warn("--infer-subdevices has no effect with --timeout or --budget.");
+    infer_subdevices = 0;
+  }
+  if ((probe_timeout != 0) || (probe_budget != 0)) {
+    // the workers are this program, run again
+    ssize_t length = readlink("/proc/self/exe", worker_path, sizeof(worker_path) - 1);
+    if (length > 0)
+      worker_path[length] = '\0';
+    else
+      snprintf(worker_path, sizeof(worker_path), "%s", argv[0]);
+  }
+  if ((run_as_daemon != 0) || (query_the_daemon != 0)) {
+    char *default_path = NULL;
+    if (socket_path == NULL) {
+      default_path = default_socket_path();
+      socket_path = default_path;
+    }
+    int result = 1;
+    if (socket_path == NULL) {
+      warn("no path for the daemon's socket.");
+    } else if (query_the_daemon != 0) {
+      result = query_daemon(socket_path, "report");
+    } else {
+      check_device_access();
+      output_format = OUTPUT_FORMAT_TEXT; // the daemon serves the text report
+      result = run_daemon(socket_path);
+    }
+    if (default_path != NULL)
+      free(default_path);
+    return result;
+  }
+  if (replay_path != NULL) {
+    // the recording stands in for the sound cards, so they aren't needed
+    backend = replay_backend_open(replay_path);
+    if (backend == NULL) {
+      warn("could not read the recording \"%s\": \"%s\".", replay_path, strerror(errno));
+      return 1;
+    }
+    use_probe_cache = 0;
+  } else {
+    check_device_access();
+    if (record_path != NULL) {
+      backend = recording_backend_open(&alsa_backend, record_path);
+      if (backend == NULL) {
+        warn("could not open the recording \"%s\": \"%s\".", record_path, strerror(errno));
+        return 1;
+      }
+      use_probe_cache = 0; // everything must be probed for it to be recorded
+    }
+  }
+  if (print_statistics != 0)
+    trace_keep_statistics();
+  if (trace_path != NULL) {
+    int trace_result = trace_open(trace_path);
+    if (trace_result != 0) {
+      warn("could not open the trace file \"%s\": \"%s\".", trace_path, strerror(-trace_result));
+      return 1;
+    }
+  }
+  int result = process_cards();
+  trace_close();
+  if (record_path != NULL) {
+    if (recording_backend_close() != 0) {
+      warn("could not finish writing the recording \"%s\": \"%s\".", record_path,
+           strerror(errno));
+      result = 1;
+    }
+  } else if (replay_path != NULL) {
+    unsigned int divergences = replay_backend_divergences();
+    replay_backend_close();
+    if (divergences != 0) {
+      warn("the replay diverged from the recording on %u interface%s.", divergences,
+           divergences == 1 ? "" : "s");
+      result = 1;
+    }
+  }
+  if (print_statistics != 0)
+    print_run_statistics(stderr);
+  if (probe_mismatches != 0) {
+    warn("the refined and exhaustive probes disagreed on %u interface%s.", probe_mismatches,
+         probe_mismatches == 1 ? "" : "s");
+    result = 1;
+  }
+  if (probe_timeouts != 0)
+    warn("%u interface%s could not be probed in the time allowed.", probe_timeouts,
+         probe_timeouts == 1 ? "" : "s");
+  return result ? 1 : 0;
   // result = check_device_access();
 }
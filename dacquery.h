@@ -23,3 +23,187 @@
  * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
  * OTHER DEALINGS IN THE SOFTWARE.
  */
+
+#ifndef _DACQUERY_H
+#define _DACQUERY_H
+
+#include "arena.h"
+#include "bitset.h"
+#include "json_writer.h"
+#include <alsa/asoundlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define VOLUME_CURVE_POINTS 32
+
+// how a mixer's volume maps to dB, when it has been sampled
+typedef enum {
+  VOLUME_CURVE_NONE = 0,    // not sampled, or it couldn't be
+  VOLUME_CURVE_LINEAR,      // a straight line between two points
+  VOLUME_CURVE_PIECEWISE,   // straight lines between more than two points
+  VOLUME_CURVE_APPROXIMATE, // straight lines that are within volume_curve_error of the curve
+} volume_curve_t;
+
+typedef struct {
+  long volume;
+  long decibels; // in hundredths of a dB
+} volume_point;
+
+typedef struct {
+  char name[64];
+  unsigned int index;
+  long minv, maxv, mindecibels, maxdecibels; // the min values are for non-muting
+  int has_a_decibel_range;
+  int lowest_value_is_mute;
+  int capture; // non-zero if the volume is a capture volume rather than a playback one
+  volume_curve_t volume_curve;
+  long volume_curve_error; // the most a point on the lines is off the curve, in hundredths of a dB
+  unsigned int volume_point_count;
+  volume_point volume_points[VOLUME_CURVE_POINTS]; // from the lowest non-muting volume up
+} mixer_info_t;
+
+typedef struct {
+  mixer_info_t *mixer; // an array allocated from the arena below
+  size_t size;         // the number of mixers there is room for
+  size_t first_free;   // the number of mixers found
+  arena *arena;
+} mixer_bundle_t;
+
+#define MAXIMUM_RATES 32 // the most rates there can be in the list of rates to check
+
+// the range of period and buffer sizes, in frames, and of the number of periods, that a
+// configuration space allows -- all zero if they weren't asked for
+typedef struct {
+  unsigned int period_size_min, period_size_max;
+  unsigned int buffer_size_min, buffer_size_max;
+  unsigned int periods_min, periods_max;
+} buffer_limits;
+
+typedef struct {
+  bitset rate_set;    // by position in the list of rates to check
+  bitset format_set;  // by snd_pcm_format_t value
+  bitset channel_set; // by channel count
+  uint16_t channel_maps[BITSET_SIZE]; // for each channel count, the number of its channel map
+  uint16_t limits[MAXIMUM_RATES]; // for each rate, the number of its buffer limits -- the widest
+                                  // over the set's formats and channel counts
+} configuration_set;
+
+// A channel map's type is SND_CHMAP_TYPE_VAR if its channels can be rearranged freely, or
+// SND_CHMAP_TYPE_PAIRED if they can be rearranged in pairs; otherwise it is SND_CHMAP_TYPE_NONE,
+// since a map read from a committed configuration is simply the one in use.
+uint16_t intern_channel_map(const char *channel_map, int type);
+const char *channel_map_name(uint16_t channel_map);
+int channel_map_type(uint16_t channel_map);
+uint16_t intern_buffer_limits(const buffer_limits *limits);
+// copy out the buffer limits with the number -- all zero if it is 0 or unknown
+void get_buffer_limits(uint16_t number, buffer_limits *limits);
+
+// the hardware PCM behind an interface, and the bounds of the configuration space it offers
+typedef struct {
+  int valid;
+  snd_pcm_type_t type; // the outermost plugin, or SND_PCM_TYPE_HW
+  int card;
+  int device;
+  int subdevice;
+  unsigned int channels_min, channels_max;
+  unsigned int rate_min, rate_max;
+  bitset format_set;
+  uint64_t space_fingerprint; // of the rates and formats at each channel count, if taken
+} pcm_signature;
+
+typedef struct {
+  configuration_set *configuration_sets; // an array allocated from the arena below
+  size_t configuration_sets_count; // the size of the array. Not all the elements will be valid!
+  size_t configuration_sets_allocated; // the number of elements there is room for
+  arena *arena;                        // where the array comes from
+  int error_status;
+  int already_handled;
+  char interface_name[128];
+  char device_name[64];
+  char subdevice_name[64];
+  unsigned int card_number;
+  unsigned int device_number;
+  unsigned int subdevice_number;
+  pcm_signature signature; // of the PCM that was opened, if it was
+  char alias_of[128];      // the interface whose results were reused, if any
+  char inferred_from[128]; // the interface on another subdevice whose results were used, if any
+} configuration_bundle;
+
+// what was found on a device of a card when it was enumerated
+typedef struct {
+  int number;
+  char name[64];
+  char id[64];
+  int info_available;       // zero if the device's information could not be read
+  int subdevices_available; // zero if the count was not available -- the device may be busy
+} card_device;
+
+// an interface to be probed, e.g. "hdmi:CARD=Generic,DEV=3"
+typedef struct {
+  char interface_name[128];
+  size_t device_index; // the card_device it was enumerated under
+  int subdevice;
+  char subdevice_name[64];
+  snd_pcm_stream_t stream; // capture interfaces come after all the playback ones
+  configuration_bundle *configuration; // the result of the probe
+} interface_probe;
+
+
+typedef enum { OUTPUT_FORMAT_TEXT = 0, OUTPUT_FORMAT_JSON, OUTPUT_FORMAT_NDJSON } output_format_t;
+
+extern output_format_t output_format;
+extern int probe_capture;            // non-zero if capture streams and mixers are probed too
+extern int report_buffer_limits;     // non-zero if the period and buffer size limits are read
+extern int probe_without_committing; // non-zero if support is decided without committing
+extern int infer_subdevices;         // non-zero if subdevices' results may be inferred
+
+// everything found on a card -- what is printed for it, and what is kept in the probe cache
+typedef struct {
+  int card_number;
+  char control_interface_name[64]; // e.g. "hw:CARD=Generic"
+  char driver[32];
+  char name[80];
+  char longname[128];
+  char components[128];
+  arena *arena;          // owns the arrays below and the configuration bundles of the probes
+  card_device *devices; // an array allocated from the arena
+  size_t device_count;
+  interface_probe *probes; // an array allocated from the arena, in the order they are printed
+  size_t probe_count;
+  int mixer_status; // the result of looking for mixers
+  mixer_bundle_t mixers;
+  int from_cache; // non-zero if what is known about the card came from the probe cache
+  int arena_shared; // non-zero if an abandoned call may still be using the arena, so it's kept
+} card_probe;
+
+// the state used while probing -- each worker thread has its own
+typedef struct {
+  snd_pcm_t *alsa_handle;
+  snd_pcm_hw_params_t *alsa_params;
+  unsigned int probe_mismatches; // the number of interfaces on which the probe engines disagreed
+  unsigned int probe_timeouts;   // the number of interfaces abandoned because they took too long
+  json_writer writer;            // for records in the machine-readable formats
+} probe_context;
+
+int probe_context_init(probe_context *context);
+void probe_context_free(probe_context *context);
+
+size_t get_control_interface_names(char ***control_interface_names);
+void free_control_interface_names(char **control_interface_names, size_t count);
+
+void open_card_cache(void);
+void close_card_cache(void);
+
+// build_card_model() finds the card's devices and interfaces without opening any of them, and
+// probe_card_model() probes them; probe_card() does both
+int build_card_model(const char *control_interface_name, card_probe *card, int use_cached_results);
+void probe_card_model(probe_context *context, card_probe *card);
+int probe_card(const char *control_interface_name, probe_context *context, card_probe *card,
+               int use_cached_results);
+void card_probe_free(card_probe *card);
+
+void print_report_header(FILE *output, unsigned int card_count);
+void print_card(card_probe *card, FILE *output);
+
+#endif // _DACQUERY_H
@@ -0,0 +1,622 @@
+/*
+ * Copyright (c) Mike Brady 2024
+ * All rights reserved.
+ * Mike Brady <4265913+mikebrady@users.noreply.github.com>
+
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "daemon.h"
+#include "dacquery.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// The protocol: a client connects, sends a one-line request and reads the response until the
+// daemon closes the connection. The requests are:
+//   "report" (or an empty line) -- everything, just as dacquery would print it,
+//   "card N" -- the part of the report for card N.
+
+#define SETTLE_TIME_MS 200 // wait for a burst of events to finish before probing again
+
+typedef struct {
+  char *control_interface_name;
+  snd_ctl_t *events; // the card's control interface, subscribed to events; NULL if it's gone
+  card_probe card;
+  int probed;             // non-zero if card holds a valid model of the card
+  int needs_probe;        // non-zero if the card has changed or has not been probed yet
+  int use_cached_results; // non-zero if the probe cache may be used for it
+} daemon_card;
+
+typedef struct {
+  pthread_mutex_t lock; // for everything below
+  pthread_cond_t work_to_do;
+  daemon_card *cards; // in card order; only the event loop changes the array itself
+  size_t card_count;
+  char *report; // the current model, rendered as dacquery would print it
+  size_t report_size;
+  int stopping;
+} daemon_state;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(__attribute__((unused)) int signal_number) { stop_requested = 1; }
+
+char *default_socket_path(void) {
+  char *path = NULL;
+  const char *runtime_directory = getenv("XDG_RUNTIME_DIR");
+  size_t size;
+  if ((runtime_directory != NULL) && (runtime_directory[0] != '\0')) {
+    size = strlen(runtime_directory) + sizeof("/dacquery.socket");
+    path = malloc(size);
+    if (path != NULL)
+      snprintf(path, size, "%s/dacquery.socket", runtime_directory);
+  } else {
+    size = sizeof("/tmp/dacquery-.socket") + 12;
+    path = malloc(size);
+    if (path != NULL)
+      snprintf(path, size, "/tmp/dacquery-%u.socket", (unsigned int)getuid());
+  }
+  return path;
+}
+
+static int make_socket_address(const char *socket_path, struct sockaddr_un *address) {
+  memset(address, 0, sizeof(struct sockaddr_un));
+  address->sun_family = AF_UNIX;
+  if (strlen(socket_path) >= sizeof(address->sun_path))
+    return -ENAMETOOLONG;
+  strcpy(address->sun_path, socket_path);
+  return 0;
+}
+
+// render the report of all the probed cards -- the lock must be held
+static void render_report(daemon_state *state) {
+  char *report = NULL;
+  size_t report_size = 0;
+  FILE *output = open_memstream(&report, &report_size);
+  if (output != NULL) {
+    print_report_header(output, state->card_count);
+    size_t ci;
+    for (ci = 0; ci < state->card_count; ci++)
+      if (state->cards[ci].probed != 0)
+        print_card(&state->cards[ci].card, output);
+    fclose(output);
+    if (state->report != NULL)
+      free(state->report);
+    state->report = report;
+    state->report_size = report_size;
+  } else {
+    debug(1, "could not render the report");
+  }
+}
+
+static void free_daemon_card(daemon_card *card) {
+  if (card->events != NULL)
+    snd_ctl_close(card->events);
+  card->events = NULL;
+  if (card->probed != 0)
+    card_probe_free(&card->card);
+  card->probed = 0;
+  free(card->control_interface_name);
+}
+
+static void open_card_events(daemon_card *card) {
+  int err = snd_ctl_open(&card->events, card->control_interface_name, SND_CTL_NONBLOCK);
+  if (err == 0) {
+    err = snd_ctl_subscribe_events(card->events, 1);
+    if (err != 0) {
+      debug(1, "could not subscribe to events on \"%s\": %s.", card->control_interface_name,
+            snd_strerror(err));
+      snd_ctl_close(card->events);
+      card->events = NULL;
+    }
+  } else {
+    debug(1, "could not open \"%s\" for events: %s.", card->control_interface_name,
+          snd_strerror(err));
+    card->events = NULL;
+  }
+}
+
+// bring the list of cards up to date, keeping what is known about cards that are still present
+static void rescan_cards(daemon_state *state) {
+  char **names;
+  size_t name_count = get_control_interface_names(&names);
+  daemon_card *cards = calloc(name_count + 1, sizeof(daemon_card));
+  if (cards == NULL) {
+    debug(1, "could not allocate memory for the list of cards");
+    free_control_interface_names(names, name_count);
+    return;
+  }
+  pthread_mutex_lock(&state->lock);
+  size_t ni, ci;
+  for (ni = 0; ni < name_count; ni++) {
+    for (ci = 0; ci < state->card_count; ci++) {
+      if ((state->cards[ci].control_interface_name != NULL) &&
+          (state->cards[ci].events != NULL) &&
+          (strcmp(state->cards[ci].control_interface_name, names[ni]) == 0))
+        break;
+    }
+    if (ci < state->card_count) {
+      cards[ni] = state->cards[ci];
+      state->cards[ci].control_interface_name = NULL; // it has been moved
+      free(names[ni]);
+    } else {
+      debug(1, "card \"%s\" has appeared.", names[ni]);
+      cards[ni].control_interface_name = names[ni];
+      cards[ni].needs_probe = 1;
+      cards[ni].use_cached_results = 1;
+      open_card_events(&cards[ni]);
+    }
+  }
+  for (ci = 0; ci < state->card_count; ci++) {
+    if (state->cards[ci].control_interface_name != NULL) {
+      debug(1, "card \"%s\" has gone.", state->cards[ci].control_interface_name);
+      free_daemon_card(&state->cards[ci]);
+    }
+  }
+  free(names); // the names themselves now belong to the cards
+  if (state->cards != NULL)
+    free(state->cards);
+  state->cards = cards;
+  state->card_count = name_count;
+  render_report(state);
+  pthread_cond_signal(&state->work_to_do);
+  pthread_mutex_unlock(&state->lock);
+}
+
+// probe the cards that need it, one at a time, without holding the lock while probing
+static void probe_changed_cards(daemon_state *state, probe_context *context) {
+  int finished = 0;
+  int cache_changed = 0;
+  while (finished == 0) {
+    char *control_interface_name = NULL;
+    int use_cached_results = 0;
+    pthread_mutex_lock(&state->lock);
+    size_t ci;
+    for (ci = 0; (ci < state->card_count) && (control_interface_name == NULL); ci++) {
+      if (state->cards[ci].needs_probe != 0) {
+        state->cards[ci].needs_probe = 0;
+        control_interface_name = strdup(state->cards[ci].control_interface_name);
+        use_cached_results = state->cards[ci].use_cached_results;
+        state->cards[ci].use_cached_results = 0;
+      }
+    }
+    pthread_mutex_unlock(&state->lock);
+    if (control_interface_name != NULL) {
+      debug(1, "probing \"%s\".", control_interface_name);
+      card_probe card;
+      int err = probe_card(control_interface_name, context, &card, use_cached_results);
+      cache_changed = 1;
+      pthread_mutex_lock(&state->lock);
+      // the card may have gone while it was being probed
+      for (ci = 0; ci < state->card_count; ci++)
+        if (strcmp(state->cards[ci].control_interface_name, control_interface_name) == 0)
+          break;
+      if ((ci < state->card_count) && (err == 0)) {
+        if (state->cards[ci].probed != 0)
+          card_probe_free(&state->cards[ci].card);
+        state->cards[ci].card = card;
+        state->cards[ci].probed = 1;
+        render_report(state);
+      } else {
+        card_probe_free(&card);
+      }
+      pthread_mutex_unlock(&state->lock);
+      free(control_interface_name);
+    } else {
+      finished = 1;
+    }
+  }
+  if (cache_changed != 0) {
+    // write out what has been found and start again from the file
+    close_card_cache();
+    open_card_cache();
+  }
+}
+
+static void *prober(void *arg) {
+  daemon_state *state = (daemon_state *)arg;
+  probe_context context;
+  if (probe_context_init(&context) != 0) {
+    debug(1, "could not allocate a probe context for the daemon");
+    return NULL;
+  }
+  pthread_mutex_lock(&state->lock);
+  while (state->stopping == 0) {
+    size_t ci;
+    int work = 0;
+    for (ci = 0; ci < state->card_count; ci++)
+      if (state->cards[ci].needs_probe != 0)
+        work = 1;
+    if (work == 0) {
+      pthread_cond_wait(&state->work_to_do, &state->lock);
+    } else {
+      pthread_mutex_unlock(&state->lock);
+      struct timespec settle_time = {0, SETTLE_TIME_MS * 1000000};
+      nanosleep(&settle_time, NULL);
+      probe_changed_cards(state, &context);
+      pthread_mutex_lock(&state->lock);
+    }
+  }
+  pthread_mutex_unlock(&state->lock);
+  probe_context_free(&context);
+  return NULL;
+}
+
+static void mark_card_changed(daemon_state *state, daemon_card *card) {
+  pthread_mutex_lock(&state->lock);
+  card->needs_probe = 1;
+  pthread_cond_signal(&state->work_to_do);
+  pthread_mutex_unlock(&state->lock);
+}
+
+// Element values change all the time -- volume controls, for example -- without the card's
+// capabilities changing, so only value changes on card- and PCM-level elements, such as jacks
+// and HDMI ELDs, count. Any change to the elements themselves counts.
+static int event_is_significant(snd_ctl_event_t *event) {
+  if (snd_ctl_event_get_type(event) != SND_CTL_EVENT_ELEM)
+    return 0;
+  unsigned int mask = snd_ctl_event_elem_get_mask(event);
+  if (mask == SND_CTL_EVENT_MASK_REMOVE)
+    return 1;
+  if ((mask & (SND_CTL_EVENT_MASK_INFO | SND_CTL_EVENT_MASK_ADD | SND_CTL_EVENT_MASK_TLV)) != 0)
+    return 1;
+  if ((mask & SND_CTL_EVENT_MASK_VALUE) != 0) {
+    snd_ctl_elem_iface_t interface = snd_ctl_event_elem_get_interface(event);
+    if ((interface == SND_CTL_ELEM_IFACE_CARD) || (interface == SND_CTL_ELEM_IFACE_PCM))
+      return 1;
+  }
+  return 0;
+}
+
+// returns non-zero if the card has gone and the cards should be rescanned
+static int read_card_events(daemon_state *state, daemon_card *card, struct pollfd *descriptors,
+                            unsigned int descriptor_count) {
+  unsigned short revents = 0;
+  snd_ctl_poll_descriptors_revents(card->events, descriptors, descriptor_count, &revents);
+  if ((revents & (POLLERR | POLLHUP | POLLNVAL)) != 0) {
+    snd_ctl_close(card->events);
+    card->events = NULL;
+    return 1;
+  }
+  if ((revents & POLLIN) != 0) {
+    snd_ctl_event_t *event;
+    snd_ctl_event_alloca(&event);
+    int significant = 0;
+    int err;
+    while ((err = snd_ctl_read(card->events, event)) > 0)
+      if (event_is_significant(event))
+        significant = 1;
+    if (err == -ENODEV) {
+      snd_ctl_close(card->events);
+      card->events = NULL;
+      return 1;
+    }
+    if (significant != 0) {
+      debug(2, "\"%s\" has changed.", card->control_interface_name);
+      mark_card_changed(state, card);
+    }
+  }
+  return 0;
+}
+
+// returns non-zero if the cards should be rescanned
+static int read_device_events(daemon_state *state, int inotify_fd) {
+  int rescan = 0;
+  char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t length;
+  while ((length = read(inotify_fd, buffer, sizeof(buffer))) > 0) {
+    char *p = buffer;
+    while (p < buffer + length) {
+      struct inotify_event *event = (struct inotify_event *)p;
+      if (event->len != 0) {
+        unsigned int card_number;
+        if (strncmp(event->name, "controlC", strlen("controlC")) == 0) {
+          rescan = 1;
+        } else if (sscanf(event->name, "pcmC%u", &card_number) == 1) {
+          // a PCM device node has appeared, gone or had its permissions changed
+          pthread_mutex_lock(&state->lock);
+          size_t ci;
+          for (ci = 0; ci < state->card_count; ci++) {
+            if ((state->cards[ci].probed != 0) &&
+                (state->cards[ci].card.card_number == (int)card_number)) {
+              state->cards[ci].needs_probe = 1;
+              pthread_cond_signal(&state->work_to_do);
+            }
+          }
+          pthread_mutex_unlock(&state->lock);
+        }
+      }
+      p += sizeof(struct inotify_event) + event->len;
+    }
+  }
+  return rescan;
+}
+
+static void serve_client(daemon_state *state, int client) {
+  struct timeval timeout = {0, 100000};
+  setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  timeout.tv_sec = 1;
+  timeout.tv_usec = 0;
+  setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  char request[256];
+  size_t request_length = 0;
+  ssize_t received;
+  while ((request_length < sizeof(request) - 1) &&
+         ((received = recv(client, request + request_length, sizeof(request) - 1 - request_length,
+                           0)) > 0)) {
+    request_length += received;
+    if (memchr(request, '\n', request_length) != NULL)
+      break;
+  }
+  request[request_length] = '\0';
+  request[strcspn(request, "\r\n")] = '\0';
+  debug(2, "request: \"%s\".", request);
+
+  char *response = NULL;
+  size_t response_size = 0;
+  unsigned int card_number;
+  pthread_mutex_lock(&state->lock);
+  if ((request[0] == '\0') || (strcmp(request, "report") == 0)) {
+    response = state->report;
+    response_size = state->report_size;
+  } else if (sscanf(request, "card %u", &card_number) == 1) {
+    FILE *output = open_memstream(&response, &response_size);
+    if (output != NULL) {
+      size_t ci;
+      for (ci = 0; ci < state->card_count; ci++)
+        if ((state->cards[ci].probed != 0) &&
+            (state->cards[ci].card.card_number == (int)card_number))
+          print_card(&state->cards[ci].card, output);
+      fclose(output);
+    }
+  } else {
+    FILE *output = open_memstream(&response, &response_size);
+    if (output != NULL) {
+      fprintf(output, "error: unknown request \"%s\".\n", request);
+      fclose(output);
+    }
+  }
+  size_t sent = 0;
+  ssize_t result;
+  while ((response != NULL) && (sent < response_size) &&
+         ((result = send(client, response + sent, response_size - sent, MSG_NOSIGNAL)) > 0))
+    sent += result;
+  if ((response != NULL) && (response != state->report))
+    free(response);
+  pthread_mutex_unlock(&state->lock);
+}
+
+static int open_listening_socket(const char *socket_path) {
+  struct sockaddr_un address;
+  if (make_socket_address(socket_path, &address) != 0) {
+    warn("the socket path \"%s\" is too long.", socket_path);
+    return -1;
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    warn("could not create a socket: %s.", strerror(errno));
+    return -1;
+  }
+  if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+    if (errno == EADDRINUSE) {
+      // if nothing is listening on it, it's left over from before
+      int probe_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      int in_use = (probe_fd >= 0) &&
+                   (connect(probe_fd, (struct sockaddr *)&address, sizeof(address)) == 0);
+      if (probe_fd >= 0)
+        close(probe_fd);
+      if (in_use == 0) {
+        unlink(socket_path);
+        if (bind(fd, (struct sockaddr *)&address, sizeof(address)) == 0)
+          errno = 0;
+      } else {
+        errno = EADDRINUSE;
+      }
+    }
+    if (errno != 0) {
+      warn("could not use the socket \"%s\": %s.", socket_path, strerror(errno));
+      close(fd);
+      return -1;
+    }
+  }
+  if (listen(fd, 16) != 0) {
+    warn("could not listen on the socket \"%s\": %s.", socket_path, strerror(errno));
+    close(fd);
+    unlink(socket_path);
+    return -1;
+  }
+  return fd;
+}
+
+int run_daemon(const char *socket_path) {
+  int listen_fd = open_listening_socket(socket_path);
+  if (listen_fd < 0)
+    return 1;
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = request_stop; // no SA_RESTART, so that poll() is interrupted
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  int inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd >= 0) {
+    if (inotify_add_watch(inotify_fd, "/dev/snd", IN_CREATE | IN_DELETE | IN_ATTRIB) < 0) {
+      debug(1, "can't watch \"/dev/snd\": %s.", strerror(errno));
+      close(inotify_fd);
+      inotify_fd = -1;
+    }
+  }
+
+  daemon_state state;
+  memset(&state, 0, sizeof(state));
+  pthread_mutex_init(&state.lock, NULL);
+  pthread_cond_init(&state.work_to_do, NULL);
+
+  // the first probe is done before any requests are answered; requests wait until it's done
+  open_card_cache();
+  rescan_cards(&state);
+  {
+    probe_context context;
+    if (probe_context_init(&context) == 0) {
+      probe_changed_cards(&state, &context);
+      probe_context_free(&context);
+    }
+  }
+  inform("dacquery is listening on \"%s\".", socket_path);
+
+  pthread_t prober_thread;
+  int prober_running = (pthread_create(&prober_thread, NULL, prober, &state) == 0);
+  if (prober_running == 0)
+    warn("could not start the prober thread -- changes will not be picked up.");
+
+  struct pollfd *descriptors = NULL;
+  size_t descriptors_allocated = 0;
+  while (stop_requested == 0) {
+    // the listening socket and inotify come first, then the descriptors of each card in turn
+    size_t needed = 2;
+    size_t ci;
+    for (ci = 0; ci < state.card_count; ci++)
+      if (state.cards[ci].events != NULL)
+        needed += snd_ctl_poll_descriptors_count(state.cards[ci].events);
+    if (needed > descriptors_allocated) {
+      struct pollfd *new_descriptors = realloc(descriptors, sizeof(struct pollfd) * needed);
+      if (new_descriptors == NULL) {
+        warn("could not allocate memory for the daemon's descriptors.");
+        break;
+      }
+      descriptors = new_descriptors;
+      descriptors_allocated = needed;
+    }
+    descriptors[0].fd = listen_fd;
+    descriptors[0].events = POLLIN;
+    descriptors[1].fd = inotify_fd; // ignored by poll() if negative
+    descriptors[1].events = POLLIN;
+    size_t descriptor_count = 2;
+    for (ci = 0; ci < state.card_count; ci++)
+      if (state.cards[ci].events != NULL)
+        descriptor_count += snd_ctl_poll_descriptors(state.cards[ci].events,
+                                                     descriptors + descriptor_count,
+                                                     needed - descriptor_count);
+
+    if (poll(descriptors, descriptor_count, -1) < 0) {
+      if (errno != EINTR)
+        debug(1, "poll error: %s.", strerror(errno));
+      continue;
+    }
+
+    if ((descriptors[0].revents & POLLIN) != 0) {
+      int client = accept(listen_fd, NULL, NULL);
+      if (client >= 0) {
+        serve_client(&state, client);
+        close(client);
+      }
+    }
+    int rescan = 0;
+    if ((inotify_fd >= 0) && ((descriptors[1].revents & POLLIN) != 0))
+      rescan |= read_device_events(&state, inotify_fd);
+    size_t first_descriptor = 2;
+    for (ci = 0; ci < state.card_count; ci++) {
+      if (state.cards[ci].events != NULL) {
+        unsigned int count = snd_ctl_poll_descriptors_count(state.cards[ci].events);
+        rescan |= read_card_events(&state, &state.cards[ci], descriptors + first_descriptor, count);
+        first_descriptor += count;
+      }
+    }
+    if (rescan != 0)
+      rescan_cards(&state);
+  }
+  inform("dacquery is stopping.");
+
+  if (prober_running != 0) {
+    pthread_mutex_lock(&state.lock);
+    state.stopping = 1;
+    pthread_cond_signal(&state.work_to_do);
+    pthread_mutex_unlock(&state.lock);
+    pthread_join(prober_thread, NULL);
+  }
+  close(listen_fd);
+  unlink(socket_path);
+  if (inotify_fd >= 0)
+    close(inotify_fd);
+  if (descriptors != NULL)
+    free(descriptors);
+  size_t ci;
+  for (ci = 0; ci < state.card_count; ci++)
+    free_daemon_card(&state.cards[ci]);
+  if (state.cards != NULL)
+    free(state.cards);
+  if (state.report != NULL)
+    free(state.report);
+  close_card_cache();
+  pthread_cond_destroy(&state.work_to_do);
+  pthread_mutex_destroy(&state.lock);
+  return 0;
+}
+
+int query_daemon(const char *socket_path, const char *request) {
+  struct sockaddr_un address;
+  if (make_socket_address(socket_path, &address) != 0) {
+    warn("the socket path \"%s\" is too long.", socket_path);
+    return 1;
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    warn("could not create a socket: %s.", strerror(errno));
+    return 1;
+  }
+  if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+    warn("could not connect to the dacquery daemon at \"%s\": %s.", socket_path,
+         strerror(errno));
+    close(fd);
+    return 1;
+  }
+  int result = 0;
+  size_t request_length = strlen(request);
+  if ((send(fd, request, request_length, MSG_NOSIGNAL) != (ssize_t)request_length) ||
+      (send(fd, "\n", 1, MSG_NOSIGNAL) != 1)) {
+    warn("could not send a request to the dacquery daemon: %s.", strerror(errno));
+    result = 1;
+  } else {
+    char buffer[4096];
+    ssize_t received;
+    while ((received = recv(fd, buffer, sizeof(buffer), 0)) > 0)
+      fwrite(buffer, 1, received, stdout);
+    if (received < 0) {
+      warn("error reading from the dacquery daemon: %s.", strerror(errno));
+      result = 1;
+    }
+  }
+  close(fd);
+  return result;
+}
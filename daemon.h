@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) Mike Brady 2024
+ * All rights reserved.
+ * Mike Brady <4265913+mikebrady@users.noreply.github.com>
+
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// In daemon mode, dacquery probes every card once and then keeps its model of the cards up to
+// date, probing a card again only when its control events or the device nodes in /dev/snd show
+// that it has changed. Clients ask for the current model over a Unix domain socket.
+
+#ifndef _DAEMON_H
+#define _DAEMON_H
+
+// return the socket to use if none is given: $XDG_RUNTIME_DIR/dacquery.socket if
+// XDG_RUNTIME_DIR is set, /tmp/dacquery-<uid>.socket otherwise. Free the result.
+char *default_socket_path(void);
+
+// run until SIGINT or SIGTERM; returns non-zero if the daemon could not be started.
+int run_daemon(const char *socket_path);
+
+// send the request to the daemon and copy its response to stdout
+int query_daemon(const char *socket_path, const char *request);
+
+#endif // _DAEMON_H
@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) Mike Brady 2024
+ * All rights reserved.
+ * Mike Brady <4265913+mikebrady@users.noreply.github.com>
+
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "json_writer.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+static FILE *json_output = NULL;
+static int json_newline_delimited = 0;
+static int json_records_written = 0;
+static pthread_mutex_t json_output_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void json_writer_free(json_writer *writer) {
+  if (writer->buffer != NULL)
+    free(writer->buffer);
+  memset(writer, 0, sizeof(json_writer));
+}
+
+// make room for another extra characters and a terminating NUL
+static int json_reserve(json_writer *writer, size_t extra) {
+  if (writer->failed != 0)
+    return -1;
+  if (writer->length + extra + 1 > writer->size) {
+    size_t new_size = writer->size == 0 ? 4096 : writer->size;
+    while (writer->length + extra + 1 > new_size)
+      new_size *= 2;
+    char *new_buffer = realloc(writer->buffer, new_size);
+    if (new_buffer == NULL) {
+      writer->failed = 1;
+      return -1;
+    }
+    writer->buffer = new_buffer;
+    writer->size = new_size;
+  }
+  return 0;
+}
+
+static void json_append(json_writer *writer, const char *text, size_t length) {
+  if (json_reserve(writer, length) == 0) {
+    memcpy(writer->buffer + writer->length, text, length);
+    writer->length += length;
+    writer->buffer[writer->length] = '\0';
+  }
+}
+
+static void json_append_quoted(json_writer *writer, const char *text) {
+  json_append(writer, "\"", 1);
+  const char *run = text; // a run of characters that need no escaping
+  const char *p;
+  for (p = text; *p != '\0'; p++) {
+    unsigned char c = *p;
+    if ((c == '"') || (c == '\\') || (c < 0x20)) {
+      json_append(writer, run, p - run);
+      char escape[8];
+      if (c == '"')
+        json_append(writer, "\\\"", 2);
+      else if (c == '\\')
+        json_append(writer, "\\\\", 2);
+      else if (c == '\n')
+        json_append(writer, "\\n", 2);
+      else if (c == '\t')
+        json_append(writer, "\\t", 2);
+      else
+        json_append(writer, escape, snprintf(escape, sizeof(escape), "\\u%04x", c));
+      run = p + 1;
+    }
+  }
+  json_append(writer, run, p - run);
+  json_append(writer, "\"", 1);
+}
+
+// write the separator, if needed, and the key, if there is one
+static void json_begin_value(json_writer *writer, const char *key) {
+  uint64_t bit = (uint64_t)1 << (writer->depth & 63);
+  if ((writer->first_at_depth & bit) == 0)
+    json_append(writer, ",", 1);
+  writer->first_at_depth &= ~bit;
+  if (key != NULL) {
+    json_append_quoted(writer, key);
+    json_append(writer, ":", 1);
+  }
+}
+
+static void json_open(json_writer *writer, const char *key, const char *bracket) {
+  json_begin_value(writer, key);
+  json_append(writer, bracket, 1);
+  writer->depth++;
+  writer->first_at_depth |= (uint64_t)1 << (writer->depth & 63);
+}
+
+static void json_close(json_writer *writer, const char *bracket) {
+  if (writer->depth != 0)
+    writer->depth--;
+  json_append(writer, bracket, 1);
+}
+
+void json_record_begin(json_writer *writer) {
+  writer->length = 0;
+  writer->depth = 0;
+  writer->first_at_depth = 1;
+  writer->failed = 0;
+  json_open(writer, NULL, "{");
+}
+
+void json_record_end(json_writer *writer) { json_close(writer, "}"); }
+
+void json_object_begin(json_writer *writer, const char *key) { json_open(writer, key, "{"); }
+
+void json_object_end(json_writer *writer) { json_close(writer, "}"); }
+
+void json_array_begin(json_writer *writer, const char *key) { json_open(writer, key, "["); }
+
+void json_array_end(json_writer *writer) { json_close(writer, "]"); }
+
+void json_string(json_writer *writer, const char *key, const char *value) {
+  json_begin_value(writer, key);
+  json_append_quoted(writer, value);
+}
+
+void json_integer(json_writer *writer, const char *key, long long value) {
+  char text[32];
+  json_begin_value(writer, key);
+  json_append(writer, text, snprintf(text, sizeof(text), "%lld", value));
+}
+
+void json_number(json_writer *writer, const char *key, double value) {
+  char text[32];
+  json_begin_value(writer, key);
+  json_append(writer, text, snprintf(text, sizeof(text), "%.2f", value));
+}
+
+void json_boolean(json_writer *writer, const char *key, int value) {
+  json_begin_value(writer, key);
+  if (value != 0)
+    json_append(writer, "true", 4);
+  else
+    json_append(writer, "false", 5);
+}
+
+void json_output_begin(FILE *output, int newline_delimited) {
+  json_output = output;
+  json_newline_delimited = newline_delimited;
+  json_records_written = 0;
+  if (newline_delimited == 0)
+    fprintf(json_output, "[");
+}
+
+void json_output_record(json_writer *writer) {
+  if ((json_output != NULL) && (writer->failed == 0) && (writer->length != 0)) {
+    pthread_mutex_lock(&json_output_lock);
+    if (json_newline_delimited == 0)
+      fputs(json_records_written == 0 ? "\n" : ",\n", json_output);
+    fwrite(writer->buffer, 1, writer->length, json_output);
+    if (json_newline_delimited != 0)
+      fputc('\n', json_output);
+    // flush each record so that a consumer can start on it straight away
+    fflush(json_output);
+    json_records_written++;
+    pthread_mutex_unlock(&json_output_lock);
+  }
+}
+
+void json_output_end(void) {
+  if ((json_output != NULL) && (json_newline_delimited == 0))
+    fprintf(json_output, "\n]\n");
+  if (json_output != NULL)
+    fflush(json_output);
+  json_output = NULL;
+}
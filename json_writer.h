@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) Mike Brady 2024
+ * All rights reserved.
+ * Mike Brady <4265913+mikebrady@users.noreply.github.com>
+
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// A small JSON writer for dacquery's machine-readable output. A record is built up in a
+// json_writer's buffer, which is kept and reused from one record to the next, so it only needs
+// to be allocated again if a record is bigger than any before it. Finished records are written
+// to the output one at a time, from any thread.
+
+#ifndef _JSON_WRITER_H
+#define _JSON_WRITER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct {
+  char *buffer;
+  size_t size;   // the space allocated
+  size_t length; // the space used
+  unsigned int depth;
+  uint64_t first_at_depth; // bit n is set if nothing has been written at depth n yet
+  int failed;              // non-zero if the buffer could not be made big enough
+} json_writer;
+
+void json_writer_free(json_writer *writer);
+
+// start a new record, discarding anything in the buffer
+void json_record_begin(json_writer *writer);
+void json_record_end(json_writer *writer);
+
+// key is NULL for an element of an array
+void json_object_begin(json_writer *writer, const char *key);
+void json_object_end(json_writer *writer);
+void json_array_begin(json_writer *writer, const char *key);
+void json_array_end(json_writer *writer);
+void json_string(json_writer *writer, const char *key, const char *value);
+void json_integer(json_writer *writer, const char *key, long long value);
+void json_number(json_writer *writer, const char *key, double value);
+void json_boolean(json_writer *writer, const char *key, int value);
+
+// Records go to the output as a JSON array, or as newline-delimited JSON, one per line.
+void json_output_begin(FILE *output, int newline_delimited);
+void json_output_record(json_writer *writer);
+void json_output_end(void);
+
+#endif // _JSON_WRITER_H
@@ -0,0 +1,736 @@
+/*
+ * Copyright (c) Mike Brady 2024
+ * All rights reserved.
+ * Mike Brady <4265913+mikebrady@users.noreply.github.com>
+
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "probe_cache.h"
+#include <alsa/asoundlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+// The file is a header followed by records, one per card. Structures are stored as they are in
+// memory, so the header records their sizes and a file written by a differently-built dacquery
+// is ignored. Pointers are stored as zero and recreated when a record is loaded.
+//
+//   record:  cache_record_header
+//            cache_channel_map[channel_map_count]
+//            buffer_limits[buffer_limits_count]
+//            card_device[device_count]
+//            mixer_info_t[mixer_count]
+//            probe_count x { cache_interface, [configuration_bundle, configuration_set[n]] }
+//
+// Everything is padded to a multiple of eight bytes. Channel map numbers are only good for a
+// single run, so the configuration sets in a record refer to the record's own table of channel
+// maps, numbered from 1, and likewise to its own table of buffer limits. Formats are stored by snd_pcm_format_t value and rates by their
+// position in the list of rates to check, so the version must change if that list does.
+
+#define PROBE_CACHE_MAGIC "DACQCACH"
+#define PROBE_CACHE_VERSION 9
+#define CHANNEL_MAP_SIZE 128
+
+typedef struct {
+  char map[CHANNEL_MAP_SIZE];
+  int32_t type; // as given by channel_map_type()
+} cache_channel_map;
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t structure_sizes[6];
+  uint32_t record_count;
+} cache_file_header;
+
+typedef struct {
+  uint64_t record_size; // including this header
+  probe_cache_key key;
+  uint64_t channel_map_count;
+  uint64_t buffer_limits_count;
+  uint64_t device_count;
+  uint64_t probe_count;
+  int64_t mixer_status;
+  uint64_t mixer_count;
+} cache_record_header;
+
+typedef struct {
+  interface_probe probe;
+  uint64_t has_configuration;
+} cache_interface;
+
+typedef struct {
+  void *record; // a malloced copy of the record
+  size_t size;
+} cache_new_record;
+
+// A hash table of records by key, so that a card is found without looking through every record.
+typedef struct {
+  size_t *slots; // each is zero, or one more than the number of the record it refers to
+  size_t size;   // the number of slots, a power of two
+} key_index;
+
+struct probe_cache {
+  char *path;
+  int fd;
+  uint8_t *map; // the contents of the file, or NULL
+  size_t map_size;
+  size_t *record_offsets; // where each record in the map starts
+  size_t record_count;    // the number of good records -- those before any damaged one
+  key_index records;
+  pthread_mutex_t lock; // for the new records
+  cache_new_record *new_records;
+  size_t new_record_count;
+  size_t new_records_allocated;
+  key_index new_record_index;
+};
+
+static size_t padded(size_t size) { return (size + 7) & ~(size_t)7; }
+
+typedef const probe_cache_key *(*key_getter)(const probe_cache *cache, size_t n);
+
+static const probe_cache_key *record_key(const probe_cache *cache, size_t n) {
+  return &((const cache_record_header *)(cache->map + cache->record_offsets[n]))->key;
+}
+
+static const probe_cache_key *new_record_key(const probe_cache *cache, size_t n) {
+  return &((const cache_record_header *)cache->new_records[n].record)->key;
+}
+
+static uint64_t key_hash(const probe_cache_key *key) {
+  const uint8_t *p = (const uint8_t *)key;
+  uint64_t hash = UINT64_C(0xcbf29ce484222325);
+  size_t i;
+  for (i = 0; i < sizeof(probe_cache_key); i++) {
+    hash ^= p[i];
+    hash *= UINT64_C(0x100000001b3);
+  }
+  return hash;
+}
+
+// return the slot that refers to the key's record or, if there isn't one, the empty slot
+// where it would go
+static size_t key_index_find(const probe_cache *cache, const key_index *index, key_getter key_of,
+                             const probe_cache_key *key) {
+  size_t slot = key_hash(key) & (index->size - 1);
+  while ((index->slots[slot] != 0) &&
+         (memcmp(key_of(cache, index->slots[slot] - 1), key, sizeof(probe_cache_key)) != 0))
+    slot = (slot + 1) & (index->size - 1);
+  return slot;
+}
+
+// Make sure the index has room for capacity records, rebuilding it from the first count
+// records if it hasn't. Return zero on success.
+static int key_index_reserve(const probe_cache *cache, key_index *index, key_getter key_of,
+                             size_t count, size_t capacity) {
+  if (capacity * 2 <= index->size)
+    return 0;
+  key_index new_index;
+  new_index.size = 16;
+  while (new_index.size < capacity * 2)
+    new_index.size *= 2;
+  new_index.slots = calloc(new_index.size, sizeof(size_t));
+  if (new_index.slots == NULL)
+    return -ENOMEM;
+  size_t n;
+  for (n = 0; n < count; n++)
+    new_index.slots[key_index_find(cache, &new_index, key_of, key_of(cache, n))] = n + 1;
+  free(index->slots);
+  *index = new_index;
+  return 0;
+}
+
+static void get_structure_sizes(uint32_t *sizes) {
+  sizes[0] = sizeof(probe_cache_key);
+  sizes[1] = sizeof(mixer_info_t);
+  sizes[2] = sizeof(card_device);
+  sizes[3] = sizeof(interface_probe);
+  sizes[4] = sizeof(configuration_bundle);
+  sizes[5] = sizeof(configuration_set);
+}
+
+static void read_first_line(const char *path, char *buffer, size_t buffer_size) {
+  FILE *f = fopen(path, "r");
+  if (f != NULL) {
+    if (fgets(buffer, buffer_size, f) != NULL)
+      buffer[strcspn(buffer, "\r\n")] = '\0';
+    else
+      buffer[0] = '\0';
+    fclose(f);
+  }
+}
+
+void probe_cache_make_key(const card_probe *card, probe_cache_key *key) {
+  memset(key, 0, sizeof(probe_cache_key));
+  // these fields are the same sizes in the card_probe and are zero-padded there
+  memcpy(key->control_interface_name, card->control_interface_name,
+         sizeof(key->control_interface_name));
+  memcpy(key->driver, card->driver, sizeof(key->driver));
+  memcpy(key->name, card->name, sizeof(key->name));
+  memcpy(key->longname, card->longname, sizeof(key->longname));
+  memcpy(key->components, card->components, sizeof(key->components));
+  char usbid_path[64];
+  snprintf(usbid_path, sizeof(usbid_path), "/proc/asound/card%d/usbid", card->card_number);
+  read_first_line(usbid_path, key->usb_id, sizeof(key->usb_id));
+  strncpy(key->alsa_lib_version, snd_asoundlib_version(), sizeof(key->alsa_lib_version) - 1);
+  struct utsname system_name;
+  if (uname(&system_name) == 0)
+    strncpy(key->kernel_release, system_name.release, sizeof(key->kernel_release) - 1);
+  key->with_capture = probe_capture != 0;
+  key->with_buffer_limits = report_buffer_limits != 0;
+  key->without_committing = probe_without_committing != 0;
+  key->with_inference = infer_subdevices != 0;
+}
+
+static char *join_path(const char *directory, const char *file_name) {
+  size_t size = strlen(directory) + strlen(file_name) + 1;
+  char *path = malloc(size);
+  if (path != NULL)
+    snprintf(path, size, "%s%s", directory, file_name);
+  return path;
+}
+
+static char *default_cache_path(void) {
+  char *path = NULL;
+  const char *cache_home = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  if ((cache_home != NULL) && (cache_home[0] != '\0'))
+    path = join_path(cache_home, "/dacquery/probe-cache");
+  else if ((home != NULL) && (home[0] != '\0'))
+    path = join_path(home, "/.cache/dacquery/probe-cache");
+  return path;
+}
+
+// return the size of the record at offset, or zero if it's not a valid one
+static size_t check_record(probe_cache *cache, size_t offset) {
+  if (cache->map_size - offset < sizeof(cache_record_header))
+    return 0;
+  const cache_record_header *header = (const cache_record_header *)(cache->map + offset);
+  size_t record_size = header->record_size;
+  if ((record_size < sizeof(cache_record_header)) || (record_size > cache->map_size - offset) ||
+      (record_size != padded(record_size)))
+    return 0;
+  size_t position = padded(sizeof(cache_record_header));
+  if (header->channel_map_count > (record_size - position) / sizeof(cache_channel_map))
+    return 0;
+  position += padded(sizeof(cache_channel_map) * header->channel_map_count);
+  if (header->buffer_limits_count > (record_size - position) / sizeof(buffer_limits))
+    return 0;
+  position += padded(sizeof(buffer_limits) * header->buffer_limits_count);
+  if (header->device_count > (record_size - position) / sizeof(card_device))
+    return 0;
+  position += padded(sizeof(card_device) * header->device_count);
+  if (header->mixer_count > (record_size - position) / sizeof(mixer_info_t))
+    return 0;
+  position += padded(sizeof(mixer_info_t) * header->mixer_count);
+  uint64_t pi;
+  for (pi = 0; pi < header->probe_count; pi++) {
+    if (record_size - position < padded(sizeof(cache_interface)))
+      return 0;
+    const cache_interface *interface = (const cache_interface *)((uint8_t *)header + position);
+    if (interface->probe.device_index >= header->device_count)
+      return 0;
+    position += padded(sizeof(cache_interface));
+    if (interface->has_configuration != 0) {
+      if (record_size - position < padded(sizeof(configuration_bundle)))
+        return 0;
+      const configuration_bundle *configuration =
+          (const configuration_bundle *)((uint8_t *)header + position);
+      position += padded(sizeof(configuration_bundle));
+      if (configuration->configuration_sets_count >
+          (record_size - position) / sizeof(configuration_set))
+        return 0;
+      const configuration_set *sets = (const configuration_set *)((uint8_t *)header + position);
+      size_t si, ci;
+      for (si = 0; si < configuration->configuration_sets_count; si++) {
+        for (ci = 0; ci < BITSET_SIZE; ci++)
+          if (sets[si].channel_maps[ci] > header->channel_map_count)
+            return 0;
+        for (ci = 0; ci < MAXIMUM_RATES; ci++)
+          if (sets[si].limits[ci] > header->buffer_limits_count)
+            return 0;
+      }
+      position += padded(sizeof(configuration_set) * configuration->configuration_sets_count);
+    }
+  }
+  if (position != record_size)
+    return 0;
+  return record_size;
+}
+
+// check each record in the map once and index them by key
+static void index_records(probe_cache *cache) {
+  const cache_file_header *file_header = (const cache_file_header *)cache->map;
+  size_t record_count = file_header->record_count;
+  if (record_count > cache->map_size / sizeof(cache_record_header))
+    record_count = cache->map_size / sizeof(cache_record_header); // it must be damaged
+  cache->record_offsets = malloc(sizeof(size_t) * (record_count + 1));
+  if (cache->record_offsets == NULL)
+    return;
+  size_t offset = padded(sizeof(cache_file_header));
+  size_t ri;
+  for (ri = 0; ri < record_count; ri++) {
+    size_t record_size = check_record(cache, offset);
+    if (record_size == 0) {
+      debug(1, "record %zu of the probe cache is damaged.", ri);
+      break;
+    }
+    cache->record_offsets[ri] = offset;
+    offset += record_size;
+  }
+  if (key_index_reserve(cache, &cache->records, record_key, ri, ri) == 0)
+    cache->record_count = ri;
+}
+
+probe_cache *probe_cache_open(const char *path, int ignore_contents) {
+  probe_cache *cache = calloc(1, sizeof(probe_cache));
+  if (cache != NULL) {
+    cache->fd = -1;
+    if (path != NULL)
+      cache->path = strdup(path);
+    else
+      cache->path = default_cache_path();
+    if (cache->path == NULL) {
+      debug(1, "no location for the probe cache.");
+      free(cache);
+      return NULL;
+    }
+    pthread_mutex_init(&cache->lock, NULL);
+    if (ignore_contents == 0) {
+      cache->fd = open(cache->path, O_RDONLY | O_CLOEXEC);
+      if (cache->fd >= 0) {
+        struct stat file_status;
+        if ((fstat(cache->fd, &file_status) == 0) &&
+            ((size_t)file_status.st_size >= sizeof(cache_file_header))) {
+          cache->map_size = file_status.st_size;
+          cache->map = mmap(NULL, cache->map_size, PROT_READ, MAP_PRIVATE, cache->fd, 0);
+          if (cache->map == MAP_FAILED) {
+            debug(1, "could not map the probe cache \"%s\": %s.", cache->path, strerror(errno));
+            cache->map = NULL;
+            cache->map_size = 0;
+          } else {
+            const cache_file_header *header = (const cache_file_header *)cache->map;
+            uint32_t structure_sizes[6];
+            get_structure_sizes(structure_sizes);
+            if ((memcmp(header->magic, PROBE_CACHE_MAGIC, sizeof(header->magic)) != 0) ||
+                (header->version != PROBE_CACHE_VERSION) ||
+                (memcmp(header->structure_sizes, structure_sizes, sizeof(structure_sizes)) !=
+                 0)) {
+              debug(1, "the probe cache \"%s\" is not in the expected format and is ignored.",
+                    cache->path);
+              munmap(cache->map, cache->map_size);
+              cache->map = NULL;
+              cache->map_size = 0;
+            } else {
+              index_records(cache);
+            }
+          }
+        }
+      } else if (errno != ENOENT) {
+        debug(1, "could not open the probe cache \"%s\": %s.", cache->path, strerror(errno));
+      }
+    }
+  }
+  return cache;
+}
+
+int probe_cache_lookup(probe_cache *cache, const probe_cache_key *key, card_probe *card) {
+  if (cache->record_count == 0)
+    return -ENOENT;
+  size_t slot = key_index_find(cache, &cache->records, record_key, key);
+  if (cache->records.slots[slot] != 0) {
+    const uint8_t *record = cache->map + cache->record_offsets[cache->records.slots[slot] - 1];
+    const cache_record_header *header = (const cache_record_header *)record;
+    size_t position = padded(sizeof(cache_record_header));
+    // intern the record's channel maps, to get their numbers for this run
+    uint16_t channel_maps[header->channel_map_count + 1];
+    channel_maps[0] = 0;
+    size_t mi;
+    for (mi = 0; mi < header->channel_map_count; mi++) {
+      cache_channel_map channel_map;
+      memcpy(&channel_map, (const cache_channel_map *)(record + position) + mi,
+             sizeof(cache_channel_map));
+      channel_map.map[CHANNEL_MAP_SIZE - 1] = '\0';
+      channel_maps[mi + 1] = intern_channel_map(channel_map.map, channel_map.type);
+    }
+    position += padded(sizeof(cache_channel_map) * header->channel_map_count);
+    // and likewise its buffer limits
+    uint16_t limits[header->buffer_limits_count + 1];
+    limits[0] = 0;
+    for (mi = 0; mi < header->buffer_limits_count; mi++)
+      limits[mi + 1] = intern_buffer_limits((const buffer_limits *)(record + position) + mi);
+    position += padded(sizeof(buffer_limits) * header->buffer_limits_count);
+    card->mixer_status = header->mixer_status;
+    card->device_count = header->device_count;
+    card->probe_count = header->probe_count;
+    card->devices = arena_alloc(card->arena, sizeof(card_device) * card->device_count);
+    card->probes = arena_alloc(card->arena, sizeof(interface_probe) * card->probe_count);
+    card->mixers.arena = card->arena;
+    card->mixers.mixer = arena_alloc(card->arena, sizeof(mixer_info_t) * header->mixer_count);
+    if ((card->devices == NULL) || (card->probes == NULL) || (card->mixers.mixer == NULL)) {
+      card->device_count = 0;
+      card->probe_count = 0;
+      card->mixers.mixer = NULL;
+      return -ENOMEM;
+    }
+    card->mixers.size = header->mixer_count;
+    card->mixers.first_free = header->mixer_count;
+    memcpy(card->devices, record + position, sizeof(card_device) * card->device_count);
+    position += padded(sizeof(card_device) * card->device_count);
+    memcpy(card->mixers.mixer, record + position, sizeof(mixer_info_t) * header->mixer_count);
+    position += padded(sizeof(mixer_info_t) * header->mixer_count);
+    size_t pi;
+    for (pi = 0; pi < card->probe_count; pi++) {
+      const cache_interface *interface = (const cache_interface *)(record + position);
+      position += padded(sizeof(cache_interface));
+      card->probes[pi] = interface->probe;
+      card->probes[pi].configuration = NULL;
+      if (interface->has_configuration != 0) {
+        configuration_bundle *configuration =
+            arena_alloc(card->arena, sizeof(configuration_bundle));
+        if (configuration != NULL) {
+          memcpy(configuration, record + position, sizeof(configuration_bundle));
+          position += padded(sizeof(configuration_bundle));
+          size_t sets_size = sizeof(configuration_set) * configuration->configuration_sets_count;
+          configuration->configuration_sets = NULL;
+          configuration->arena = card->arena;
+          if (sets_size != 0) {
+            configuration->configuration_sets = arena_alloc(card->arena, sets_size);
+            if (configuration->configuration_sets != NULL) {
+              configuration->configuration_sets_allocated =
+                  configuration->configuration_sets_count;
+              memcpy(configuration->configuration_sets, record + position, sets_size);
+              size_t si, ci;
+              for (si = 0; si < configuration->configuration_sets_count; si++) {
+                configuration_set *set = &configuration->configuration_sets[si];
+                for (ci = 0; ci < BITSET_SIZE; ci++)
+                  set->channel_maps[ci] = channel_maps[set->channel_maps[ci]];
+                for (ci = 0; ci < MAXIMUM_RATES; ci++)
+                  set->limits[ci] = limits[set->limits[ci]];
+              }
+            } else {
+              configuration->configuration_sets_count = 0;
+            }
+          }
+          position += padded(sets_size);
+          card->probes[pi].configuration = configuration;
+        }
+      }
+    }
+    return 0;
+  }
+  return -ENOENT;
+}
+
+// Add the interned channel map or buffer limits to the record's table, if they're not there
+// already, and return their number in the table. The table can't be bigger than the number of
+// configuration sets times 32.
+static uint16_t record_number(uint16_t number, uint16_t *table, size_t *table_size) {
+  if (number == 0)
+    return 0;
+  size_t i;
+  for (i = 0; i < *table_size; i++)
+    if (table[i] == number)
+      return i + 1;
+  table[(*table_size)++] = number;
+  return *table_size;
+}
+
+void probe_cache_store(probe_cache *cache, const probe_cache_key *key, const card_probe *card) {
+  size_t set_count = 0;
+  size_t pi;
+  for (pi = 0; pi < card->probe_count; pi++)
+    if (card->probes[pi].configuration != NULL)
+      set_count += card->probes[pi].configuration->configuration_sets_count;
+  uint16_t *channel_maps = malloc(sizeof(uint16_t) * BITSET_SIZE * (set_count + 1));
+  uint16_t *limits = malloc(sizeof(uint16_t) * MAXIMUM_RATES * (set_count + 1));
+  if ((channel_maps == NULL) || (limits == NULL)) {
+    debug(1, "could not allocate memory for a probe cache record.");
+    free(channel_maps);
+    free(limits);
+    return;
+  }
+  size_t channel_map_count = 0;
+  size_t limits_count = 0;
+  for (pi = 0; pi < card->probe_count; pi++) {
+    configuration_bundle *configuration = card->probes[pi].configuration;
+    if (configuration != NULL) {
+      size_t si, ci;
+      for (si = 0; si < configuration->configuration_sets_count; si++) {
+        for (ci = 0; ci < BITSET_SIZE; ci++)
+          record_number(configuration->configuration_sets[si].channel_maps[ci], channel_maps,
+                        &channel_map_count);
+        for (ci = 0; ci < MAXIMUM_RATES; ci++)
+          record_number(configuration->configuration_sets[si].limits[ci], limits, &limits_count);
+      }
+    }
+  }
+
+  size_t record_size = padded(sizeof(cache_record_header)) +
+                       padded(sizeof(cache_channel_map) * channel_map_count) +
+                       padded(sizeof(buffer_limits) * limits_count) +
+                       padded(sizeof(card_device) * card->device_count) +
+                       padded(sizeof(mixer_info_t) * card->mixers.first_free);
+  for (pi = 0; pi < card->probe_count; pi++) {
+    record_size += padded(sizeof(cache_interface));
+    configuration_bundle *configuration = card->probes[pi].configuration;
+    if (configuration != NULL)
+      record_size += padded(sizeof(configuration_bundle)) +
+                     padded(sizeof(configuration_set) * configuration->configuration_sets_count);
+  }
+  uint8_t *record = calloc(1, record_size);
+  if (record == NULL) {
+    debug(1, "could not allocate memory for a probe cache record.");
+    free(channel_maps);
+    free(limits);
+    return;
+  }
+  cache_record_header *header = (cache_record_header *)record;
+  header->record_size = record_size;
+  header->key = *key;
+  header->channel_map_count = channel_map_count;
+  header->buffer_limits_count = limits_count;
+  header->device_count = card->device_count;
+  header->probe_count = card->probe_count;
+  header->mixer_status = card->mixer_status;
+  header->mixer_count = card->mixers.first_free;
+  size_t position = padded(sizeof(cache_record_header));
+  size_t mi;
+  for (mi = 0; mi < channel_map_count; mi++) {
+    cache_channel_map *channel_map = (cache_channel_map *)(record + position) + mi;
+    strncpy(channel_map->map, channel_map_name(channel_maps[mi]), CHANNEL_MAP_SIZE - 1);
+    channel_map->type = channel_map_type(channel_maps[mi]);
+  }
+  position += padded(sizeof(cache_channel_map) * channel_map_count);
+  for (mi = 0; mi < limits_count; mi++)
+    get_buffer_limits(limits[mi], (buffer_limits *)(record + position) + mi);
+  position += padded(sizeof(buffer_limits) * limits_count);
+  if (card->device_count != 0)
+    memcpy(record + position, card->devices, sizeof(card_device) * card->device_count);
+  position += padded(sizeof(card_device) * card->device_count);
+  if (card->mixers.first_free != 0)
+    memcpy(record + position, card->mixers.mixer, sizeof(mixer_info_t) * card->mixers.first_free);
+  position += padded(sizeof(mixer_info_t) * card->mixers.first_free);
+  for (pi = 0; pi < card->probe_count; pi++) {
+    cache_interface *interface = (cache_interface *)(record + position);
+    position += padded(sizeof(cache_interface));
+    interface->probe = card->probes[pi];
+    interface->probe.configuration = NULL;
+    configuration_bundle *configuration = card->probes[pi].configuration;
+    if (configuration != NULL) {
+      interface->has_configuration = 1;
+      configuration_bundle *stored_configuration = (configuration_bundle *)(record + position);
+      *stored_configuration = *configuration;
+      stored_configuration->configuration_sets = NULL;
+      stored_configuration->configuration_sets_allocated = 0;
+      stored_configuration->arena = NULL;
+      stored_configuration->already_handled = 0;
+      position += padded(sizeof(configuration_bundle));
+      size_t sets_size = sizeof(configuration_set) * configuration->configuration_sets_count;
+      if (sets_size != 0)
+        memcpy(record + position, configuration->configuration_sets, sets_size);
+      configuration_set *stored_sets = (configuration_set *)(record + position);
+      size_t si, ci;
+      for (si = 0; si < configuration->configuration_sets_count; si++) {
+        for (ci = 0; ci < BITSET_SIZE; ci++)
+          stored_sets[si].channel_maps[ci] =
+              record_number(stored_sets[si].channel_maps[ci], channel_maps, &channel_map_count);
+        for (ci = 0; ci < MAXIMUM_RATES; ci++)
+          stored_sets[si].limits[ci] =
+              record_number(stored_sets[si].limits[ci], limits, &limits_count);
+      }
+      position += padded(sets_size);
+    }
+  }
+  free(channel_maps);
+  free(limits);
+
+  pthread_mutex_lock(&cache->lock);
+  // a card stored again in the same run replaces what was stored before
+  size_t ri = cache->new_record_count;
+  size_t slot = 0;
+  if (cache->new_record_count != 0) {
+    slot = key_index_find(cache, &cache->new_record_index, new_record_key, key);
+    if (cache->new_record_index.slots[slot] != 0)
+      ri = cache->new_record_index.slots[slot] - 1;
+  }
+  if (ri == cache->new_record_count) {
+    if (cache->new_record_count == cache->new_records_allocated) {
+      size_t new_size = cache->new_records_allocated == 0 ? 8 : cache->new_records_allocated * 2;
+      cache_new_record *new_records =
+          realloc(cache->new_records, sizeof(cache_new_record) * new_size);
+      if (new_records != NULL) {
+        cache->new_records = new_records;
+        cache->new_records_allocated = new_size;
+      }
+    }
+    if ((cache->new_record_count < cache->new_records_allocated) &&
+        (key_index_reserve(cache, &cache->new_record_index, new_record_key,
+                           cache->new_record_count, cache->new_record_count + 1) == 0)) {
+      cache->new_records[ri].record = record;
+      cache->new_records[ri].size = record_size;
+      cache->new_record_count++;
+      slot = key_index_find(cache, &cache->new_record_index, new_record_key, key);
+      cache->new_record_index.slots[slot] = ri + 1;
+    } else {
+      debug(1, "could not allocate memory for a probe cache record.");
+      free(record);
+    }
+  } else {
+    free(cache->new_records[ri].record);
+    cache->new_records[ri].record = record;
+    cache->new_records[ri].size = record_size;
+  }
+  pthread_mutex_unlock(&cache->lock);
+}
+
+static int make_directory_for(const char *path) {
+  char *directory = strdup(path);
+  if (directory == NULL)
+    return -ENOMEM;
+  char *p;
+  for (p = directory + 1; *p != '\0'; p++) {
+    if (*p == '/') {
+      *p = '\0';
+      if ((mkdir(directory, 0755) != 0) && (errno != EEXIST)) {
+        int result = -errno;
+        free(directory);
+        return result;
+      }
+      *p = '/';
+    }
+  }
+  free(directory);
+  return 0;
+}
+
+static int write_all(int fd, const void *buffer, size_t size) {
+  const uint8_t *p = buffer;
+  while (size != 0) {
+    ssize_t written = write(fd, p, size);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return -errno;
+    }
+    p += written;
+    size -= written;
+  }
+  return 0;
+}
+
+// write the new records, followed by any old records that have not been replaced
+static int write_cache(probe_cache *cache) {
+  int result = make_directory_for(cache->path);
+  if (result != 0)
+    return result;
+  char *temporary_path = join_path(cache->path, ".XXXXXX");
+  if (temporary_path == NULL)
+    return -ENOMEM;
+  int fd = mkstemp(temporary_path);
+  if (fd < 0) {
+    result = -errno;
+    free(temporary_path);
+    return result;
+  }
+
+  cache_file_header file_header;
+  memset(&file_header, 0, sizeof(file_header));
+  memcpy(file_header.magic, PROBE_CACHE_MAGIC, sizeof(file_header.magic));
+  file_header.version = PROBE_CACHE_VERSION;
+  get_structure_sizes(file_header.structure_sizes);
+
+  // count the old records to be kept
+  size_t old_records_kept = 0;
+  size_t pass;
+  for (pass = 0; (pass < 2) && (result == 0); pass++) {
+    if (pass == 1) {
+      file_header.record_count = cache->new_record_count + old_records_kept;
+      uint8_t padding[8] = {0};
+      result = write_all(fd, &file_header, sizeof(file_header));
+      if (result == 0)
+        result = write_all(fd, padding, padded(sizeof(file_header)) - sizeof(file_header));
+      size_t ri;
+      for (ri = 0; (ri < cache->new_record_count) && (result == 0); ri++)
+        result = write_all(fd, cache->new_records[ri].record, cache->new_records[ri].size);
+    }
+    size_t ri;
+    for (ri = 0; (ri < cache->record_count) && (result == 0); ri++) {
+      const cache_record_header *old_record =
+          (const cache_record_header *)(cache->map + cache->record_offsets[ri]);
+      size_t slot = key_index_find(cache, &cache->new_record_index, new_record_key,
+                                   &old_record->key);
+      if (cache->new_record_index.slots[slot] == 0) {
+        if (pass == 0)
+          old_records_kept++;
+        else
+          result = write_all(fd, old_record, old_record->record_size);
+      }
+    }
+  }
+  if (close(fd) != 0 && result == 0)
+    result = -errno;
+  if (result == 0) {
+    if (rename(temporary_path, cache->path) != 0)
+      result = -errno;
+  }
+  if (result != 0)
+    unlink(temporary_path);
+  free(temporary_path);
+  return result;
+}
+
+int probe_cache_close(probe_cache *cache) {
+  int result = 0;
+  if (cache != NULL) {
+    if (cache->new_record_count != 0) {
+      result = write_cache(cache);
+      if (result != 0)
+        debug(1, "could not write the probe cache \"%s\": %s.", cache->path,
+              strerror(-result));
+    }
+    size_t ri;
+    for (ri = 0; ri < cache->new_record_count; ri++)
+      free(cache->new_records[ri].record);
+    if (cache->new_records != NULL)
+      free(cache->new_records);
+    free(cache->new_record_index.slots);
+    free(cache->records.slots);
+    free(cache->record_offsets);
+    if (cache->map != NULL)
+      munmap(cache->map, cache->map_size);
+    if (cache->fd >= 0)
+      close(cache->fd);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->path);
+    free(cache);
+  }
+  return result;
+}
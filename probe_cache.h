@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) Mike Brady 2024
+ * All rights reserved.
+ * Mike Brady <4265913+mikebrady@users.noreply.github.com>
+
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// A persistent cache of probe results, so that a card that has already been probed need not be
+// probed again. Cards are identified by what ALSA says about them, by their USB IDs, if any, and
+// by the versions of alsa-lib and the kernel. The cache is a single file that is memory-mapped
+// when read and rewritten in full when anything in it changes.
+
+#ifndef _PROBE_CACHE_H
+#define _PROBE_CACHE_H
+
+#include "dacquery.h"
+
+typedef struct {
+  char control_interface_name[64];
+  char driver[32];
+  char name[80];
+  char longname[128];
+  char components[128];
+  char usb_id[16];
+  char alsa_lib_version[32];
+  char kernel_release[72];
+  uint32_t with_capture;       // non-zero if capture streams and mixers were probed too
+  uint32_t with_buffer_limits; // non-zero if the period and buffer size limits were read
+  uint32_t without_committing; // non-zero if support was decided without committing it
+  uint32_t with_inference;     // non-zero if subdevices' results could be taken from others
+} probe_cache_key;
+
+typedef struct probe_cache probe_cache;
+
+void probe_cache_make_key(const card_probe *card, probe_cache_key *key);
+
+// open the cache at path, or at the default path if path is NULL.
+// if ignore_contents is non-zero, nothing is read from it, but it is still written to.
+probe_cache *probe_cache_open(const char *path, int ignore_contents);
+
+// on a hit, return zero and fill in the card's devices, interfaces and mixers
+int probe_cache_lookup(probe_cache *cache, const probe_cache_key *key, card_probe *card);
+
+void probe_cache_store(probe_cache *cache, const probe_cache_key *key, const card_probe *card);
+
+// write out any changes and release the cache
+int probe_cache_close(probe_cache *cache);
+
+#endif // _PROBE_CACHE_H
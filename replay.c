@@ -0,0 +1,1392 @@
+/*
+ * Copyright (c) Mike Brady 2024
+ * All rights reserved.
+ * Mike Brady <4265913+mikebrady@users.noreply.github.com>
+
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// The recording and replay backends. A recording is a text file, one call to a line, e.g.
+//
+//   dacquery-recording 1 "1.2.12"
+//   control "hw:CARD=Generic"
+//   card_info "hw:CARD=Generic" = 0 0 "HDA-Intel" "HD-Audio Generic" "HD-Audio Generic at ..." ""
+//   enumerate "hw:CARD=Generic" = 0
+//   device 0 1 1 "Generic Analog" "Generic Analog"
+//   interface 0 0 "hw:Generic" "subdevice #0"
+//   open "hw:Generic" = 0
+//   any = 0
+//   rate 44100 0 = 0 44100 0
+//   ...
+//   close = 0
+//   mixers "hw:CARD=Generic" = 0
+//   mixer 0 0 64 -6400 0 1 0 "Master"
+//
+// With --capture, the capture interfaces and mixers are written as "capture_interface" and
+// "capture_mixer" lines, and a capture PCM is opened with "open_capture" rather than "open".
+//
+// With --latency, the limits of each configuration space before it's committed are written as
+// "buffer_limits = 0 32 16384 64 65536 2 32" -- the period size, buffer size and period count
+// ranges.
+//
+// With --volume-curves, a mixer line ends with the kind of curve, its error and a string of the
+// volume and dB value of each point, e.g. 1 0 "0 -6400 64 0".
+//
+// Each line is the name of the call, its arguments, "=", and its results, the first of which is
+// what it returned. The calls made on a PCM, from opening it to closing it, are written together,
+// so a recording of interfaces probed at the same time can be replayed one interface at a time.
+// Strings are quoted, with any quote, backslash or unprintable character escaped.
+
+#include "backend.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RECORDING_MAGIC "dacquery-recording"
+#define RECORDING_VERSION 1
+#define RECORDING_LINE_TOKENS 16
+
+typedef enum {
+  CALL_FREE,
+  CALL_ANY,
+  CALL_ACCESS,
+  CALL_CHANNELS,
+  CALL_FORMAT,
+  CALL_RATE,
+  CALL_TEST_CHANNELS,
+  CALL_TEST_FORMAT,
+  CALL_CHANNELS_MIN,
+  CALL_CHANNELS_MAX,
+  CALL_RATE_MIN,
+  CALL_RATE_MAX,
+  CALL_FORMAT_MASK,
+  CALL_BUFFER_LIMITS,
+  CALL_COMMIT,
+  CALL_CHANNEL_MAP,
+  CALL_CHANNEL_MAPS,
+  CALL_IDENTITY,
+  CALL_CLOSE,
+  CALL_KIND_COUNT
+} call_kind;
+
+static const char *call_names[CALL_KIND_COUNT] = {
+    "free",          "any",          "access",       "channels",     "format",
+    "rate",          "test_channels", "test_format", "channels_min", "channels_max",
+    "rate_min",      "rate_max",     "format_mask",  "buffer_limits", "commit",
+    "channel_map",   "channel_maps", "identity",     "close"};
+
+// the number of arguments each kind of call has
+static const unsigned int call_argument_counts[CALL_KIND_COUNT] = {
+    0, 0, 1, 1, 1, 2, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+// return the array, with room for at least one more element, or NULL if it can't be made bigger
+static void *room_for_one_more(void *array, size_t count, size_t *allocated, size_t size) {
+  if (count < *allocated)
+    return array;
+  size_t new_allocated = *allocated == 0 ? 16 : *allocated * 2;
+  void *new_array = realloc(array, new_allocated * size);
+  if (new_array != NULL)
+    *allocated = new_allocated;
+  return new_array;
+}
+
+static void write_string(FILE *file, const char *string) {
+  fputc('"', file);
+  for (; *string != '\0'; string++) {
+    unsigned char c = *string;
+    if ((c == '"') || (c == '\\'))
+      fprintf(file, "\\%c", c);
+    else if ((c < 0x20) || (c >= 0x7f))
+      fprintf(file, "\\x%02x", c);
+    else
+      fputc(c, file);
+  }
+  fputc('"', file);
+}
+
+static void format_mask_to_bitset(const snd_pcm_format_mask_t *mask, bitset *formats) {
+  bitset_clear(formats);
+  int format;
+  for (format = 0; format <= SND_PCM_FORMAT_LAST; format++)
+    if (snd_pcm_format_mask_test(mask, (snd_pcm_format_t)format))
+      bitset_add(formats, format);
+}
+
+// The recording backend.
+
+typedef struct {
+  snd_pcm_t *handle;
+  char *text; // the calls made on the PCM so far
+  size_t size;
+  FILE *stream; // writes to text
+} recording_session;
+
+static const probe_backend *recorded = NULL;
+static FILE *recording_file = NULL;
+static recording_session **recording_sessions = NULL; // the PCMs that are open
+static size_t recording_session_count = 0;
+static size_t recording_sessions_allocated = 0;
+static pthread_mutex_t recording_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// return where the calls made on the PCM are written, or NULL if it isn't being recorded
+static FILE *recording_stream(snd_pcm_t *handle) {
+  FILE *stream = NULL;
+  pthread_mutex_lock(&recording_lock);
+  size_t i;
+  for (i = 0; (i < recording_session_count) && (stream == NULL); i++)
+    if (recording_sessions[i]->handle == handle)
+      stream = recording_sessions[i]->stream;
+  pthread_mutex_unlock(&recording_lock);
+  return stream;
+}
+
+static const char *record_library_version(void) { return recorded->library_version(); }
+
+static size_t record_get_control_interface_names(char ***control_interface_names) {
+  size_t count = recorded->get_control_interface_names(control_interface_names);
+  pthread_mutex_lock(&recording_lock);
+  size_t i;
+  for (i = 0; i < count; i++) {
+    fprintf(recording_file, "control ");
+    write_string(recording_file, (*control_interface_names)[i]);
+    fprintf(recording_file, "\n");
+  }
+  pthread_mutex_unlock(&recording_lock);
+  return count;
+}
+
+static int record_get_card_info(const char *control_interface_name, card_probe *card) {
+  int result = recorded->get_card_info(control_interface_name, card);
+  pthread_mutex_lock(&recording_lock);
+  fprintf(recording_file, "card_info ");
+  write_string(recording_file, control_interface_name);
+  fprintf(recording_file, " = %d %d ", result, card->card_number);
+  write_string(recording_file, card->driver);
+  fprintf(recording_file, " ");
+  write_string(recording_file, card->name);
+  fprintf(recording_file, " ");
+  write_string(recording_file, card->longname);
+  fprintf(recording_file, " ");
+  write_string(recording_file, card->components);
+  fprintf(recording_file, "\n");
+  pthread_mutex_unlock(&recording_lock);
+  return result;
+}
+
+static int record_enumerate_card(const char *control_interface_name, card_probe *card) {
+  int result = recorded->enumerate_card(control_interface_name, card);
+  pthread_mutex_lock(&recording_lock);
+  fprintf(recording_file, "enumerate ");
+  write_string(recording_file, control_interface_name);
+  fprintf(recording_file, " = %d\n", result);
+  size_t i;
+  for (i = 0; i < card->device_count; i++) {
+    card_device *device = &card->devices[i];
+    fprintf(recording_file, "device %d %d %d ", device->number, device->info_available,
+            device->subdevices_available);
+    write_string(recording_file, device->name);
+    fprintf(recording_file, " ");
+    write_string(recording_file, device->id);
+    fprintf(recording_file, "\n");
+  }
+  for (i = 0; i < card->probe_count; i++) {
+    interface_probe *probe = &card->probes[i];
+    fprintf(recording_file, "%s %zu %d ",
+            probe->stream == SND_PCM_STREAM_CAPTURE ? "capture_interface" : "interface",
+            probe->device_index, probe->subdevice);
+    write_string(recording_file, probe->interface_name);
+    fprintf(recording_file, " ");
+    write_string(recording_file, probe->subdevice_name);
+    fprintf(recording_file, "\n");
+  }
+  pthread_mutex_unlock(&recording_lock);
+  return result;
+}
+
+static int record_load_mixers(const char *device_name, mixer_bundle_t *mixers) {
+  int result = recorded->load_mixers(device_name, mixers);
+  pthread_mutex_lock(&recording_lock);
+  fprintf(recording_file, "mixers ");
+  write_string(recording_file, device_name);
+  fprintf(recording_file, " = %d\n", result);
+  size_t i;
+  for (i = 0; i < mixers->first_free; i++) {
+    mixer_info_t *mixer = &mixers->mixer[i];
+    fprintf(recording_file, "%s %u %ld %ld %ld %ld %d %d ",
+            mixer->capture != 0 ? "capture_mixer" : "mixer", mixer->index, mixer->minv, mixer->maxv,
+            mixer->mindecibels, mixer->maxdecibels, mixer->has_a_decibel_range,
+            mixer->lowest_value_is_mute);
+    write_string(recording_file, mixer->name);
+    // the volume curve, if it was sampled, follows as its kind, its error and a string of the
+    // volume and dB value of each point
+    if (mixer->volume_curve != VOLUME_CURVE_NONE) {
+      char points[VOLUME_CURVE_POINTS * 48];
+      size_t length = 0;
+      unsigned int pi;
+      points[0] = '\0';
+      for (pi = 0; pi < mixer->volume_point_count; pi++)
+        length += snprintf(points + length, sizeof(points) - length, "%s%ld %ld",
+                           pi == 0 ? "" : " ", mixer->volume_points[pi].volume,
+                           mixer->volume_points[pi].decibels);
+      fprintf(recording_file, " %d %ld ", (int)mixer->volume_curve, mixer->volume_curve_error);
+      write_string(recording_file, points);
+    }
+    fprintf(recording_file, "\n");
+  }
+  pthread_mutex_unlock(&recording_lock);
+  return result;
+}
+
+static int record_pcm_open(snd_pcm_t **handle, const char *interface_name,
+                           snd_pcm_stream_t pcm_stream) {
+  int result = recorded->pcm_open(handle, interface_name, pcm_stream);
+  recording_session *session = NULL;
+  if (result == 0) {
+    session = calloc(1, sizeof(recording_session));
+    if (session != NULL) {
+      session->handle = *handle;
+      session->stream = open_memstream(&session->text, &session->size);
+      if (session->stream == NULL) {
+        free(session);
+        session = NULL;
+      }
+    }
+    if (session == NULL)
+      warn("could not allocate memory to record the probe of \"%s\".", interface_name);
+  }
+  pthread_mutex_lock(&recording_lock);
+  if (session != NULL) {
+    recording_session **new_sessions =
+        room_for_one_more(recording_sessions, recording_session_count,
+                          &recording_sessions_allocated, sizeof(recording_session *));
+    if (new_sessions != NULL) {
+      recording_sessions = new_sessions;
+      recording_sessions[recording_session_count++] = session;
+    } else {
+      warn("could not allocate memory to record the probe of \"%s\".", interface_name);
+      fclose(session->stream);
+      free(session->text);
+      free(session);
+      session = NULL;
+    }
+  }
+  // the calls made on the PCM are written when it's closed; if it couldn't be opened, that's all
+  FILE *stream = session != NULL ? session->stream : recording_file;
+  fprintf(stream, pcm_stream == SND_PCM_STREAM_CAPTURE ? "open_capture " : "open ");
+  write_string(stream, interface_name);
+  fprintf(stream, " = %d\n", result);
+  pthread_mutex_unlock(&recording_lock);
+  return result;
+}
+
+static int record_pcm_close(snd_pcm_t *handle) {
+  int result = recorded->pcm_close(handle);
+  pthread_mutex_lock(&recording_lock);
+  size_t i;
+  for (i = 0; i < recording_session_count; i++) {
+    recording_session *session = recording_sessions[i];
+    if (session->handle == handle) {
+      fprintf(session->stream, "close = %d\n", result);
+      fclose(session->stream);
+      fputs(session->text, recording_file);
+      free(session->text);
+      free(session);
+      recording_sessions[i] = recording_sessions[--recording_session_count];
+      break;
+    }
+  }
+  pthread_mutex_unlock(&recording_lock);
+  return result;
+}
+
+static int record_hw_free(snd_pcm_t *handle) {
+  int result = recorded->hw_free(handle);
+  FILE *stream = recording_stream(handle);
+  if (stream != NULL)
+    fprintf(stream, "free = %d\n", result);
+  return result;
+}
+
+static int record_hw_params_any(snd_pcm_t *handle, snd_pcm_hw_params_t *params) {
+  int result = recorded->hw_params_any(handle, params);
+  FILE *stream = recording_stream(handle);
+  if (stream != NULL)
+    fprintf(stream, "any = %d\n", result);
+  return result;
+}
+
+static int record_hw_params_set_access(snd_pcm_t *handle, snd_pcm_hw_params_t *params,
+                                       snd_pcm_access_t access) {
+  int result = recorded->hw_params_set_access(handle, params, access);
+  FILE *stream = recording_stream(handle);
+  if (stream != NULL)
+    fprintf(stream, "access %d = %d\n", access, result);
+  return result;
+}
+
+static int record_hw_params_set_channels(snd_pcm_t *handle, snd_pcm_hw_params_t *params,
+                                         unsigned int channels) {
+  int result = recorded->hw_params_set_channels(handle, params, channels);
+  FILE *stream = recording_stream(handle);
+  if (stream != NULL)
+    fprintf(stream, "channels %u = %d\n", channels, result);
+  return result;
+}
+
+static int record_hw_params_set_format(snd_pcm_t *handle, snd_pcm_hw_params_t *params,
+                                       snd_pcm_format_t format) {
+  int result = recorded->hw_params_set_format(handle, params, format);
+  FILE *stream = recording_stream(handle);
+  if (stream != NULL)
+    fprintf(stream, "format %d = %d\n", format, result);
+  return result;
+}
+
+static int record_hw_params_set_rate_near(snd_pcm_t *handle, snd_pcm_hw_params_t *params,
+                                          unsigned int *rate, int *dir) {
+  unsigned int requested_rate = *rate;
+  int requested_dir = *dir;
+  int result = recorded->hw_params_set_rate_near(handle, params, rate, dir);
+  FILE *stream = recording_stream(handle);
+  if (stream != NULL)
+    fprintf(stream, "rate %u %d = %d %u %d\n", requested_rate, requested_dir, result, *rate,
+            *dir);
+  return result;
+}
+
+static int record_hw_params_test_channels(snd_pcm_t *handle, snd_pcm_hw_params_t *params,
+                                          unsigned int channels) {
+  int result = recorded->hw_params_test_channels(handle, params, channels);
+  FILE *stream = recording_stream(handle);
+  if (stream != NULL)
+    fprintf(stream, "test_channels %u = %d\n", channels, result);
+  return result;
+}
+
+static int record_hw_params_test_format(snd_pcm_t *handle, snd_pcm_hw_params_t *params,
+                                        snd_pcm_format_t format) {
+  int result = recorded->hw_params_test_format(handle, params, format);
+  FILE *stream = recording_stream(handle);
+  if (stream != NULL)
+    fprintf(stream, "test_format %d = %d\n", format, result);
+  return result;
+}
+
+static int record_hw_params_get_channels_min(snd_pcm_t *handle, const snd_pcm_hw_params_t *params,
+                                             unsigned int *channels) {
+  int result = recorded->hw_params_get_channels_min(handle, params, channels);
+  FILE *stream = recording_stream(handle);
+  if (stream != NULL)
+    fprintf(stream, "channels_min = %d %u\n", result, *channels);
+  return result;
+}
+
+static int record_hw_params_get_channels_max(snd_pcm_t *handle, const snd_pcm_hw_params_t *params,
+                                             unsigned int *channels) {
+  int result = recorded->hw_params_get_channels_max(handle, params, channels);
+  FILE *stream = recording_stream(handle);
+  if (stream != NULL)
+    fprintf(stream, "channels_max = %d %u\n", result, *channels);
+  return result;
+}
+
+static int record_hw_params_get_rate_min(snd_pcm_t *handle, const snd_pcm_hw_params_t *params,
+                                         unsigned int *rate) {
+  int result = recorded->hw_params_get_rate_min(handle, params, rate);
+  FILE *stream = recording_stream(handle);
+  if (stream != NULL)
+    fprintf(stream, "rate_min = %d %u\n", result, *rate);
+  return result;
+}
+
+static int record_hw_params_get_rate_max(snd_pcm_t *handle, const snd_pcm_hw_params_t *params,
+                                         unsigned int *rate) {
+  int result = recorded->hw_params_get_rate_max(handle, params, rate);
+  FILE *stream = recording_stream(handle);
+  if (stream != NULL)
+    fprintf(stream, "rate_max = %d %u\n", result, *rate);
+  return result;
+}
+
+static void record_hw_params_get_format_mask(snd_pcm_t *handle, snd_pcm_hw_params_t *params,
+                                             snd_pcm_format_mask_t *mask) {
+  recorded->hw_params_get_format_mask(handle, params, mask);
+  FILE *stream = recording_stream(handle);
+  if (stream != NULL) {
+    bitset formats;
+    format_mask_to_bitset(mask, &formats);
+    fprintf(stream, "format_mask = 0");
+    unsigned int w;
+    for (w = 0; w < BITSET_WORDS; w++)
+      fprintf(stream, " 0x%" PRIx64, formats.word[w]);
+    fprintf(stream, "\n");
+  }
+}
+
+static int record_hw_params_get_buffer_limits(snd_pcm_t *handle,
+                                              const snd_pcm_hw_params_t *params,
+                                              buffer_limits *limits) {
+  int result = recorded->hw_params_get_buffer_limits(handle, params, limits);
+  FILE *stream = recording_stream(handle);
+  if (stream != NULL)
+    fprintf(stream, "buffer_limits = %d %u %u %u %u %u %u\n", result, limits->period_size_min,
+            limits->period_size_max, limits->buffer_size_min, limits->buffer_size_max,
+            limits->periods_min, limits->periods_max);
+  return result;
+}
+
+static int record_pcm_identity(snd_pcm_t *handle, pcm_signature *signature) {
+  int result = recorded->pcm_identity(handle, signature);
+  FILE *stream = recording_stream(handle);
+  if (stream != NULL) {
+    if (result == 0)
+      fprintf(stream, "identity = 0 %d %d %d %d\n", (int)signature->type, signature->card,
+              signature->device, signature->subdevice);
+    else
+      fprintf(stream, "identity = %d\n", result);
+  }
+  return result;
+}
+
+static int record_hw_params(snd_pcm_t *handle, snd_pcm_hw_params_t *params) {
+  int result = recorded->hw_params(handle, params);
+  FILE *stream = recording_stream(handle);
+  if (stream != NULL)
+    fprintf(stream, "commit = %d\n", result);
+  return result;
+}
+
+static void record_get_channel_map(snd_pcm_t *handle, char *store) {
+  recorded->get_channel_map(handle, store);
+  FILE *stream = recording_stream(handle);
+  if (stream != NULL) {
+    fprintf(stream, "channel_map = 0 ");
+    write_string(stream, store);
+    fprintf(stream, "\n");
+  }
+}
+
+// the maps are written as a single string, with a line for each channel count giving the count,
+// the type of its map and then the map -- a recording made before the types were recorded has
+// no type, and the maps in it are taken to be fixed
+static int record_query_channel_maps(snd_pcm_t *handle, channel_map_list *maps) {
+  int result = recorded->query_channel_maps(handle, maps);
+  FILE *stream = recording_stream(handle);
+  if (stream != NULL) {
+    char *text = NULL;
+    size_t text_size = 0;
+    FILE *text_stream = open_memstream(&text, &text_size);
+    if (text_stream != NULL) {
+      if (result == 0) {
+        int channels;
+        bitset_for_each(channels, &maps->channel_counts) {
+          fprintf(text_stream, "%d %s %s\n", channels,
+                  snd_pcm_chmap_type_name((enum snd_pcm_chmap_type)maps->type[channels]),
+                  maps->map[channels]);
+        }
+      }
+      fclose(text_stream);
+    }
+    fprintf(stream, "channel_maps = %d ", result);
+    write_string(stream, text != NULL ? text : "");
+    fprintf(stream, "\n");
+    free(text);
+  }
+  return result;
+}
+
+static const probe_backend recording_backend = {
+    .library_version = record_library_version,
+    .get_control_interface_names = record_get_control_interface_names,
+    .get_card_info = record_get_card_info,
+    .enumerate_card = record_enumerate_card,
+    .load_mixers = record_load_mixers,
+    .pcm_open = record_pcm_open,
+    .pcm_close = record_pcm_close,
+    .pcm_identity = record_pcm_identity,
+    .hw_free = record_hw_free,
+    .hw_params_any = record_hw_params_any,
+    .hw_params_set_access = record_hw_params_set_access,
+    .hw_params_set_channels = record_hw_params_set_channels,
+    .hw_params_set_format = record_hw_params_set_format,
+    .hw_params_set_rate_near = record_hw_params_set_rate_near,
+    .hw_params_test_channels = record_hw_params_test_channels,
+    .hw_params_test_format = record_hw_params_test_format,
+    .hw_params_get_channels_min = record_hw_params_get_channels_min,
+    .hw_params_get_channels_max = record_hw_params_get_channels_max,
+    .hw_params_get_rate_min = record_hw_params_get_rate_min,
+    .hw_params_get_rate_max = record_hw_params_get_rate_max,
+    .hw_params_get_format_mask = record_hw_params_get_format_mask,
+    .hw_params_get_buffer_limits = record_hw_params_get_buffer_limits,
+    .hw_params = record_hw_params,
+    .get_channel_map = record_get_channel_map,
+    .query_channel_maps = record_query_channel_maps};
+
+const probe_backend *recording_backend_open(const probe_backend *backend, const char *path) {
+  recording_file = fopen(path, "w");
+  if (recording_file == NULL)
+    return NULL;
+  recorded = backend;
+  fprintf(recording_file, "%s %d ", RECORDING_MAGIC, RECORDING_VERSION);
+  write_string(recording_file, backend->library_version());
+  fprintf(recording_file, "\n");
+  return &recording_backend;
+}
+
+int recording_backend_close(void) {
+  int result = 0;
+  pthread_mutex_lock(&recording_lock);
+  if (recording_file != NULL) {
+    if (recording_session_count != 0)
+      debug(1, "%zu PCMs were still open when the recording was closed.",
+            recording_session_count);
+    result = fclose(recording_file);
+    recording_file = NULL;
+  }
+  free(recording_sessions);
+  recording_sessions = NULL;
+  recording_session_count = 0;
+  recording_sessions_allocated = 0;
+  pthread_mutex_unlock(&recording_lock);
+  return result;
+}
+
+// The replay backend. The whole recording is read in when it's opened.
+
+// a format mask or a set of buffer limits is the most a call passes back
+#define CALL_RESULT_COUNT (1 + (BITSET_WORDS > 6 ? BITSET_WORDS : 6))
+
+typedef struct {
+  call_kind kind;
+  int64_t arguments[2];
+  int64_t results[CALL_RESULT_COUNT]; // what the call returned, then anything it passed back
+  char *text;                        // the channel map, or the channel maps
+} recorded_call;
+
+typedef struct {
+  char *interface_name;
+  snd_pcm_stream_t stream;
+  int open_result;
+  recorded_call *calls;
+  size_t call_count;
+  size_t calls_allocated;
+  size_t next_call;
+  int used;     // non-zero once it has been opened
+  int diverged; // non-zero if a call was made that wasn't the next one recorded
+} replay_session;
+
+typedef struct {
+  char *control_interface_name;
+  int result;
+  card_probe card; // just the number and names
+  int used;
+} replay_card_info;
+
+typedef struct {
+  char *control_interface_name;
+  int result;
+  card_device *devices;
+  size_t device_count;
+  size_t devices_allocated;
+  interface_probe *probes;
+  size_t probe_count;
+  size_t probes_allocated;
+  int used;
+} replay_enumeration;
+
+typedef struct {
+  char *device_name;
+  int result;
+  mixer_info_t *mixers;
+  size_t mixer_count;
+  size_t mixers_allocated;
+  int used;
+} replay_mixers;
+
+typedef struct {
+  char library_version[64];
+  char **control_interface_names;
+  size_t control_interface_name_count;
+  size_t control_interface_names_allocated;
+  replay_card_info *card_infos;
+  size_t card_info_count;
+  size_t card_infos_allocated;
+  replay_enumeration *enumerations;
+  size_t enumeration_count;
+  size_t enumerations_allocated;
+  replay_mixers *mixers;
+  size_t mixers_count;
+  size_t mixers_allocated;
+  replay_session *sessions; // a session's address is the handle of the PCM it replays
+  size_t session_count;
+  size_t sessions_allocated;
+  unsigned int divergences;
+  pthread_mutex_t lock;
+} replay_state;
+
+static replay_state replay = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+typedef struct {
+  char *token[RECORDING_LINE_TOKENS];
+  unsigned int count;
+  unsigned int equals; // the index of the "=", or RECORDING_LINE_TOKENS if there isn't one
+} recording_line;
+
+// split the line into tokens, in place, removing the quotes and escapes from strings
+static int split_line(char *line, recording_line *tokens) {
+  tokens->count = 0;
+  tokens->equals = RECORDING_LINE_TOKENS;
+  char *p = line;
+  while (1) {
+    while ((*p == ' ') || (*p == '\t') || (*p == '\n') || (*p == '\r'))
+      p++;
+    if (*p == '\0')
+      return 0;
+    if (tokens->count == RECORDING_LINE_TOKENS)
+      return -1;
+    if (*p == '"') {
+      char *out = ++p;
+      tokens->token[tokens->count++] = out;
+      while (*p != '"') {
+        if (*p == '\0')
+          return -1;
+        if (*p == '\\') {
+          p++;
+          if (*p == 'x') {
+            char hex[3] = {p[1], 0, 0};
+            if (hex[0] != '\0')
+              hex[1] = p[2];
+            char *end;
+            long value = strtol(hex, &end, 16);
+            if ((hex[1] == '\0') || (*end != '\0'))
+              return -1;
+            *out++ = (char)value;
+            p += 3;
+            continue;
+          } else if (*p == '\0') {
+            return -1;
+          }
+        }
+        *out++ = *p++;
+      }
+      *out = '\0';
+      p++;
+    } else {
+      tokens->token[tokens->count] = p;
+      while ((*p != '\0') && (*p != ' ') && (*p != '\t') && (*p != '\n') && (*p != '\r'))
+        p++;
+      if (*p != '\0')
+        *p++ = '\0';
+      if (strcmp(tokens->token[tokens->count], "=") == 0)
+        tokens->equals = tokens->count;
+      tokens->count++;
+    }
+  }
+}
+
+static int token_number(const recording_line *tokens, unsigned int i, int64_t *value) {
+  if (i >= tokens->count)
+    return -1;
+  char *end;
+  if (strncmp(tokens->token[i], "0x", 2) == 0)
+    *value = (int64_t)strtoull(tokens->token[i], &end, 16);
+  else
+    *value = strtoll(tokens->token[i], &end, 10);
+  return ((end == tokens->token[i]) || (*end != '\0')) ? -1 : 0;
+}
+
+static int token_int(const recording_line *tokens, unsigned int i, int *value) {
+  int64_t number;
+  if (token_number(tokens, i, &number) != 0)
+    return -1;
+  *value = (int)number;
+  return 0;
+}
+
+static int token_long(const recording_line *tokens, unsigned int i, long *value) {
+  int64_t number;
+  if (token_number(tokens, i, &number) != 0)
+    return -1;
+  *value = (long)number;
+  return 0;
+}
+
+static void copy_token(const recording_line *tokens, unsigned int i, char *store, size_t size) {
+  snprintf(store, size, "%s", tokens->token[i]);
+}
+
+// the session, enumeration or mixers that the lines that follow belong to, or -1
+static ssize_t current_session;
+static ssize_t current_enumeration;
+static ssize_t current_mixers;
+
+// add what the line says to the replay; return 0 if it makes sense
+static int read_recording_line(const recording_line *tokens) {
+  const char *name = tokens->token[0];
+  if ((strcmp(name, "control") == 0) && (tokens->count == 2)) {
+    char **names =
+        room_for_one_more(replay.control_interface_names, replay.control_interface_name_count,
+                          &replay.control_interface_names_allocated, sizeof(char *));
+    if (names == NULL)
+      return -1;
+    replay.control_interface_names = names;
+    names[replay.control_interface_name_count] = strdup(tokens->token[1]);
+    if (names[replay.control_interface_name_count] == NULL)
+      return -1;
+    replay.control_interface_name_count++;
+  } else if ((strcmp(name, "card_info") == 0) && (tokens->count == 9) && (tokens->equals == 2)) {
+    replay_card_info *card_infos = room_for_one_more(
+        replay.card_infos, replay.card_info_count, &replay.card_infos_allocated,
+        sizeof(replay_card_info));
+    if (card_infos == NULL)
+      return -1;
+    replay.card_infos = card_infos;
+    replay_card_info *card_info = &card_infos[replay.card_info_count];
+    memset(card_info, 0, sizeof(replay_card_info));
+    if ((token_int(tokens, 3, &card_info->result) != 0) ||
+        (token_int(tokens, 4, &card_info->card.card_number) != 0))
+      return -1;
+    card_info->control_interface_name = strdup(tokens->token[1]);
+    if (card_info->control_interface_name == NULL)
+      return -1;
+    copy_token(tokens, 1, card_info->card.control_interface_name,
+               sizeof(card_info->card.control_interface_name));
+    copy_token(tokens, 5, card_info->card.driver, sizeof(card_info->card.driver));
+    copy_token(tokens, 6, card_info->card.name, sizeof(card_info->card.name));
+    copy_token(tokens, 7, card_info->card.longname, sizeof(card_info->card.longname));
+    copy_token(tokens, 8, card_info->card.components, sizeof(card_info->card.components));
+    replay.card_info_count++;
+  } else if ((strcmp(name, "enumerate") == 0) && (tokens->count == 4) && (tokens->equals == 2)) {
+    replay_enumeration *enumerations = room_for_one_more(
+        replay.enumerations, replay.enumeration_count, &replay.enumerations_allocated,
+        sizeof(replay_enumeration));
+    if (enumerations == NULL)
+      return -1;
+    replay.enumerations = enumerations;
+    replay_enumeration *enumeration = &enumerations[replay.enumeration_count];
+    memset(enumeration, 0, sizeof(replay_enumeration));
+    if (token_int(tokens, 3, &enumeration->result) != 0)
+      return -1;
+    enumeration->control_interface_name = strdup(tokens->token[1]);
+    if (enumeration->control_interface_name == NULL)
+      return -1;
+    current_enumeration = replay.enumeration_count++;
+  } else if ((strcmp(name, "device") == 0) && (tokens->count == 6) &&
+             (current_enumeration >= 0)) {
+    replay_enumeration *enumeration = &replay.enumerations[current_enumeration];
+    card_device *devices =
+        room_for_one_more(enumeration->devices, enumeration->device_count,
+                          &enumeration->devices_allocated, sizeof(card_device));
+    if (devices == NULL)
+      return -1;
+    enumeration->devices = devices;
+    card_device *device = &devices[enumeration->device_count];
+    memset(device, 0, sizeof(card_device));
+    if ((token_int(tokens, 1, &device->number) != 0) ||
+        (token_int(tokens, 2, &device->info_available) != 0) ||
+        (token_int(tokens, 3, &device->subdevices_available) != 0))
+      return -1;
+    copy_token(tokens, 4, device->name, sizeof(device->name));
+    copy_token(tokens, 5, device->id, sizeof(device->id));
+    enumeration->device_count++;
+  } else if (((strcmp(name, "interface") == 0) || (strcmp(name, "capture_interface") == 0)) &&
+             (tokens->count == 5) &&
+             (current_enumeration >= 0)) {
+    replay_enumeration *enumeration = &replay.enumerations[current_enumeration];
+    interface_probe *probes =
+        room_for_one_more(enumeration->probes, enumeration->probe_count,
+                          &enumeration->probes_allocated, sizeof(interface_probe));
+    if (probes == NULL)
+      return -1;
+    enumeration->probes = probes;
+    interface_probe *probe = &probes[enumeration->probe_count];
+    memset(probe, 0, sizeof(interface_probe));
+    int64_t device_index;
+    if ((token_number(tokens, 1, &device_index) != 0) ||
+        (device_index < 0) || ((size_t)device_index >= enumeration->device_count) ||
+        (token_int(tokens, 2, &probe->subdevice) != 0))
+      return -1;
+    probe->device_index = device_index;
+    if (strcmp(name, "capture_interface") == 0)
+      probe->stream = SND_PCM_STREAM_CAPTURE;
+    copy_token(tokens, 3, probe->interface_name, sizeof(probe->interface_name));
+    copy_token(tokens, 4, probe->subdevice_name, sizeof(probe->subdevice_name));
+    enumeration->probe_count++;
+  } else if ((strcmp(name, "mixers") == 0) && (tokens->count == 4) && (tokens->equals == 2)) {
+    replay_mixers *mixers = room_for_one_more(replay.mixers, replay.mixers_count,
+                                              &replay.mixers_allocated, sizeof(replay_mixers));
+    if (mixers == NULL)
+      return -1;
+    replay.mixers = mixers;
+    memset(&mixers[replay.mixers_count], 0, sizeof(replay_mixers));
+    if (token_int(tokens, 3, &mixers[replay.mixers_count].result) != 0)
+      return -1;
+    mixers[replay.mixers_count].device_name = strdup(tokens->token[1]);
+    if (mixers[replay.mixers_count].device_name == NULL)
+      return -1;
+    current_mixers = replay.mixers_count++;
+  } else if (((strcmp(name, "mixer") == 0) || (strcmp(name, "capture_mixer") == 0)) &&
+             ((tokens->count == 9) || (tokens->count == 12)) && (current_mixers >= 0)) {
+    replay_mixers *mixers = &replay.mixers[current_mixers];
+    mixer_info_t *mixer_array = room_for_one_more(mixers->mixers, mixers->mixer_count,
+                                                  &mixers->mixers_allocated, sizeof(mixer_info_t));
+    if (mixer_array == NULL)
+      return -1;
+    mixers->mixers = mixer_array;
+    mixer_info_t *mixer = &mixer_array[mixers->mixer_count];
+    memset(mixer, 0, sizeof(mixer_info_t));
+    int64_t index;
+    if ((token_number(tokens, 1, &index) != 0) || (token_long(tokens, 2, &mixer->minv) != 0) ||
+        (token_long(tokens, 3, &mixer->maxv) != 0) ||
+        (token_long(tokens, 4, &mixer->mindecibels) != 0) ||
+        (token_long(tokens, 5, &mixer->maxdecibels) != 0) ||
+        (token_int(tokens, 6, &mixer->has_a_decibel_range) != 0) ||
+        (token_int(tokens, 7, &mixer->lowest_value_is_mute) != 0))
+      return -1;
+    mixer->index = index;
+    mixer->capture = strcmp(name, "capture_mixer") == 0;
+    copy_token(tokens, 8, mixer->name, sizeof(mixer->name));
+    if (tokens->count == 12) {
+      int curve;
+      if ((token_int(tokens, 9, &curve) != 0) ||
+          (token_long(tokens, 10, &mixer->volume_curve_error) != 0))
+        return -1;
+      mixer->volume_curve = (volume_curve_t)curve;
+      char *point = tokens->token[11];
+      while ((*point != '\0') && (mixer->volume_point_count < VOLUME_CURVE_POINTS)) {
+        volume_point *p = &mixer->volume_points[mixer->volume_point_count++];
+        char *volume_end, *decibels_end;
+        p->volume = strtol(point, &volume_end, 10);
+        p->decibels = strtol(volume_end, &decibels_end, 10);
+        if ((volume_end == point) || (decibels_end == volume_end))
+          return -1;
+        point = decibels_end;
+      }
+    }
+    mixers->mixer_count++;
+  } else if (((strcmp(name, "open") == 0) || (strcmp(name, "open_capture") == 0)) &&
+             (tokens->count == 4) && (tokens->equals == 2)) {
+    replay_session *sessions =
+        room_for_one_more(replay.sessions, replay.session_count, &replay.sessions_allocated,
+                          sizeof(replay_session));
+    if (sessions == NULL)
+      return -1;
+    replay.sessions = sessions;
+    replay_session *session = &sessions[replay.session_count];
+    memset(session, 0, sizeof(replay_session));
+    if (token_int(tokens, 3, &session->open_result) != 0)
+      return -1;
+    session->interface_name = strdup(tokens->token[1]);
+    if (session->interface_name == NULL)
+      return -1;
+    session->stream =
+        strcmp(name, "open_capture") == 0 ? SND_PCM_STREAM_CAPTURE : SND_PCM_STREAM_PLAYBACK;
+    // if it was opened, the calls made on it follow
+    current_session = session->open_result == 0 ? (ssize_t)replay.session_count : -1;
+    replay.session_count++;
+  } else {
+    // it must be a call made on the PCM that is open
+    call_kind kind;
+    for (kind = 0; (kind < CALL_KIND_COUNT) && (strcmp(name, call_names[kind]) != 0); kind++)
+      ;
+    if ((kind == CALL_KIND_COUNT) || (current_session < 0) ||
+        (tokens->equals != 1 + call_argument_counts[kind]) ||
+        (tokens->count <= tokens->equals + 1) ||
+        (tokens->count > tokens->equals + 1 + CALL_RESULT_COUNT))
+      return -1;
+    replay_session *session = &replay.sessions[current_session];
+    recorded_call *calls = room_for_one_more(session->calls, session->call_count,
+                                             &session->calls_allocated, sizeof(recorded_call));
+    if (calls == NULL)
+      return -1;
+    session->calls = calls;
+    recorded_call *call = &calls[session->call_count];
+    memset(call, 0, sizeof(recorded_call));
+    call->kind = kind;
+    unsigned int i;
+    for (i = 0; i < call_argument_counts[kind]; i++)
+      if (token_number(tokens, 1 + i, &call->arguments[i]) != 0)
+        return -1;
+    for (i = tokens->equals + 1; i < tokens->count; i++) {
+      if (((kind == CALL_CHANNEL_MAP) || (kind == CALL_CHANNEL_MAPS)) &&
+          (i == tokens->equals + 2)) {
+        call->text = strdup(tokens->token[i]);
+        if (call->text == NULL)
+          return -1;
+      } else if (token_number(tokens, i, &call->results[i - tokens->equals - 1]) != 0) {
+        return -1;
+      }
+    }
+    session->call_count++;
+    if (kind == CALL_CLOSE)
+      current_session = -1;
+  }
+  return 0;
+}
+
+// return the next call recorded on the PCM if it's the one being made, or NULL if not
+static recorded_call *replay_call(snd_pcm_t *handle, call_kind kind, int64_t argument0,
+                                  int64_t argument1) {
+  replay_session *session = (replay_session *)handle;
+  if (session->diverged != 0)
+    return NULL;
+  if (session->next_call < session->call_count) {
+    recorded_call *call = &session->calls[session->next_call];
+    if ((call->kind == kind) && (call->arguments[0] == argument0) &&
+        (call->arguments[1] == argument1)) {
+      session->next_call++;
+      return call;
+    }
+  }
+  session->diverged = 1;
+  pthread_mutex_lock(&replay.lock);
+  replay.divergences++;
+  pthread_mutex_unlock(&replay.lock);
+  warn("the replay of \"%s\" has diverged from the recording at call %zu, \"%s\".",
+       session->interface_name, session->next_call + 1, call_names[kind]);
+  return NULL;
+}
+
+static const char *replay_library_version(void) { return replay.library_version; }
+
+static size_t replay_get_control_interface_names(char ***control_interface_names) {
+  size_t count = 0;
+  *control_interface_names = malloc(sizeof(char *) * (replay.control_interface_name_count + 1));
+  if (*control_interface_names != NULL) {
+    for (count = 0; count < replay.control_interface_name_count; count++) {
+      (*control_interface_names)[count] = strdup(replay.control_interface_names[count]);
+      if ((*control_interface_names)[count] == NULL)
+        break;
+    }
+  }
+  return count;
+}
+
+static int replay_get_card_info(const char *control_interface_name, card_probe *card) {
+  int result = -ENODEV;
+  pthread_mutex_lock(&replay.lock);
+  size_t i;
+  for (i = 0; i < replay.card_info_count; i++) {
+    replay_card_info *card_info = &replay.card_infos[i];
+    if ((card_info->used == 0) &&
+        (strcmp(card_info->control_interface_name, control_interface_name) == 0)) {
+      card_info->used = 1;
+      result = card_info->result;
+      card->card_number = card_info->card.card_number;
+      memcpy(card->control_interface_name, card_info->card.control_interface_name,
+             sizeof(card->control_interface_name));
+      memcpy(card->driver, card_info->card.driver, sizeof(card->driver));
+      memcpy(card->name, card_info->card.name, sizeof(card->name));
+      memcpy(card->longname, card_info->card.longname, sizeof(card->longname));
+      memcpy(card->components, card_info->card.components, sizeof(card->components));
+      break;
+    }
+  }
+  pthread_mutex_unlock(&replay.lock);
+  if (i == replay.card_info_count)
+    warn("\"%s\" is not in the recording.", control_interface_name);
+  return result;
+}
+
+static int replay_enumerate_card(const char *control_interface_name, card_probe *card) {
+  replay_enumeration *enumeration = NULL;
+  pthread_mutex_lock(&replay.lock);
+  size_t i;
+  for (i = 0; (i < replay.enumeration_count) && (enumeration == NULL); i++)
+    if ((replay.enumerations[i].used == 0) &&
+        (strcmp(replay.enumerations[i].control_interface_name, control_interface_name) == 0)) {
+      enumeration = &replay.enumerations[i];
+      enumeration->used = 1;
+    }
+  pthread_mutex_unlock(&replay.lock);
+  if (enumeration == NULL) {
+    warn("the devices of \"%s\" are not in the recording.", control_interface_name);
+    return -ENODEV;
+  }
+  if (enumeration->device_count != 0) {
+    card->devices = arena_alloc(card->arena, sizeof(card_device) * enumeration->device_count);
+    if (card->devices == NULL)
+      return -ENOMEM;
+    memcpy(card->devices, enumeration->devices, sizeof(card_device) * enumeration->device_count);
+    card->device_count = enumeration->device_count;
+  }
+  if (enumeration->probe_count != 0) {
+    card->probes = arena_alloc(card->arena, sizeof(interface_probe) * enumeration->probe_count);
+    if (card->probes == NULL)
+      return -ENOMEM;
+    memcpy(card->probes, enumeration->probes, sizeof(interface_probe) * enumeration->probe_count);
+    card->probe_count = enumeration->probe_count;
+  }
+  return enumeration->result;
+}
+
+static int replay_load_mixers(const char *device_name, mixer_bundle_t *mixers) {
+  replay_mixers *recorded_mixers = NULL;
+  pthread_mutex_lock(&replay.lock);
+  size_t i;
+  for (i = 0; (i < replay.mixers_count) && (recorded_mixers == NULL); i++)
+    if ((replay.mixers[i].used == 0) && (strcmp(replay.mixers[i].device_name, device_name) == 0)) {
+      recorded_mixers = &replay.mixers[i];
+      recorded_mixers->used = 1;
+    }
+  pthread_mutex_unlock(&replay.lock);
+  if (recorded_mixers == NULL) {
+    warn("the mixers of \"%s\" are not in the recording.", device_name);
+    return -ENODEV;
+  }
+  if (recorded_mixers->mixer_count != 0) {
+    mixers->mixer =
+        arena_alloc(mixers->arena, sizeof(mixer_info_t) * recorded_mixers->mixer_count);
+    if (mixers->mixer == NULL)
+      return -ENOMEM;
+    memcpy(mixers->mixer, recorded_mixers->mixers,
+           sizeof(mixer_info_t) * recorded_mixers->mixer_count);
+    mixers->size = recorded_mixers->mixer_count;
+    mixers->first_free = recorded_mixers->mixer_count;
+  }
+  return recorded_mixers->result;
+}
+
+static int replay_pcm_open(snd_pcm_t **handle, const char *interface_name,
+                           snd_pcm_stream_t stream) {
+  replay_session *session = NULL;
+  pthread_mutex_lock(&replay.lock);
+  size_t i;
+  for (i = 0; (i < replay.session_count) && (session == NULL); i++)
+    if ((replay.sessions[i].used == 0) && (replay.sessions[i].stream == stream) &&
+        (strcmp(replay.sessions[i].interface_name, interface_name) == 0)) {
+      session = &replay.sessions[i];
+      session->used = 1;
+    }
+  if (session == NULL)
+    replay.divergences++;
+  pthread_mutex_unlock(&replay.lock);
+  if (session == NULL) {
+    warn("the replay has diverged from the recording: \"%s\" was not opened as often as this.",
+         interface_name);
+    return -ENOENT;
+  }
+  if (session->open_result == 0)
+    *handle = (snd_pcm_t *)session;
+  return session->open_result;
+}
+
+static int replay_pcm_close(snd_pcm_t *handle) {
+  recorded_call *call = replay_call(handle, CALL_CLOSE, 0, 0);
+  return call != NULL ? call->results[0] : -EIO;
+}
+
+static int replay_hw_free(snd_pcm_t *handle) {
+  recorded_call *call = replay_call(handle, CALL_FREE, 0, 0);
+  return call != NULL ? call->results[0] : -EIO;
+}
+
+static int replay_hw_params_any(snd_pcm_t *handle,
+                                __attribute__((unused)) snd_pcm_hw_params_t *params) {
+  recorded_call *call = replay_call(handle, CALL_ANY, 0, 0);
+  return call != NULL ? call->results[0] : -EIO;
+}
+
+static int replay_hw_params_set_access(snd_pcm_t *handle,
+                                       __attribute__((unused)) snd_pcm_hw_params_t *params,
+                                       snd_pcm_access_t access) {
+  recorded_call *call = replay_call(handle, CALL_ACCESS, access, 0);
+  return call != NULL ? call->results[0] : -EIO;
+}
+
+static int replay_hw_params_set_channels(snd_pcm_t *handle,
+                                         __attribute__((unused)) snd_pcm_hw_params_t *params,
+                                         unsigned int channels) {
+  recorded_call *call = replay_call(handle, CALL_CHANNELS, channels, 0);
+  return call != NULL ? call->results[0] : -EIO;
+}
+
+static int replay_hw_params_set_format(snd_pcm_t *handle,
+                                       __attribute__((unused)) snd_pcm_hw_params_t *params,
+                                       snd_pcm_format_t format) {
+  recorded_call *call = replay_call(handle, CALL_FORMAT, format, 0);
+  return call != NULL ? call->results[0] : -EIO;
+}
+
+static int replay_hw_params_set_rate_near(snd_pcm_t *handle,
+                                          __attribute__((unused)) snd_pcm_hw_params_t *params,
+                                          unsigned int *rate, int *dir) {
+  recorded_call *call = replay_call(handle, CALL_RATE, *rate, *dir);
+  if (call == NULL)
+    return -EIO;
+  *rate = call->results[1];
+  *dir = call->results[2];
+  return call->results[0];
+}
+
+static int replay_hw_params_test_channels(snd_pcm_t *handle,
+                                          __attribute__((unused)) snd_pcm_hw_params_t *params,
+                                          unsigned int channels) {
+  recorded_call *call = replay_call(handle, CALL_TEST_CHANNELS, channels, 0);
+  return call != NULL ? call->results[0] : -EIO;
+}
+
+static int replay_hw_params_test_format(snd_pcm_t *handle,
+                                        __attribute__((unused)) snd_pcm_hw_params_t *params,
+                                        snd_pcm_format_t format) {
+  recorded_call *call = replay_call(handle, CALL_TEST_FORMAT, format, 0);
+  return call != NULL ? call->results[0] : -EIO;
+}
+
+// the calls that pass back a single number
+static int replay_value(snd_pcm_t *handle, call_kind kind, unsigned int *value) {
+  recorded_call *call = replay_call(handle, kind, 0, 0);
+  if (call == NULL)
+    return -EIO;
+  *value = call->results[1];
+  return call->results[0];
+}
+
+static int replay_hw_params_get_channels_min(snd_pcm_t *handle,
+                                             __attribute__((unused))
+                                             const snd_pcm_hw_params_t *params,
+                                             unsigned int *channels) {
+  return replay_value(handle, CALL_CHANNELS_MIN, channels);
+}
+
+static int replay_hw_params_get_channels_max(snd_pcm_t *handle,
+                                             __attribute__((unused))
+                                             const snd_pcm_hw_params_t *params,
+                                             unsigned int *channels) {
+  return replay_value(handle, CALL_CHANNELS_MAX, channels);
+}
+
+static int replay_hw_params_get_rate_min(snd_pcm_t *handle,
+                                         __attribute__((unused)) const snd_pcm_hw_params_t *params,
+                                         unsigned int *rate) {
+  return replay_value(handle, CALL_RATE_MIN, rate);
+}
+
+static int replay_hw_params_get_rate_max(snd_pcm_t *handle,
+                                         __attribute__((unused)) const snd_pcm_hw_params_t *params,
+                                         unsigned int *rate) {
+  return replay_value(handle, CALL_RATE_MAX, rate);
+}
+
+static void replay_hw_params_get_format_mask(snd_pcm_t *handle,
+                                             __attribute__((unused)) snd_pcm_hw_params_t *params,
+                                             snd_pcm_format_mask_t *mask) {
+  snd_pcm_format_mask_none(mask);
+  recorded_call *call = replay_call(handle, CALL_FORMAT_MASK, 0, 0);
+  if (call != NULL) {
+    bitset formats;
+    unsigned int w;
+    for (w = 0; w < BITSET_WORDS; w++)
+      formats.word[w] = call->results[1 + w];
+    int format;
+    bitset_for_each(format, &formats) {
+      snd_pcm_format_mask_set(mask, (snd_pcm_format_t)format);
+    }
+  }
+}
+
+static int replay_hw_params_get_buffer_limits(snd_pcm_t *handle,
+                                              __attribute__((unused))
+                                              const snd_pcm_hw_params_t *params,
+                                              buffer_limits *limits) {
+  recorded_call *call = replay_call(handle, CALL_BUFFER_LIMITS, 0, 0);
+  if (call == NULL)
+    return -EIO;
+  limits->period_size_min = call->results[1];
+  limits->period_size_max = call->results[2];
+  limits->buffer_size_min = call->results[3];
+  limits->buffer_size_max = call->results[4];
+  limits->periods_min = call->results[5];
+  limits->periods_max = call->results[6];
+  return call->results[0];
+}
+
+// Recordings made before identities were recorded don't have them, so if the next call isn't
+// one, the identity is simply not available, and the replay carries on.
+static int replay_pcm_identity(snd_pcm_t *handle, pcm_signature *signature) {
+  replay_session *session = (replay_session *)handle;
+  if ((session->diverged != 0) || (session->next_call >= session->call_count) ||
+      (session->calls[session->next_call].kind != CALL_IDENTITY))
+    return -ENXIO;
+  recorded_call *call = replay_call(handle, CALL_IDENTITY, 0, 0);
+  if (call->results[0] == 0) {
+    signature->type = (snd_pcm_type_t)call->results[1];
+    signature->card = call->results[2];
+    signature->device = call->results[3];
+    signature->subdevice = call->results[4];
+  }
+  return call->results[0];
+}
+
+static int replay_hw_params(snd_pcm_t *handle,
+                            __attribute__((unused)) snd_pcm_hw_params_t *params) {
+  recorded_call *call = replay_call(handle, CALL_COMMIT, 0, 0);
+  return call != NULL ? call->results[0] : -EIO;
+}
+
+static void replay_get_channel_map(snd_pcm_t *handle, char *store) {
+  store[0] = '\0';
+  recorded_call *call = replay_call(handle, CALL_CHANNEL_MAP, 0, 0);
+  if ((call != NULL) && (call->text != NULL))
+    snprintf(store, CHANNEL_MAP_STORE_SIZE, "%s", call->text);
+}
+
+static int replay_query_channel_maps(snd_pcm_t *handle, channel_map_list *maps) {
+  bitset_clear(&maps->channel_counts);
+  recorded_call *call = replay_call(handle, CALL_CHANNEL_MAPS, 0, 0);
+  if (call == NULL)
+    return -EIO;
+  const char *line = call->text != NULL ? call->text : "";
+  while (*line != '\0') {
+    const char *end = strchr(line, '\n');
+    if (end == NULL)
+      end = line + strlen(line);
+    char *map;
+    unsigned long channels = strtoul(line, &map, 10);
+    if ((map < end) && (*map == ' ') && (channels < BITSET_SIZE)) {
+      map++;
+      maps->type[channels] = SND_CHMAP_TYPE_FIXED;
+      int type;
+      for (type = 0; type <= SND_CHMAP_TYPE_LAST; type++) {
+        const char *type_name = snd_pcm_chmap_type_name((enum snd_pcm_chmap_type)type);
+        size_t length = strlen(type_name);
+        if ((end - map > (ptrdiff_t)length) && (strncmp(map, type_name, length) == 0) &&
+            (map[length] == ' ')) {
+          maps->type[channels] = type;
+          map += length + 1;
+          break;
+        }
+      }
+      snprintf(maps->map[channels], CHANNEL_MAP_STORE_SIZE, "%.*s", (int)(end - map), map);
+      bitset_add(&maps->channel_counts, channels);
+    }
+    line = *end == '\n' ? end + 1 : end;
+  }
+  return call->results[0];
+}
+
+static const probe_backend replay_backend = {
+    .library_version = replay_library_version,
+    .get_control_interface_names = replay_get_control_interface_names,
+    .get_card_info = replay_get_card_info,
+    .enumerate_card = replay_enumerate_card,
+    .load_mixers = replay_load_mixers,
+    .pcm_open = replay_pcm_open,
+    .pcm_close = replay_pcm_close,
+    .pcm_identity = replay_pcm_identity,
+    .hw_free = replay_hw_free,
+    .hw_params_any = replay_hw_params_any,
+    .hw_params_set_access = replay_hw_params_set_access,
+    .hw_params_set_channels = replay_hw_params_set_channels,
+    .hw_params_set_format = replay_hw_params_set_format,
+    .hw_params_set_rate_near = replay_hw_params_set_rate_near,
+    .hw_params_test_channels = replay_hw_params_test_channels,
+    .hw_params_test_format = replay_hw_params_test_format,
+    .hw_params_get_channels_min = replay_hw_params_get_channels_min,
+    .hw_params_get_channels_max = replay_hw_params_get_channels_max,
+    .hw_params_get_rate_min = replay_hw_params_get_rate_min,
+    .hw_params_get_rate_max = replay_hw_params_get_rate_max,
+    .hw_params_get_format_mask = replay_hw_params_get_format_mask,
+    .hw_params_get_buffer_limits = replay_hw_params_get_buffer_limits,
+    .hw_params = replay_hw_params,
+    .get_channel_map = replay_get_channel_map,
+    .query_channel_maps = replay_query_channel_maps};
+
+const probe_backend *replay_backend_open(const char *path) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL)
+    return NULL;
+  current_session = -1;
+  current_enumeration = -1;
+  current_mixers = -1;
+  char *line = NULL;
+  size_t line_size = 0;
+  size_t line_number = 0;
+  int failed = 0;
+  while ((failed == 0) && (getline(&line, &line_size, file) != -1)) {
+    line_number++;
+    recording_line tokens;
+    if (split_line(line, &tokens) != 0) {
+      failed = 1;
+    } else if (line_number == 1) {
+      int64_t version;
+      if ((tokens.count != 3) || (strcmp(tokens.token[0], RECORDING_MAGIC) != 0) ||
+          (token_number(&tokens, 1, &version) != 0) || (version != RECORDING_VERSION))
+        failed = 1;
+      else
+        copy_token(&tokens, 2, replay.library_version, sizeof(replay.library_version));
+    } else if (tokens.count != 0) {
+      failed = read_recording_line(&tokens);
+    }
+  }
+  free(line);
+  fclose(file);
+  if ((failed == 0) && (line_number == 0))
+    failed = 1;
+  if (failed != 0) {
+    if (line_number > 1)
+      warn("line %zu of the recording \"%s\" can't be read.", line_number, path);
+    replay_backend_close();
+    errno = EINVAL;
+    return NULL;
+  }
+  debug(1, "the recording \"%s\" has %zu cards and %zu PCMs that were opened.", path,
+        replay.card_info_count, replay.session_count);
+  return &replay_backend;
+}
+
+unsigned int replay_backend_divergences(void) { return replay.divergences; }
+
+void replay_backend_close(void) {
+  size_t i, j;
+  for (i = 0; i < replay.control_interface_name_count; i++)
+    free(replay.control_interface_names[i]);
+  free(replay.control_interface_names);
+  for (i = 0; i < replay.card_info_count; i++)
+    free(replay.card_infos[i].control_interface_name);
+  free(replay.card_infos);
+  for (i = 0; i < replay.enumeration_count; i++) {
+    free(replay.enumerations[i].control_interface_name);
+    free(replay.enumerations[i].devices);
+    free(replay.enumerations[i].probes);
+  }
+  free(replay.enumerations);
+  for (i = 0; i < replay.mixers_count; i++) {
+    free(replay.mixers[i].device_name);
+    free(replay.mixers[i].mixers);
+  }
+  free(replay.mixers);
+  for (i = 0; i < replay.session_count; i++) {
+    for (j = 0; j < replay.sessions[i].call_count; j++)
+      free(replay.sessions[i].calls[j].text);
+    free(replay.sessions[i].calls);
+    free(replay.sessions[i].interface_name);
+  }
+  free(replay.sessions);
+  unsigned int divergences = replay.divergences;
+  memset(&replay, 0, sizeof(replay));
+  pthread_mutex_init(&replay.lock, NULL);
+  replay.divergences = divergences;
+}
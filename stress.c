@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) Mike Brady 2024
+ * All rights reserved.
+ * Mike Brady <4265913+mikebrady@users.noreply.github.com>
+
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// A stress benchmark for what dacquery does with the results of a scan: building the
+// configuration sets, grouping and printing the interfaces, emitting the machine-readable
+// records and storing and loading the probe cache. It works on a synthetic topology -- by
+// default 64 cards with 1000 interfaces between them, and 40 mixers on each card -- at one,
+// two, four and eight times that size, and also with all the interfaces on a single card.
+// The time per interface should stay roughly the same as the topology grows.
+//
+// dacquery.c is included, with its main() renamed, so that its static functions can be used.
+
+#define main dacquery_main
+#include "dacquery.c"
+#undef main
+
+#include <time.h>
+
+static const char *stress_channel_maps[] = {"MONO", "FL FR", "FL FR FC", "FL FR RL RR",
+                                            "FL FR RL RR FC", "FL FR RL RR FC LFE",
+                                            "FL FR RL RR FC LFE RC", "FL FR RL RR FC LFE SL SR"};
+
+static double seconds_since(const struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+// One of a small number of patterns of capabilities is used for each interface, so that there
+// are groups of identical interfaces to be found.
+static void make_configuration(configuration_bundle *configuration, unsigned int pattern) {
+  unsigned int ci, ri;
+  for (ci = 1; ci <= 2 + pattern % 7; ci++) {
+    uint16_t channel_map =
+        intern_channel_map(stress_channel_maps[(ci - 1) % 8], SND_CHMAP_TYPE_NONE);
+    for (ri = pattern % 3; ri < RATE_COUNT; ri += 1 + pattern % 2) {
+      bitset format_set;
+      bitset_clear(&format_set);
+      bitset_add(&format_set, SND_PCM_FORMAT_S16_LE);
+      bitset_add(&format_set, SND_PCM_FORMAT_S32_LE);
+      if ((ri + pattern) % 4 == 0)
+        bitset_add(&format_set, SND_PCM_FORMAT_S24_3LE);
+      add_to_configuration_sets(ci, ri, &format_set, channel_map, NULL, configuration);
+    }
+  }
+  merge_configuration_sets(configuration);
+}
+
+static int make_card(card_probe *card, int card_number, size_t interface_count) {
+  memset(card, 0, sizeof(card_probe));
+  card->arena = arena_create();
+  if (card->arena == NULL)
+    return -ENOMEM;
+  card->card_number = card_number;
+  snprintf(card->control_interface_name, sizeof(card->control_interface_name),
+           "hw:CARD=Stress%d", card_number);
+  snprintf(card->driver, sizeof(card->driver), "Stress");
+  snprintf(card->name, sizeof(card->name), "Stress Card %d", card_number);
+  snprintf(card->longname, sizeof(card->longname), "Synthetic Stress Card %d", card_number);
+  // each device has one subdevice, with an hw:, hdmi: and iec958: interface
+  size_t device_count = (interface_count + 2) / 3;
+  card->devices = arena_alloc(card->arena, sizeof(card_device) * device_count);
+  card->probes = arena_alloc(card->arena, sizeof(interface_probe) * interface_count);
+  if ((card->devices == NULL) || (card->probes == NULL))
+    return -ENOMEM;
+  size_t di, pi;
+  for (di = 0; di < device_count; di++) {
+    card->devices[di].number = di;
+    snprintf(card->devices[di].name, sizeof(card->devices[di].name), "Stress %zu", di);
+    snprintf(card->devices[di].id, sizeof(card->devices[di].id), "Stress %zu", di);
+    card->devices[di].info_available = 1;
+    card->devices[di].subdevices_available = 1;
+  }
+  card->device_count = device_count;
+  const char *prefixes[] = {"hw", "hdmi", "iec958"};
+  for (pi = 0; pi < interface_count; pi++) {
+    interface_probe *probe = &card->probes[pi];
+    probe->device_index = pi / 3;
+    snprintf(probe->interface_name, sizeof(probe->interface_name), "%s:CARD=Stress%d,DEV=%zu",
+             prefixes[pi % 3], card_number, pi / 3);
+    snprintf(probe->subdevice_name, sizeof(probe->subdevice_name), "subdevice #0");
+    configuration_bundle *configuration = arena_alloc(card->arena, sizeof(configuration_bundle));
+    if (configuration == NULL)
+      return -ENOMEM;
+    configuration->arena = card->arena;
+    memcpy(configuration->interface_name, probe->interface_name,
+           sizeof(configuration->interface_name));
+    make_configuration(configuration, (card_number + pi) % 11);
+    probe->configuration = configuration;
+  }
+  card->probe_count = interface_count;
+  card->mixers.arena = card->arena;
+  unsigned int mi;
+  for (mi = 0; mi < 40; mi++) {
+    mixer_info_t *mixer = new_mixer(&card->mixers);
+    if (mixer == NULL)
+      return -ENOMEM;
+    snprintf(mixer->name, sizeof(mixer->name), "Channel %u", mi);
+    mixer->maxv = 255;
+    mixer->has_a_decibel_range = 1;
+    mixer->mindecibels = -5100;
+  }
+  return 0;
+}
+
+static int run(size_t card_count, size_t interface_count, const char *cache_path) {
+  card_probe *cards = calloc(card_count, sizeof(card_probe));
+  FILE *null_output = fopen("/dev/null", "w");
+  probe_context context;
+  if ((cards == NULL) || (null_output == NULL) || (probe_context_init(&context) != 0)) {
+    fprintf(stderr, "could not set up the benchmark.\n");
+    return -1;
+  }
+  struct timespec start;
+  size_t ci;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (ci = 0; ci < card_count; ci++) {
+    size_t interfaces_on_card = interface_count / card_count;
+    if (ci < interface_count % card_count)
+      interfaces_on_card++;
+    if (make_card(&cards[ci], ci, interfaces_on_card) != 0) {
+      fprintf(stderr, "could not build card %zu.\n", ci);
+      return -1;
+    }
+  }
+  double build_time = seconds_since(&start);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  display_extended_information = 1;
+  for (ci = 0; ci < card_count; ci++)
+    print_card(&cards[ci], null_output);
+  double print_time = seconds_since(&start);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  output_format = OUTPUT_FORMAT_JSON;
+  json_output_begin(null_output, 0);
+  for (ci = 0; ci < card_count; ci++) {
+    emit_card_record(&context, &cards[ci]);
+    emit_mixer_records(&context, &cards[ci]);
+    size_t pi;
+    for (pi = 0; pi < cards[ci].probe_count; pi++)
+      emit_interface_records(&context, &cards[ci], &cards[ci].probes[pi]);
+  }
+  json_output_end();
+  output_format = OUTPUT_FORMAT_TEXT;
+  double json_time = seconds_since(&start);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  unlink(cache_path);
+  probe_cache *cache = probe_cache_open(cache_path, 0);
+  probe_cache_key *keys = calloc(card_count, sizeof(probe_cache_key));
+  size_t hits = 0;
+  if ((cache != NULL) && (keys != NULL)) {
+    for (ci = 0; ci < card_count; ci++) {
+      probe_cache_make_key(&cards[ci], &keys[ci]);
+      probe_cache_store(cache, &keys[ci], &cards[ci]);
+    }
+    probe_cache_close(cache);
+    cache = probe_cache_open(cache_path, 0);
+    if (cache != NULL) {
+      for (ci = 0; ci < card_count; ci++) {
+        card_probe card;
+        memset(&card, 0, sizeof(card_probe));
+        card.arena = arena_create();
+        if ((card.arena != NULL) && (probe_cache_lookup(cache, &keys[ci], &card) == 0))
+          hits++;
+        card_probe_free(&card);
+      }
+      probe_cache_close(cache);
+    }
+  }
+  free(keys);
+  unlink(cache_path);
+  double cache_time = seconds_since(&start);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (ci = 0; ci < card_count; ci++)
+    card_probe_free(&cards[ci]);
+  double release_time = seconds_since(&start);
+
+  double per_interface = 1e6 / interface_count; // in microseconds
+  printf("%6zu %7zu | %8.2f %8.2f %8.2f %8.2f %8.2f | %8.3f%s\n", card_count, interface_count,
+         build_time * per_interface, print_time * per_interface, json_time * per_interface,
+         cache_time * per_interface, release_time * per_interface,
+         build_time + print_time + json_time + cache_time + release_time,
+         hits == card_count ? "" : "  (cache lookups failed)");
+  probe_context_free(&context);
+  fclose(null_output);
+  free(cards);
+  return hits == card_count ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+  size_t card_count = 64;
+  size_t interface_count = 1000;
+  if (argc > 1)
+    card_count = strtoul(argv[1], NULL, 10);
+  if (argc > 2)
+    interface_count = strtoul(argv[2], NULL, 10);
+  if ((card_count == 0) || (interface_count < card_count)) {
+    fprintf(stderr, "usage: %s [CARDS [INTERFACES]] -- there must be at least one interface "
+                    "per card.\n", argv[0]);
+    return 1;
+  }
+  char cache_path[64];
+  snprintf(cache_path, sizeof(cache_path), "/tmp/dacquery-stress-%d.cache", getpid());
+  debug_init(0, 0, 0, 0);
+  pthread_once(&formats_to_check_once, find_formats_to_check);
+
+  int result = 0;
+  unsigned int scale;
+  printf("                 |            microseconds per interface            |  total\n");
+  printf(" cards interfaces|    build    print     json    cache  release |  seconds\n");
+  for (scale = 1; (scale <= 8) && (result == 0); scale *= 2)
+    result = run(card_count * scale, interface_count * scale, cache_path);
+  for (scale = 1; (scale <= 8) && (result == 0); scale *= 2)
+    result = run(1, interface_count * scale, cache_path);
+  arena_statistics memory;
+  arena_get_statistics(&memory);
+  printf("at most %zu bytes were held in arenas at once.\n", memory.peak_bytes_reserved);
+  return result == 0 ? 0 : 1;
+}
@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) Mike Brady 2024
+ * All rights reserved.
+ * Mike Brady <4265913+mikebrady@users.noreply.github.com>
+
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "trace.h"
+#include "json_writer.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *phase_names[TRACE_PHASE_COUNT] = {
+    "card",
+    "interface",
+    "snd_device_name_hint",
+    "snd_pcm_open",
+    "snd_pcm_hw_params_any",
+    "snd_pcm_hw_params",
+    "snd_pcm_get_chmap",
+    "snd_pcm_close",
+    "snd_mixer_load"};
+
+typedef struct {
+  uint64_t *durations; // in nanoseconds
+  size_t count;
+  size_t allocated;
+  uint64_t total;
+} phase_statistics;
+
+static int recording = 0; // non-zero if there is a trace file or statistics are being kept
+static FILE *trace_file = NULL;
+static json_writer trace_writer;
+static size_t trace_event_count = 0;
+static int keep_statistics = 0;
+static phase_statistics statistics[TRACE_PHASE_COUNT];
+static uint64_t trace_epoch = 0;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t monotonic_time_in_ns(void) {
+  struct timespec tn;
+  clock_gettime(CLOCK_MONOTONIC, &tn);
+  return (uint64_t)tn.tv_sec * 1000000000 + tn.tv_nsec;
+}
+
+static void start_recording(void) {
+  if (trace_epoch == 0)
+    trace_epoch = monotonic_time_in_ns();
+  recording = 1;
+}
+
+// write the event in the writer's buffer to the trace file -- call with the lock held
+static void write_trace_event(void) {
+  if ((trace_writer.failed == 0) && (trace_writer.length != 0)) {
+    fputs(trace_event_count == 0 ? "[\n" : ",\n", trace_file);
+    fwrite(trace_writer.buffer, 1, trace_writer.length, trace_file);
+    trace_event_count++;
+  }
+}
+
+int trace_open(const char *path) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL)
+    return -errno;
+  pthread_mutex_lock(&trace_lock);
+  trace_file = file;
+  start_recording();
+  // name the process, so the viewer doesn't just show its number
+  json_record_begin(&trace_writer);
+  json_string(&trace_writer, "name", "process_name");
+  json_string(&trace_writer, "ph", "M");
+  json_integer(&trace_writer, "pid", getpid());
+  json_object_begin(&trace_writer, "args");
+  json_string(&trace_writer, "name", "dacquery");
+  json_object_end(&trace_writer);
+  json_record_end(&trace_writer);
+  write_trace_event();
+  pthread_mutex_unlock(&trace_lock);
+  return 0;
+}
+
+void trace_close(void) {
+  pthread_mutex_lock(&trace_lock);
+  if (trace_file != NULL) {
+    fputs(trace_event_count == 0 ? "[]\n" : "\n]\n", trace_file);
+    if (fclose(trace_file) != 0)
+      warn("could not finish writing the trace file: \"%s\".", strerror(errno));
+    trace_file = NULL;
+    recording = keep_statistics;
+  }
+  json_writer_free(&trace_writer);
+  pthread_mutex_unlock(&trace_lock);
+}
+
+void trace_keep_statistics(void) {
+  pthread_mutex_lock(&trace_lock);
+  keep_statistics = 1;
+  start_recording();
+  pthread_mutex_unlock(&trace_lock);
+}
+
+uint64_t trace_start(void) {
+  if (recording == 0)
+    return 0;
+  return monotonic_time_in_ns();
+}
+
+void trace_end(trace_phase phase, uint64_t start, const char *detail) {
+  if (start == 0)
+    return;
+  uint64_t duration = monotonic_time_in_ns() - start;
+  pthread_mutex_lock(&trace_lock);
+  if (keep_statistics != 0) {
+    phase_statistics *phase_statistics = &statistics[phase];
+    if (phase_statistics->count == phase_statistics->allocated) {
+      size_t new_size = phase_statistics->allocated == 0 ? 256 : phase_statistics->allocated * 2;
+      uint64_t *new_durations =
+          realloc(phase_statistics->durations, sizeof(uint64_t) * new_size);
+      if (new_durations != NULL) {
+        phase_statistics->durations = new_durations;
+        phase_statistics->allocated = new_size;
+      }
+    }
+    if (phase_statistics->count < phase_statistics->allocated) {
+      phase_statistics->durations[phase_statistics->count++] = duration;
+      phase_statistics->total += duration;
+    }
+  }
+  if (trace_file != NULL) {
+    // a "complete" event, with its start and duration in microseconds
+    json_record_begin(&trace_writer);
+    json_string(&trace_writer, "name", detail != NULL ? detail : phase_names[phase]);
+    json_string(&trace_writer, "cat", phase_names[phase]);
+    json_string(&trace_writer, "ph", "X");
+    json_number(&trace_writer, "ts", (start - trace_epoch) / 1000.0);
+    json_number(&trace_writer, "dur", duration / 1000.0);
+    json_integer(&trace_writer, "pid", getpid());
+    json_integer(&trace_writer, "tid", syscall(SYS_gettid));
+    json_record_end(&trace_writer);
+    write_trace_event();
+  }
+  pthread_mutex_unlock(&trace_lock);
+}
+
+static int compare_durations(const void *a, const void *b) {
+  uint64_t da = *(const uint64_t *)a;
+  uint64_t db = *(const uint64_t *)b;
+  return (da > db) - (da < db);
+}
+
+// the nearest-rank percentile of the sorted durations
+static uint64_t percentile(const uint64_t *durations, size_t count, unsigned int p) {
+  size_t rank = (count * p + 99) / 100;
+  return durations[rank == 0 ? 0 : rank - 1];
+}
+
+void trace_print_statistics(FILE *output) {
+  pthread_mutex_lock(&trace_lock);
+  fprintf(output, "  --- Time: %-22s %8s %12s %12s %12s\n", "Phase", "Count", "Total ms",
+          "p50 us", "p99 us");
+  unsigned int phase;
+  for (phase = 0; phase < TRACE_PHASE_COUNT; phase++) {
+    phase_statistics *phase_statistics = &statistics[phase];
+    if (phase_statistics->count != 0) {
+      qsort(phase_statistics->durations, phase_statistics->count, sizeof(uint64_t),
+            compare_durations);
+      fprintf(output, "  --- Time: %-22s %8zu %12.3f %12.1f %12.1f\n", phase_names[phase],
+              phase_statistics->count, phase_statistics->total / 1000000.0,
+              percentile(phase_statistics->durations, phase_statistics->count, 50) / 1000.0,
+              percentile(phase_statistics->durations, phase_statistics->count, 99) / 1000.0);
+    }
+  }
+  pthread_mutex_unlock(&trace_lock);
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) Mike Brady 2024
+ * All rights reserved.
+ * Mike Brady <4265913+mikebrady@users.noreply.github.com>
+
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Timing of the phases of a scan. Each phase -- a card, an interface, or a call into ALSA such
+// as opening a PCM or committing its hardware parameters -- is timed from trace_start() to
+// trace_end(). If a trace file is open, every span is written to it as a Chrome trace event,
+// with the thread that it ran on, so the file can be loaded into chrome://tracing or Perfetto.
+// If statistics are being kept, the duration of every span is recorded so that the count,
+// total and percentiles for each phase can be printed at the end of the run. If neither is
+// wanted, timing costs next to nothing.
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum {
+  TRACE_CARD,
+  TRACE_INTERFACE,
+  TRACE_NAME_HINTS,
+  TRACE_PCM_OPEN,
+  TRACE_HW_PARAMS_ANY,
+  TRACE_HW_PARAMS,
+  TRACE_CHANNEL_MAP,
+  TRACE_PCM_CLOSE,
+  TRACE_MIXER_LOAD,
+  TRACE_PHASE_COUNT
+} trace_phase;
+
+// return 0 on success, or -errno if the file can't be opened for writing
+int trace_open(const char *path);
+void trace_close(void);
+
+void trace_keep_statistics(void);
+void trace_print_statistics(FILE *output);
+
+// return the time now, or 0 if spans aren't being recorded
+uint64_t trace_start(void);
+// detail, if not NULL, names what the span is about, e.g. the interface
+void trace_end(trace_phase phase, uint64_t start, const char *detail);
+
+#endif // _TRACE_H
@@ -0,0 +1,314 @@
+/*
+ * Copyright (c) Mike Brady 2024
+ * All rights reserved.
+ * Mike Brady <4265913+mikebrady@users.noreply.github.com>
+
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "xrun.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Each load thread scatters writes over a buffer bigger than most caches, so that it loads the
+// memory bus as well as its core.
+#define LOAD_BUFFER_SIZE (4 * 1024 * 1024)
+
+static pthread_t *load_threads = NULL;
+static unsigned int load_thread_count = 0;
+static int load_stop_requested = 0;
+static pthread_mutex_t load_lock = PTHREAD_MUTEX_INITIALIZER;
+static cpu_set_t saved_affinity; // the calling thread's affinity before the load was started
+static int affinity_saved = 0;
+static int realtime_warning_given = 0;
+
+static uint64_t monotonic_time_in_ns(void) {
+  struct timespec tn;
+  clock_gettime(CLOCK_MONOTONIC, &tn);
+  return (uint64_t)tn.tv_sec * 1000000000 + tn.tv_nsec;
+}
+
+// set the hardware parameters up for the format, channel count and rate, leaving the period and
+// buffer sizes open
+static int xrun_set_configuration(snd_pcm_t *handle, snd_pcm_hw_params_t *params,
+                                  snd_pcm_format_t format, unsigned int channels,
+                                  unsigned int rate) {
+  int ret = snd_pcm_hw_params_any(handle, params);
+  if (ret >= 0)
+    ret = snd_pcm_hw_params_set_access(handle, params, SND_PCM_ACCESS_RW_INTERLEAVED);
+  if (ret >= 0)
+    ret = snd_pcm_hw_params_set_format(handle, params, format);
+  if (ret >= 0)
+    ret = snd_pcm_hw_params_set_channels(handle, params, channels);
+  if (ret >= 0)
+    ret = snd_pcm_hw_params_set_rate(handle, params, rate, 0);
+  return ret;
+}
+
+// get the range of period sizes the interface allows at the format, channel count and rate
+static int xrun_period_range(const char *interface_name, snd_pcm_format_t format,
+                             unsigned int channels, unsigned int rate,
+                             snd_pcm_uframes_t *smallest, snd_pcm_uframes_t *largest) {
+  snd_pcm_t *handle;
+  int ret = snd_pcm_open(&handle, interface_name, SND_PCM_STREAM_PLAYBACK, 0);
+  if (ret < 0)
+    return ret;
+  snd_pcm_hw_params_t *params;
+  snd_pcm_hw_params_alloca(&params);
+  ret = xrun_set_configuration(handle, params, format, channels, rate);
+  int dir = 0;
+  if (ret >= 0)
+    ret = snd_pcm_hw_params_get_period_size_min(params, smallest, &dir);
+  if (ret >= 0)
+    ret = snd_pcm_hw_params_get_period_size_max(params, largest, &dir);
+  snd_pcm_close(handle);
+  if ((ret >= 0) && (*smallest == 0))
+    *smallest = 1;
+  return ret < 0 ? ret : 0;
+}
+
+// Stream silence for the given number of milliseconds with a period as near to period_size as
+// the interface allows and a buffer of two periods, and count the xruns. The period and buffer
+// sizes used are returned in period_size and buffer_size.
+static int xrun_trial(const char *interface_name, snd_pcm_format_t format, unsigned int channels,
+                      unsigned int rate, unsigned int milliseconds,
+                      snd_pcm_uframes_t *period_size, snd_pcm_uframes_t *buffer_size,
+                      unsigned int *xruns) {
+  *xruns = 0;
+  snd_pcm_t *handle;
+  int ret = snd_pcm_open(&handle, interface_name, SND_PCM_STREAM_PLAYBACK, 0);
+  if (ret < 0)
+    return ret;
+  snd_pcm_hw_params_t *params;
+  snd_pcm_hw_params_alloca(&params);
+  ret = xrun_set_configuration(handle, params, format, channels, rate);
+  int dir = 0;
+  if (ret >= 0)
+    ret = snd_pcm_hw_params_set_period_size_near(handle, params, period_size, &dir);
+  if (ret >= 0) {
+    *buffer_size = *period_size * 2;
+    ret = snd_pcm_hw_params_set_buffer_size_near(handle, params, buffer_size);
+  }
+  if (ret >= 0)
+    ret = snd_pcm_hw_params(handle, params);
+  if (ret >= 0) {
+    snd_pcm_hw_params_get_period_size(params, period_size, &dir);
+    snd_pcm_hw_params_get_buffer_size(params, buffer_size);
+    // start when the buffer is full, and wake up when there is room for a period
+    snd_pcm_sw_params_t *sw_params;
+    snd_pcm_sw_params_alloca(&sw_params);
+    ret = snd_pcm_sw_params_current(handle, sw_params);
+    if (ret >= 0)
+      ret = snd_pcm_sw_params_set_start_threshold(handle, sw_params, *buffer_size);
+    if (ret >= 0)
+      ret = snd_pcm_sw_params_set_avail_min(handle, sw_params, *period_size);
+    if (ret >= 0)
+      ret = snd_pcm_sw_params(handle, sw_params);
+  }
+  void *silence = NULL;
+  if (ret >= 0) {
+    silence = malloc(snd_pcm_frames_to_bytes(handle, *period_size));
+    if (silence == NULL)
+      ret = -ENOMEM;
+    else
+      ret = snd_pcm_format_set_silence(format, silence, *period_size * channels);
+  }
+  if (ret >= 0)
+    ret = snd_pcm_prepare(handle);
+  if (ret >= 0) {
+    uint64_t deadline = monotonic_time_in_ns() + (uint64_t)milliseconds * 1000000;
+    while ((ret >= 0) && (monotonic_time_in_ns() < deadline)) {
+      snd_pcm_sframes_t written = snd_pcm_writei(handle, silence, *period_size);
+      if (written == -EPIPE) {
+        (*xruns)++;
+        ret = snd_pcm_prepare(handle);
+      } else if (written < 0) {
+        ret = snd_pcm_recover(handle, written, 1); // e.g. after a suspend
+      }
+    }
+    if (ret >= 0) {
+      // an xrun since the last write would only be seen by the next one
+      snd_pcm_status_t *status;
+      snd_pcm_status_alloca(&status);
+      if ((snd_pcm_status(handle, status) == 0) &&
+          (snd_pcm_status_get_state(status) == SND_PCM_STATE_XRUN))
+        (*xruns)++;
+    }
+    snd_pcm_drop(handle);
+  }
+  free(silence);
+  snd_pcm_close(handle);
+  return ret < 0 ? ret : 0;
+}
+
+int xrun_find_smallest_period(const char *interface_name, snd_pcm_format_t format,
+                              unsigned int channels, unsigned int rate,
+                              const xrun_settings *settings, xrun_result *result) {
+  memset(result, 0, sizeof(xrun_result));
+  int old_policy = SCHED_OTHER;
+  struct sched_param old_param;
+  memset(&old_param, 0, sizeof(old_param));
+  if (settings->priority != 0) {
+    pthread_getschedparam(pthread_self(), &old_policy, &old_param);
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = settings->priority;
+    int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (ret == 0) {
+      result->realtime = 1;
+    } else if (realtime_warning_given == 0) {
+      warn("could not stream at SCHED_FIFO priority %d: \"%s\" -- streaming at the normal "
+           "priority instead.",
+           settings->priority, strerror(ret));
+      realtime_warning_given = 1;
+    }
+  }
+
+  snd_pcm_uframes_t smallest, largest;
+  int ret = xrun_period_range(interface_name, format, channels, rate, &smallest, &largest);
+  if (ret == 0) {
+    // start at the largest power of two allowed, up to XRUN_LARGEST_PERIOD
+    snd_pcm_uframes_t limit = largest < XRUN_LARGEST_PERIOD ? largest : XRUN_LARGEST_PERIOD;
+    snd_pcm_uframes_t period = 1;
+    while (period * 2 <= limit)
+      period *= 2;
+    if (period < smallest)
+      period = smallest;
+    int done = 0;
+    while ((done == 0) && (ret == 0)) {
+      snd_pcm_uframes_t period_size = period, buffer_size = 0;
+      unsigned int xruns = 0;
+      ret = xrun_trial(interface_name, format, channels, rate, settings->trial_milliseconds,
+                       &period_size, &buffer_size, &xruns);
+      if (ret == 0) {
+        result->trials++;
+        debug(2, "%u xruns on \"%s\" at %u/%s/%u with a period of %lu and a buffer of %lu.",
+              xruns, interface_name, rate, snd_pcm_format_name(format), channels, period_size,
+              buffer_size);
+        if (xruns != 0) {
+          result->failed_period_size = period_size;
+          result->xruns = xruns;
+          done = 1;
+        } else {
+          result->period_size = period_size;
+          result->buffer_size = buffer_size;
+        }
+      }
+      // halve the period, finishing with the smallest allowed
+      if (period <= smallest)
+        done = 1;
+      else if (period / 2 < smallest)
+        period = smallest;
+      else
+        period /= 2;
+    }
+  }
+  if (ret != 0) {
+    debug(1, "error %d (\"%s\") streaming to \"%s\".", ret, snd_strerror(ret), interface_name);
+    result->error = ret;
+  }
+
+  if (result->realtime != 0)
+    pthread_setschedparam(pthread_self(), old_policy, &old_param);
+  return result->error;
+}
+
+static int load_should_stop(void) {
+  pthread_mutex_lock(&load_lock);
+  int response = load_stop_requested;
+  pthread_mutex_unlock(&load_lock);
+  return response;
+}
+
+static void *load_thread(void *arg) {
+  (void)arg;
+  volatile uint64_t *buffer = calloc(1, LOAD_BUFFER_SIZE);
+  size_t words = LOAD_BUFFER_SIZE / sizeof(uint64_t);
+  uint64_t x = 88172645463325252ULL;
+  while (load_should_stop() == 0) {
+    int i;
+    for (i = 0; i < 65536; i++) {
+      // a xorshift generator, for scattered addresses
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      if (buffer != NULL)
+        buffer[x % words] += x;
+    }
+  }
+  free((void *)buffer);
+  return NULL;
+}
+
+int xrun_load_start(unsigned int thread_count) {
+  long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+  int own_cpu = sched_getcpu();
+  if ((own_cpu >= 0) &&
+      (pthread_getaffinity_np(pthread_self(), sizeof(saved_affinity), &saved_affinity) == 0)) {
+    cpu_set_t own;
+    CPU_ZERO(&own);
+    CPU_SET(own_cpu, &own);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(own), &own) == 0)
+      affinity_saved = 1;
+  }
+  load_threads = malloc(sizeof(pthread_t) * thread_count);
+  load_thread_count = 0;
+  load_stop_requested = 0;
+  if (load_threads == NULL) {
+    debug(1, "could not allocate the load threads.");
+    return 0;
+  }
+  while ((load_thread_count < thread_count) &&
+         (pthread_create(&load_threads[load_thread_count], NULL, load_thread, NULL) == 0)) {
+    if ((cpu_count > 1) && (own_cpu >= 0)) {
+      // spread the threads over the other cores
+      cpu_set_t other;
+      CPU_ZERO(&other);
+      CPU_SET((own_cpu + 1 + load_thread_count % (cpu_count - 1)) % cpu_count, &other);
+      pthread_setaffinity_np(load_threads[load_thread_count], sizeof(other), &other);
+    }
+    load_thread_count++;
+  }
+  debug(2, "%u load threads started on %ld cores.", load_thread_count, cpu_count);
+  return load_thread_count;
+}
+
+void xrun_load_stop(void) {
+  pthread_mutex_lock(&load_lock);
+  load_stop_requested = 1;
+  pthread_mutex_unlock(&load_lock);
+  unsigned int ti;
+  for (ti = 0; ti < load_thread_count; ti++)
+    pthread_join(load_threads[ti], NULL);
+  free(load_threads);
+  load_threads = NULL;
+  load_thread_count = 0;
+  if (affinity_saved != 0) {
+    pthread_setaffinity_np(pthread_self(), sizeof(saved_affinity), &saved_affinity);
+    affinity_saved = 0;
+  }
+}
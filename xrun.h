@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) Mike Brady 2024
+ * All rights reserved.
+ * Mike Brady <4265913+mikebrady@users.noreply.github.com>
+
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Finding the smallest period size at which an interface plays without an xrun. Silence is
+// streamed to the interface, at a given format, channel count and rate, for a fixed time at each
+// of a series of decreasing period sizes, with a buffer of two periods. Each write that fails
+// with -EPIPE is counted as an xrun, as is a PCM that snd_pcm_status() finds in the XRUN state at
+// the end of a trial. The series stops at the first period size at which there is an xrun.
+//
+// The streaming can be done at SCHED_FIFO priority, and synthetic load can be put on the other
+// cores by threads that do nothing but arithmetic and memory traffic.
+
+#ifndef _XRUN_H
+#define _XRUN_H
+
+#include <alsa/asoundlib.h>
+
+// the largest period size tried -- the series starts at the largest power of two up to this
+// that the interface accepts
+#define XRUN_LARGEST_PERIOD 4096
+
+typedef struct {
+  unsigned int trial_milliseconds; // how long silence is streamed at each period size
+  int priority;                    // the SCHED_FIFO priority to stream at, or 0 to leave it alone
+} xrun_settings;
+
+typedef struct {
+  unsigned int period_size;        // the smallest period size with no xruns, or 0 if none
+  unsigned int buffer_size;        // the buffer size used with it
+  unsigned int failed_period_size; // the period size at which there were xruns, or 0 if none
+  unsigned int xruns;              // how many there were
+  unsigned int trials;             // the number of period sizes tried
+  int realtime;                    // non-zero if the streaming was done at SCHED_FIFO priority
+  int error;                       // non-zero if the interface couldn't be set up or written to
+} xrun_result;
+
+// stream silence to the interface at decreasing period sizes, as above, and fill in the result;
+// returns the result's error
+int xrun_find_smallest_period(const char *interface_name, snd_pcm_format_t format,
+                              unsigned int channels, unsigned int rate,
+                              const xrun_settings *settings, xrun_result *result);
+
+// start thread_count threads of synthetic load, each kept to a core other than the calling
+// thread's, which is kept to its own core until the load is stopped; returns the number started
+int xrun_load_start(unsigned int thread_count);
+void xrun_load_stop(void);
+
+#endif // _XRUN_H